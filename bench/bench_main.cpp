@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_frame_resample.h"
+#include "bench_stats.h"
+#include "ffmpeg_decoder.h"
+#include "packet_pool.h"
+#include "spdlog/spdlog.h"
+#include "synthetic_clip.h"
+#include "video_frame_convert.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/log.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+namespace {
+
+struct BenchOptions {
+  string work_dir = "learn-ffmpeg-bench";
+  string json_path;
+  bool quick = false;
+};
+
+struct Resolution {
+  int width;
+  int height;
+};
+
+// Frames kept for the conversion stages, decoding is not part of those numbers.
+constexpr size_t kConvertFrameNum = 8;
+constexpr int kConvertRoundNum = 4;
+constexpr int kResampleRoundNum = 4;
+
+using FrameRef = shared_ptr<AVFrame>;
+
+FrameRef CloneFrame(const AVFrame* frame) {
+  return FrameRef(av_frame_clone(frame), [](AVFrame* ptr) { av_frame_free(&ptr); });
+}
+
+vector<int> GetThreadNums() {
+  int core_num = max<int>(1, thread::hardware_concurrency());
+  vector<int> thread_nums = {1};
+  for (int thread_num = 2; thread_num < core_num; thread_num *= 2) {
+    thread_nums.push_back(thread_num);
+  }
+  if (core_num > 1) {
+    thread_nums.push_back(core_num);
+  }
+  return thread_nums;
+}
+
+uint64_t GetFileSize(const string& path) {
+  error_code ec;
+  auto size = filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+int BenchDemux(const string& clip_path, const Resolution& resolution,
+               vector<BenchResult>& results) {
+  AVFormatContext* av_ctx_ptr = nullptr;
+  int ret = avformat_open_input(&av_ctx_ptr, clip_path.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    return ret;
+  }
+  shared_ptr<AVFormatContext> av_ctx(av_ctx_ptr,
+                                     [](AVFormatContext*& ptr) { avformat_close_input(&ptr); });
+  PacketPool packet_pool;
+  BenchTimer timer("demux", resolution.width, resolution.height, 1);
+  while (true) {
+    auto av_packet = packet_pool.Acquire();
+    timer.BeginItem();
+    if (av_read_frame(av_ctx.get(), av_packet.get()) < 0) {
+      break;
+    }
+    timer.EndItem(av_packet->size);
+  }
+  auto result = timer.Finish();
+  result.unit = "packet";
+  results.push_back(result);
+  return 0;
+}
+
+// Decodes the whole clip and keeps a few frames of each stream for the conversion stages.
+int BenchDecode(const string& clip_path, const Resolution& resolution,
+                vector<BenchResult>& results, vector<FrameRef>& video_frames,
+                vector<FrameRef>& audio_frames) {
+  FFmpegDecoderConfig config;
+  config.log_startup = false;
+  FFmpegDecoder ffmpeg_decoder(clip_path, config);
+  int ret = ffmpeg_decoder.Init();
+  if (ret < 0) {
+    return ret;
+  }
+  auto* video_codec_ctx = ffmpeg_decoder.GetVideoCodecCtx();
+  int picture_size = av_image_get_buffer_size(video_codec_ctx->pix_fmt, video_codec_ctx->width,
+                                              video_codec_ctx->height, 1);
+
+  BenchTimer timer("decode", resolution.width, resolution.height,
+                   video_codec_ctx->thread_count);
+  FramePtr frame;
+  while (true) {
+    timer.BeginItem();
+    ret = ffmpeg_decoder.GetNextFrame(frame);
+    if (ret < 0) {
+      break;
+    }
+    if (frame->width > 0) {
+      timer.EndItem(picture_size);
+      if (video_frames.size() < kConvertFrameNum) {
+        video_frames.push_back(CloneFrame(frame.get()));
+      }
+    } else {
+      audio_frames.push_back(CloneFrame(frame.get()));
+    }
+  }
+  results.push_back(timer.Finish());
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+void BenchConvert(const string& name, const vector<FrameRef>& frames,
+                  AVPixelFormat target_pixel_format, int target_width, int target_height,
+                  vector<BenchResult>& results) {
+  const auto* first = frames.front().get();
+  int target_size = av_image_get_buffer_size(target_pixel_format, target_width, target_height, 1);
+  for (int thread_num : GetThreadNums()) {
+    VideoFrameConvertConfig config;
+    config.target_width = target_width;
+    config.target_height = target_height;
+    config.preset = ScalePreset::kBilinear;
+    config.thread_num = thread_num;
+    VideoFrameConvert video_frame_convert(first->width, first->height,
+                                          static_cast<AVPixelFormat>(first->format),
+                                          target_pixel_format, config);
+    BenchTimer timer(name, first->width, first->height, thread_num);
+    for (int round = 0; round < kConvertRoundNum; round++) {
+      for (const auto& frame : frames) {
+        timer.BeginItem();
+        video_frame_convert.Convert(frame.get());
+        timer.EndItem(target_size);
+      }
+    }
+    results.push_back(timer.Finish());
+  }
+}
+
+void BenchResample(const string& name, const vector<FrameRef>& frames,
+                   const AVCodecContext* audio_codec_ctx, int sample_rate,
+                   const Resolution& resolution, vector<BenchResult>& results) {
+  AudioFrameResample audio_frame_resample(audio_codec_ctx, sample_rate);
+  BenchTimer timer(name, resolution.width, resolution.height, 1);
+  for (int round = 0; round < kResampleRoundNum; round++) {
+    for (const auto& frame : frames) {
+      timer.BeginItem();
+      auto samples = audio_frame_resample.Resample(frame.get());
+      timer.EndItem(samples.size());
+    }
+    audio_frame_resample.Flush();
+  }
+  auto result = timer.Finish();
+  result.unit = "audio frame";
+  results.push_back(result);
+}
+
+int BenchExport(const string& clip_path, const string& work_dir, const Resolution& resolution,
+                vector<BenchResult>& results) {
+  FFmpegDecoderConfig config;
+  config.log_startup = false;
+  config.lazy_codec_open = true;
+  FFmpegDecoder ffmpeg_decoder(clip_path, config);
+  int ret = ffmpeg_decoder.Init();
+  if (ret < 0) {
+    return ret;
+  }
+  int frame_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, resolution.width,
+                                            resolution.height, 1);
+
+  for (int worker_num : {1, max<int>(2, thread::hardware_concurrency())}) {
+    string yuv_path = fmt::format("{}/export_{}.yuv", work_dir, worker_num);
+    BenchTimer timer("export_yuv420", resolution.width, resolution.height, worker_num);
+    ret = ffmpeg_decoder.ExportYuv420(yuv_path, worker_num);
+    if (ret < 0) {
+      // A failed stage must fail the run, not show up as a fast one.
+      spdlog::error("ExportYuv420 {} workers failed, ret {}", worker_num, ret);
+      remove(yuv_path.c_str());
+      return ret;
+    }
+    uint64_t size = GetFileSize(yuv_path);
+    timer.AddItems(frame_size > 0 ? size / frame_size : 0, size);
+    results.push_back(timer.Finish());
+    remove(yuv_path.c_str());
+  }
+
+  string mkv_path = fmt::format("{}/remux.mkv", work_dir);
+  BenchTimer timer("remux", resolution.width, resolution.height, 1);
+  ret = ffmpeg_decoder.SaveStreams({RemuxOutput{
+      mkv_path, {ffmpeg_decoder.GetVideoStream()->index, ffmpeg_decoder.GetAudioStream()->index}}});
+  if (ret < 0) {
+    spdlog::error("SaveStreams {} failed, ret {}", mkv_path, ret);
+    remove(mkv_path.c_str());
+    return ret;
+  }
+  timer.AddItems(1, GetFileSize(mkv_path));
+  auto result = timer.Finish();
+  result.unit = "file";
+  results.push_back(result);
+  remove(mkv_path.c_str());
+  return 0;
+}
+
+int RunResolution(const BenchOptions& options, const Resolution& resolution,
+                  vector<BenchResult>& results) {
+  SyntheticClipConfig clip_config;
+  clip_config.width = resolution.width;
+  clip_config.height = resolution.height;
+  clip_config.frame_num = options.quick ? 50 : 250;
+  string clip_path =
+      fmt::format("{}/clip_{}x{}.mkv", options.work_dir, resolution.width, resolution.height);
+  int ret = GenerateSyntheticClip(clip_path, clip_config);
+  if (ret < 0) {
+    spdlog::error("GenerateSyntheticClip {} failed, ret {}", clip_path, ret);
+    return ret;
+  }
+
+  ret = BenchDemux(clip_path, resolution, results);
+  if (ret < 0) {
+    spdlog::error("demux bench failed, ret {}", ret);
+    return ret;
+  }
+  vector<FrameRef> video_frames;
+  vector<FrameRef> audio_frames;
+  ret = BenchDecode(clip_path, resolution, results, video_frames, audio_frames);
+  if (ret < 0) {
+    spdlog::error("decode bench failed, ret {}", ret);
+    return ret;
+  }
+  if (!video_frames.empty()) {
+    BenchConvert("convert_rgb24", video_frames, AV_PIX_FMT_RGB24, resolution.width,
+                 resolution.height, results);
+    BenchConvert("convert_half", video_frames, AV_PIX_FMT_YUV420P, (resolution.width / 2) & ~1,
+                 (resolution.height / 2) & ~1, results);
+  }
+  if (!audio_frames.empty()) {
+    // The resampler reads the source layout from a codec context, rebuild one.
+    FFmpegDecoderConfig config;
+    config.log_startup = false;
+    FFmpegDecoder ffmpeg_decoder(clip_path, config);
+    if (ffmpeg_decoder.Init() == 0) {
+      auto* audio_codec_ctx = ffmpeg_decoder.GetAudioCodecCtx();
+      BenchResample("resample", audio_frames, audio_codec_ctx, 44100, resolution, results);
+      // Same rate and layout, only the sample format changes, which skips swr.
+      BenchResample("convert_s16", audio_frames, audio_codec_ctx, audio_codec_ctx->sample_rate,
+                    resolution, results);
+    }
+  }
+  ret = BenchExport(clip_path, options.work_dir, resolution, results);
+  if (ret < 0) {
+    spdlog::error("export bench failed, ret {}", ret);
+    return ret;
+  }
+  remove(clip_path.c_str());
+  return 0;
+}
+
+int ParseOptions(int argc, char* argv[], BenchOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--quick") {
+      options.quick = true;
+    } else if (arg == "--json" && i + 1 < argc) {
+      options.json_path = argv[++i];
+    } else if (arg == "--dir" && i + 1 < argc) {
+      options.work_dir = argv[++i];
+    } else {
+      fmt::print(stderr, "usage: {} [--quick] [--json path] [--dir work_dir]\n", argv[0]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+int RunBench(int argc, char* argv[]) {
+  BenchOptions options;
+  if (ParseOptions(argc, argv, options) < 0) {
+    return 2;
+  }
+  spdlog::set_level(spdlog::level::warn);
+  av_log_set_level(AV_LOG_ERROR);
+  error_code ec;
+  filesystem::create_directories(options.work_dir, ec);
+
+  vector<Resolution> resolutions = {{640, 360}, {1280, 720}, {1920, 1080}};
+  if (options.quick) {
+    resolutions.resize(1);
+  }
+  vector<BenchResult> results;
+  for (const auto& resolution : resolutions) {
+    int ret = RunResolution(options, resolution, results);
+    if (ret < 0) {
+      return 1;
+    }
+  }
+
+  PrintResults(results);
+  if (!options.json_path.empty()) {
+    ofstream json_file(options.json_path);
+    json_file << ToJson(results);
+    if (!json_file) {
+      spdlog::error("write {} failed", options.json_path);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace ryoma
+
+int main(int argc, char* argv[]) { return ryoma::RunBench(argc, argv); }
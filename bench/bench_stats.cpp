@@ -0,0 +1,127 @@
+#include "bench_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "fmt/format.h"
+
+namespace {
+
+atomic<uint64_t> alloc_num{0};
+atomic<uint64_t> alloc_bytes{0};
+
+void* CountedAlloc(size_t size) {
+  alloc_num.fetch_add(1, memory_order_relaxed);
+  alloc_bytes.fetch_add(size, memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw bad_alloc();
+  }
+  return ptr;
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return CountedAlloc(size); }
+void* operator new[](size_t size) { return CountedAlloc(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+namespace ryoma {
+
+AllocStats GetAllocStats() {
+  AllocStats stats;
+  stats.alloc_num = alloc_num.load(memory_order_relaxed);
+  stats.alloc_bytes = alloc_bytes.load(memory_order_relaxed);
+  return stats;
+}
+
+BenchTimer::BenchTimer(const string& name, int width, int height, int thread_num) {
+  result_.name = name;
+  result_.width = width;
+  result_.height = height;
+  result_.thread_num = thread_num;
+  latencies_us_.reserve(4096);
+  alloc_start_ = GetAllocStats();
+  start_ = Clock::now();
+}
+
+void BenchTimer::BeginItem() { item_start_ = Clock::now(); }
+
+void BenchTimer::EndItem(uint64_t byte_num) {
+  latencies_us_.push_back(
+      chrono::duration<double, micro>(Clock::now() - item_start_).count());
+  result_.item_num++;
+  result_.byte_num += byte_num;
+}
+
+void BenchTimer::AddItems(uint64_t item_num, uint64_t byte_num) {
+  result_.item_num += item_num;
+  result_.byte_num += byte_num;
+}
+
+BenchResult BenchTimer::Finish() {
+  result_.elapsed_sec = chrono::duration<double>(Clock::now() - start_).count();
+  auto alloc_end = GetAllocStats();
+  result_.alloc_num = alloc_end.alloc_num - alloc_start_.alloc_num;
+  result_.alloc_bytes = alloc_end.alloc_bytes - alloc_start_.alloc_bytes;
+  if (!latencies_us_.empty()) {
+    sort(latencies_us_.begin(), latencies_us_.end());
+    auto percentile = [&](double p) {
+      size_t index = static_cast<size_t>(p * (latencies_us_.size() - 1) + 0.5);
+      return latencies_us_[index];
+    };
+    result_.latency_p50_us = percentile(0.50);
+    result_.latency_p90_us = percentile(0.90);
+    result_.latency_p99_us = percentile(0.99);
+    result_.latency_max_us = latencies_us_.back();
+  }
+  return result_;
+}
+
+namespace {
+
+double PerSec(double value, double elapsed_sec) {
+  return elapsed_sec > 0 ? value / elapsed_sec : 0;
+}
+
+}  // namespace
+
+void PrintResults(const vector<BenchResult>& results) {
+  fmt::print("{:<18} {:>10} {:>7} {:>10} {:>10} {:>9} {:>9} {:>9} {:>9}\n", "stage", "size",
+             "threads", "items/s", "MB/s", "p50 us", "p99 us", "allocs", "alloc MB");
+  for (const auto& result : results) {
+    fmt::print("{:<18} {:>10} {:>7} {:>10.1f} {:>10.1f} {:>9.1f} {:>9.1f} {:>9} {:>9.2f}\n",
+               result.name, fmt::format("{}x{}", result.width, result.height),
+               result.thread_num, PerSec(result.item_num, result.elapsed_sec),
+               PerSec(result.byte_num / 1e6, result.elapsed_sec), result.latency_p50_us,
+               result.latency_p99_us, result.alloc_num, result.alloc_bytes / 1e6);
+  }
+}
+
+string ToJson(const vector<BenchResult>& results) {
+  string json = "{\n  \"version\": 1,\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    json += fmt::format(
+        "{}\n    {{\"name\": \"{}\", \"width\": {}, \"height\": {}, \"threads\": {}, "
+        "\"unit\": \"{}\", \"items\": {}, \"bytes\": {}, \"seconds\": {:.6f}, "
+        "\"items_per_sec\": {:.3f}, \"mb_per_sec\": {:.3f}, "
+        "\"latency_us\": {{\"p50\": {:.3f}, \"p90\": {:.3f}, \"p99\": {:.3f}, \"max\": {:.3f}}}, "
+        "\"allocs\": {}, \"alloc_bytes\": {}}}",
+        i == 0 ? "" : ",", result.name, result.width, result.height, result.thread_num,
+        result.unit, result.item_num, result.byte_num, result.elapsed_sec,
+        PerSec(result.item_num, result.elapsed_sec),
+        PerSec(result.byte_num / 1e6, result.elapsed_sec), result.latency_p50_us,
+        result.latency_p90_us, result.latency_p99_us, result.latency_max_us, result.alloc_num,
+        result.alloc_bytes);
+  }
+  json += "\n  ]\n}\n";
+  return json;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace ryoma {
+
+// Heap allocations through operator new since the process started, counted by the bench
+// binary's replacement operators. av_malloc goes around them and is not included.
+struct AllocStats {
+  uint64_t alloc_num = 0;
+  uint64_t alloc_bytes = 0;
+};
+
+AllocStats GetAllocStats();
+
+struct BenchResult {
+  string name;
+  int width = 0;
+  int height = 0;
+  int thread_num = 1;
+  uint64_t item_num = 0;  // frames, packets or samples, see unit
+  string unit = "frame";
+  uint64_t byte_num = 0;
+  double elapsed_sec = 0;
+  // Per item, in microseconds; all zero when the stage is measured as a whole.
+  double latency_p50_us = 0;
+  double latency_p90_us = 0;
+  double latency_p99_us = 0;
+  double latency_max_us = 0;
+  uint64_t alloc_num = 0;
+  uint64_t alloc_bytes = 0;
+};
+
+// Collects one stage: wall time, per item latencies and the allocations in between.
+class BenchTimer {
+ public:
+  BenchTimer(const string& name, int width, int height, int thread_num);
+
+  // Brackets one item, for the latency percentiles.
+  void BeginItem();
+  void EndItem(uint64_t byte_num = 0);
+  // For stages measured as a whole.
+  void AddItems(uint64_t item_num, uint64_t byte_num);
+
+  BenchResult Finish();
+
+ private:
+  using Clock = chrono::steady_clock;
+
+  BenchResult result_;
+  Clock::time_point start_;
+  Clock::time_point item_start_;
+  AllocStats alloc_start_;
+  vector<double> latencies_us_;
+};
+
+void PrintResults(const vector<BenchResult>& results);
+string ToJson(const vector<BenchResult>& results);
+
+}  // namespace ryoma
@@ -0,0 +1,221 @@
+#include "synthetic_clip.h"
+
+#include <cmath>
+#include <functional>
+#include <memory>
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/channel_layout.h"
+}
+
+namespace ryoma {
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+struct EncodedStream {
+  shared_ptr<AVCodecContext> codec_ctx;
+  AVStream* stream = nullptr;
+  shared_ptr<AVFrame> frame;
+  int64_t next_pts = 0;
+};
+
+int OpenEncoder(AVFormatContext* av_ctx, AVCodecID codec_id,
+                const function<void(AVCodecContext*)>& setup, EncodedStream& encoded_stream) {
+  const auto* codec = avcodec_find_encoder(codec_id);
+  if (codec == nullptr) {
+    spdlog::error("encoder {} not available", avcodec_get_name(codec_id));
+    return AVERROR_ENCODER_NOT_FOUND;
+  }
+  encoded_stream.codec_ctx.reset(avcodec_alloc_context3(codec),
+                                 [](AVCodecContext* ptr) { avcodec_free_context(&ptr); });
+  if (encoded_stream.codec_ctx == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  auto* codec_ctx = encoded_stream.codec_ctx.get();
+  setup(codec_ctx);
+  if (av_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  int ret = avcodec_open2(codec_ctx, codec, nullptr);
+  if (ret < 0) {
+    spdlog::error("avcodec_open2 {} failed, ret {}", avcodec_get_name(codec_id), ret);
+    return ret;
+  }
+  encoded_stream.stream = avformat_new_stream(av_ctx, nullptr);
+  if (encoded_stream.stream == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  encoded_stream.stream->time_base = codec_ctx->time_base;
+  ret = avcodec_parameters_from_context(encoded_stream.stream->codecpar, codec_ctx);
+  if (ret < 0) {
+    return ret;
+  }
+
+  encoded_stream.frame.reset(av_frame_alloc(), [](AVFrame* ptr) { av_frame_free(&ptr); });
+  if (encoded_stream.frame == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  auto* frame = encoded_stream.frame.get();
+  if (codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO) {
+    frame->format = codec_ctx->pix_fmt;
+    frame->width = codec_ctx->width;
+    frame->height = codec_ctx->height;
+  } else {
+    frame->format = codec_ctx->sample_fmt;
+    frame->channel_layout = codec_ctx->channel_layout;
+    frame->channels = codec_ctx->channels;
+    frame->sample_rate = codec_ctx->sample_rate;
+    frame->nb_samples = codec_ctx->frame_size;
+  }
+  return av_frame_get_buffer(frame, 0);
+}
+
+// frame nullptr flushes the encoder.
+int Encode(AVFormatContext* av_ctx, EncodedStream& encoded_stream, AVFrame* frame) {
+  auto* codec_ctx = encoded_stream.codec_ctx.get();
+  int ret = avcodec_send_frame(codec_ctx, frame);
+  if (ret < 0) {
+    spdlog::error("avcodec_send_frame failed, ret {}", ret);
+    return ret;
+  }
+  shared_ptr<AVPacket> packet(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+  while ((ret = avcodec_receive_packet(codec_ctx, packet.get())) == 0) {
+    av_packet_rescale_ts(packet.get(), codec_ctx->time_base, encoded_stream.stream->time_base);
+    packet->stream_index = encoded_stream.stream->index;
+    ret = av_interleaved_write_frame(av_ctx, packet.get());
+    if (ret < 0) {
+      spdlog::error("av_interleaved_write_frame failed, ret {}", ret);
+      return ret;
+    }
+  }
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+void FillPicture(AVFrame* frame, int index) {
+  for (int y = 0; y < frame->height; y++) {
+    uint8_t* row = frame->data[0] + y * frame->linesize[0];
+    for (int x = 0; x < frame->width; x++) {
+      row[x] = static_cast<uint8_t>(x + y + index * 3);
+    }
+  }
+  for (int y = 0; y < frame->height / 2; y++) {
+    uint8_t* u_row = frame->data[1] + y * frame->linesize[1];
+    uint8_t* v_row = frame->data[2] + y * frame->linesize[2];
+    for (int x = 0; x < frame->width / 2; x++) {
+      u_row[x] = static_cast<uint8_t>(128 + y + index * 2);
+      v_row[x] = static_cast<uint8_t>(64 + x + index * 5);
+    }
+  }
+}
+
+void FillTone(AVFrame* frame, int64_t first_sample) {
+  for (int channel = 0; channel < frame->channels; channel++) {
+    auto* samples = reinterpret_cast<float*>(frame->data[channel]);
+    double frequency = 440.0 * (channel + 1);
+    for (int i = 0; i < frame->nb_samples; i++) {
+      double t = static_cast<double>(first_sample + i) / frame->sample_rate;
+      samples[i] = static_cast<float>(0.25 * sin(2 * kPi * frequency * t));
+    }
+  }
+}
+
+}  // namespace
+
+int GenerateSyntheticClip(const string& path, const SyntheticClipConfig& config) {
+  AVFormatContext* av_ctx_ptr = nullptr;
+  int ret = avformat_alloc_output_context2(&av_ctx_ptr, nullptr, "matroska", path.c_str());
+  if (ret < 0) {
+    spdlog::error("avformat_alloc_output_context2 {} failed, ret {}", path, ret);
+    return ret;
+  }
+  shared_ptr<AVFormatContext> av_ctx(av_ctx_ptr, [](AVFormatContext* ptr) {
+    avio_closep(&ptr->pb);
+    avformat_free_context(ptr);
+  });
+
+  EncodedStream video;
+  ret = OpenEncoder(av_ctx.get(), AV_CODEC_ID_MPEG4, [&](AVCodecContext* codec_ctx) {
+    codec_ctx->width = config.width;
+    codec_ctx->height = config.height;
+    codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    codec_ctx->time_base = AVRational{1, config.fps};
+    codec_ctx->framerate = AVRational{config.fps, 1};
+    codec_ctx->gop_size = config.gop_size;
+    codec_ctx->max_b_frames = 2;
+    codec_ctx->bit_rate = static_cast<int64_t>(config.width) * config.height * config.fps / 10;
+  }, video);
+  if (ret < 0) {
+    return ret;
+  }
+  EncodedStream audio;
+  if (config.with_audio) {
+    ret = OpenEncoder(av_ctx.get(), AV_CODEC_ID_AAC, [&](AVCodecContext* codec_ctx) {
+      codec_ctx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+      codec_ctx->sample_rate = config.sample_rate;
+      codec_ctx->channel_layout = AV_CH_LAYOUT_STEREO;
+      codec_ctx->channels = 2;
+      codec_ctx->time_base = AVRational{1, config.sample_rate};
+      codec_ctx->bit_rate = 128000;
+    }, audio);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = avio_open(&av_ctx->pb, path.c_str(), AVIO_FLAG_WRITE);
+  if (ret < 0) {
+    spdlog::error("avio_open {} failed, ret {}", path, ret);
+    return ret;
+  }
+  ret = avformat_write_header(av_ctx.get(), nullptr);
+  if (ret < 0) {
+    spdlog::error("avformat_write_header {} failed, ret {}", path, ret);
+    return ret;
+  }
+
+  for (int i = 0; i < config.frame_num; i++) {
+    auto* frame = video.frame.get();
+    ret = av_frame_make_writable(frame);
+    if (ret < 0) {
+      return ret;
+    }
+    FillPicture(frame, i);
+    frame->pts = video.next_pts++;
+    ret = Encode(av_ctx.get(), video, frame);
+    if (ret < 0) {
+      return ret;
+    }
+    // Audio up to the end of this picture, so the muxer interleaves without buffering much.
+    int64_t audio_end = static_cast<int64_t>(i + 1) * config.sample_rate / config.fps;
+    while (config.with_audio && audio.next_pts < audio_end) {
+      auto* audio_frame = audio.frame.get();
+      ret = av_frame_make_writable(audio_frame);
+      if (ret < 0) {
+        return ret;
+      }
+      FillTone(audio_frame, audio.next_pts);
+      audio_frame->pts = audio.next_pts;
+      audio.next_pts += audio_frame->nb_samples;
+      ret = Encode(av_ctx.get(), audio, audio_frame);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+  ret = Encode(av_ctx.get(), video, nullptr);
+  if (ret >= 0 && config.with_audio) {
+    ret = Encode(av_ctx.get(), audio, nullptr);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  return av_write_trailer(av_ctx.get());
+}
+
+}  // namespace ryoma
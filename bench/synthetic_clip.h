@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+namespace ryoma {
+
+struct SyntheticClipConfig {
+  int width = 1280;
+  int height = 720;
+  int frame_num = 120;
+  int fps = 25;
+  int gop_size = 25;
+  bool with_audio = true;
+  int sample_rate = 48000;
+};
+
+// Writes a Matroska clip with an MPEG-4 Part 2 video track and a stereo AAC track, both from
+// FFmpeg's native encoders, so the benchmark needs no sample files and no external codec. The
+// picture is a moving gradient and the audio a sine tone.
+int GenerateSyntheticClip(const string& path, const SyntheticClipConfig& config);
+
+}  // namespace ryoma
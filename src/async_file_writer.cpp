@@ -0,0 +1,205 @@
+#include "async_file_writer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+}
+
+namespace ryoma {
+
+AsyncFileWriter::AsyncFileWriter(size_t block_size, size_t block_num)
+    : block_size_(max<size_t>(block_size, 4096)),
+      block_num_(max<size_t>(block_num, 2)),
+      write_queue_(block_num_),
+      free_queue_(block_num_) {}
+
+AsyncFileWriter::~AsyncFileWriter() { Close(); }
+
+int AsyncFileWriter::Open(const string& path) {
+  Close();
+  int ret = raw_file_.Open(path);
+  if (ret < 0) {
+    return ret;
+  }
+  write_queue_.Reset();
+  free_queue_.Reset();
+  for (size_t i = 0; i < block_num_; i++) {
+    // av_malloc keeps the blocks aligned for SIMD memcpy and the kernel's page copies.
+    shared_ptr<uint8_t> data(static_cast<uint8_t*>(av_malloc(block_size_)),
+                             [](uint8_t* ptr) { av_free(ptr); });
+    if (data == nullptr) {
+      raw_file_.Close();
+      return AVERROR(ENOMEM);
+    }
+    free_queue_.Push(move(data));
+  }
+  block_ = Block();
+  position_ = 0;
+  submitted_size_ = 0;
+  error_ = 0;
+  written_bytes_ = 0;
+  block_num_written_ = 0;
+  block_wait_num_ = 0;
+  write_thread_ = thread(&AsyncFileWriter::WriteLoop, this);
+  return 0;
+}
+
+int AsyncFileWriter::Write(const uint8_t* data, size_t size) {
+  if (!write_thread_.joinable()) {
+    return AVERROR(EINVAL);
+  }
+  while (size > 0) {
+    // Contiguous with the block, or a seek back into it: keep filling it.
+    if (block_.data != nullptr &&
+        (position_ < block_.offset ||
+         position_ > block_.offset + static_cast<int64_t>(block_.size) ||
+         position_ == block_.offset + static_cast<int64_t>(block_size_))) {
+      SubmitBlock();
+    }
+    if (block_.data == nullptr) {
+      int ret = AcquireBlock();
+      if (ret < 0) {
+        return ret;
+      }
+    }
+    size_t block_pos = static_cast<size_t>(position_ - block_.offset);
+    size_t chunk = min(size, block_size_ - block_pos);
+    memcpy(block_.data.get() + block_pos, data, chunk);
+    block_.size = max(block_.size, block_pos + chunk);
+    position_ += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+  return error_;
+}
+
+void AsyncFileWriter::Seek(int64_t position) { position_ = max<int64_t>(position, 0); }
+
+int64_t AsyncFileWriter::GetPosition() const { return position_; }
+
+int64_t AsyncFileWriter::GetSize() const {
+  int64_t block_end = block_.data != nullptr ? block_.offset + block_.size : 0;
+  return max(submitted_size_, block_end);
+}
+
+int AsyncFileWriter::Close() {
+  if (!write_thread_.joinable()) {
+    return error_;
+  }
+  SubmitBlock();
+  write_queue_.Close();
+  write_thread_.join();
+  raw_file_.Close();
+  return error_;
+}
+
+shared_ptr<AVIOContext> AsyncFileWriter::CreateAvioCtx() {
+  auto* buffer = static_cast<uint8_t*>(av_malloc(kAvioBufferSize));
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+  AVIOContext* avio_ctx =
+      avio_alloc_context(buffer, kAvioBufferSize, 1, this, nullptr,
+                         &AsyncFileWriter::WritePacket, &AsyncFileWriter::SeekPacket);
+  if (avio_ctx == nullptr) {
+    av_free(buffer);
+    return nullptr;
+  }
+  return shared_ptr<AVIOContext>(avio_ctx, [](AVIOContext* ptr) {
+    avio_flush(ptr);
+    av_freep(&ptr->buffer);
+    avio_context_free(&ptr);
+  });
+}
+
+AsyncFileWriterStats AsyncFileWriter::GetStats() const {
+  AsyncFileWriterStats stats;
+  stats.written_bytes = written_bytes_;
+  stats.block_num = block_num_written_;
+  stats.block_wait_num = block_wait_num_;
+  return stats;
+}
+
+int AsyncFileWriter::AcquireBlock() {
+  shared_ptr<uint8_t> data;
+  if (!free_queue_.TryPop(data)) {
+    block_wait_num_++;
+    if (!free_queue_.Pop(data)) {
+      return AVERROR(EIO);
+    }
+  }
+  block_.data = move(data);
+  block_.size = 0;
+  block_.offset = position_;
+  return 0;
+}
+
+void AsyncFileWriter::SubmitBlock() {
+  if (block_.data == nullptr) {
+    return;
+  }
+  if (block_.size == 0) {
+    free_queue_.Push(move(block_.data));
+  } else {
+    submitted_size_ = max(submitted_size_, block_.offset + static_cast<int64_t>(block_.size));
+    write_queue_.Push(move(block_));
+  }
+  block_ = Block();
+}
+
+void AsyncFileWriter::WriteLoop() {
+  Block block;
+  while (write_queue_.Pop(block)) {
+    // After an error the blocks still go back, so the producer never waits forever.
+    if (error_ == 0) {
+      int ret = raw_file_.PWrite(block.data.get(), block.size, block.offset);
+      if (ret < 0) {
+        error_ = ret;
+      } else {
+        written_bytes_ += block.size;
+        block_num_written_++;
+      }
+    }
+    free_queue_.Push(move(block.data));
+    block = Block();
+  }
+}
+
+int AsyncFileWriter::WritePacket(void* opaque, uint8_t* buf, int buf_size) {
+  auto* writer = static_cast<AsyncFileWriter*>(opaque);
+  int ret = writer->Write(buf, buf_size);
+  return ret < 0 ? ret : buf_size;
+}
+
+int64_t AsyncFileWriter::SeekPacket(void* opaque, int64_t offset, int whence) {
+  auto* writer = static_cast<AsyncFileWriter*>(opaque);
+  int64_t position = 0;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return writer->GetSize();
+    case SEEK_SET:
+      position = offset;
+      break;
+    case SEEK_CUR:
+      position = writer->GetPosition() + offset;
+      break;
+    case SEEK_END:
+      position = writer->GetSize() + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (position < 0) {
+    return AVERROR(EINVAL);
+  }
+  writer->Seek(position);
+  return position;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "raw_file.h"
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct AsyncFileWriterStats {
+  uint64_t written_bytes = 0;
+  uint64_t block_num = 0;
+  // Writes that waited for a free block, i.e. the disk was the bottleneck.
+  uint64_t block_wait_num = 0;
+};
+
+// Sequential-ish file output that copies into large blocks and writes them with positional
+// writes on a background thread, so the producer only pays a memcpy. Seeking back is cheap:
+// inside the block being filled it only moves the cursor, elsewhere it starts a new block at
+// that offset; blocks are written in order, so later bytes always win.
+class AsyncFileWriter {
+ public:
+  static constexpr size_t kDefaultBlockSize = 4 << 20;
+  static constexpr size_t kDefaultBlockNum = 4;
+  static constexpr int kAvioBufferSize = 64 * 1024;
+
+ public:
+  explicit AsyncFileWriter(size_t block_size = kDefaultBlockSize,
+                           size_t block_num = kDefaultBlockNum);
+  ~AsyncFileWriter();
+
+  AsyncFileWriter(const AsyncFileWriter&) = delete;
+  AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+  int Open(const string& path);
+  // Returns the first error of the background thread, if any.
+  int Write(const uint8_t* data, size_t size);
+  void Seek(int64_t position);
+  int64_t GetPosition() const;
+  int64_t GetSize() const;
+  // Writes what is left and stops the thread.
+  int Close();
+
+  // A write context for avformat that lands in this writer, seekable. Must be released before
+  // Close.
+  shared_ptr<AVIOContext> CreateAvioCtx();
+
+  AsyncFileWriterStats GetStats() const;
+
+ private:
+  struct Block {
+    shared_ptr<uint8_t> data;
+    size_t size = 0;
+    int64_t offset = 0;
+  };
+
+  int AcquireBlock();
+  void SubmitBlock();
+  void WriteLoop();
+
+  static int WritePacket(void* opaque, uint8_t* buf, int buf_size);
+  static int64_t SeekPacket(void* opaque, int64_t offset, int whence);
+
+ private:
+  size_t block_size_ = 0;
+  size_t block_num_ = 0;
+
+  RawFile raw_file_;
+  BoundedQueue<Block> write_queue_;
+  // Buffers the write thread is done with; empty means every block is in flight.
+  BoundedQueue<shared_ptr<uint8_t>> free_queue_;
+  thread write_thread_;
+
+  Block block_;
+  int64_t position_ = 0;
+  int64_t submitted_size_ = 0;
+
+  atomic<int> error_{0};
+  atomic<uint64_t> written_bytes_{0};
+  atomic<uint64_t> block_num_written_{0};
+  uint64_t block_wait_num_ = 0;
+};
+
+}  // namespace ryoma
@@ -1,33 +1,167 @@
 #include "audio_frame_resample.h"
 
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/channel_layout.h"
+}
+
 namespace ryoma {
 
-ryoma::AudioFrameResample::AudioFrameResample(const AVCodecContext* audio_codec_ctx,
-                                              int sample_rate, AVSampleFormat sample_fmt)
-    : audio_codec_ctx_(audio_codec_ctx), sample_rate_(sample_rate), sample_fmt_(sample_fmt) {
-  Init();
+namespace {
+
+// Decoders leave the layout 0 when the stream does not name one.
+int64_t GetLayoutOrDefault(int64_t channel_layout, int channels) {
+  return channel_layout != 0 ? channel_layout : av_get_default_channel_layout(channels);
 }
 
-void AudioFrameResample::Init() {
-  sws_ctx_.reset(
-      swr_alloc_set_opts(nullptr, audio_codec_ctx_->channel_layout, sample_fmt_, sample_rate_,
-                         audio_codec_ctx_->channel_layout, audio_codec_ctx_->sample_fmt,
-                         audio_codec_ctx_->sample_rate, 0, nullptr),
-      [](SwrContext*& ptr) { swr_free(&ptr); });
-  swr_init(sws_ctx_.get());
-  int target_frame_buff_size = av_samples_get_buffer_size(
-      nullptr, audio_codec_ctx_->channels, audio_codec_ctx_->frame_size, sample_fmt_, 1);
-  target_frame_buff_.resize(target_frame_buff_size);
+}  // namespace
+
+AudioFrameResample::AudioFrameResample(const AVCodecContext* audio_codec_ctx, int sample_rate,
+                                       AVSampleFormat sample_fmt, int64_t channel_layout)
+    : sample_rate_(sample_rate), sample_fmt_(sample_fmt) {
+  channel_layout_ = channel_layout != 0 ? channel_layout
+                                        : GetLayoutOrDefault(audio_codec_ctx->channel_layout,
+                                                             audio_codec_ctx->channels);
+  channels_ = av_get_channel_layout_nb_channels(channel_layout_);
+  bool is_planar = av_sample_fmt_is_planar(sample_fmt_);
+  int plane_num = is_planar ? channels_ : 1;
+  plane_sample_size_ = av_get_bytes_per_sample(sample_fmt_) * (is_planar ? 1 : channels_);
+  plane_buffs_.resize(plane_num);
+  planes_.resize(plane_num);
+  out_planes_.resize(plane_num);
 }
 
-const vector<uint8_t>& AudioFrameResample::Resample(AVFrame* frame) {
-  uint8_t* audio_buff = target_frame_buff_.data();
-  int ret = swr_convert(sws_ctx_.get(), &audio_buff, target_frame_buff_.size(),
-                        (const uint8_t**)frame->data, frame->nb_samples);
+AudioSamples AudioFrameResample::Resample(const AVFrame* frame) {
+  int64_t in_channel_layout = GetLayoutOrDefault(frame->channel_layout, frame->channels);
+  auto in_sample_fmt = static_cast<AVSampleFormat>(frame->format);
+  int sample_num = 0;
+  if (in_sample_fmt_ == AV_SAMPLE_FMT_NONE || in_channel_layout != in_channel_layout_ ||
+      in_sample_fmt != in_sample_fmt_ || frame->sample_rate != in_sample_rate_) {
+    // What the old context still holds comes before this frame.
+    if (swr_ctx_ != nullptr) {
+      sample_num = Convert(nullptr, 0, 0);
+      if (sample_num < 0) {
+        return {};
+      }
+    }
+    if (InitConvert(in_channel_layout, in_sample_fmt, frame->sample_rate) < 0) {
+      return {};
+    }
+  }
+  int ret = 0;
+  if (sample_convert_func_ != nullptr) {
+    auto** out = ReserveOutput(sample_num, frame->nb_samples);
+    sample_convert_func_(frame->extended_data, out[0], frame->nb_samples, channels_);
+    ret = frame->nb_samples;
+  } else {
+    ret = Convert(const_cast<const uint8_t**>(frame->extended_data), frame->nb_samples,
+                  sample_num);
+  }
   if (ret < 0) {
     return {};
   }
-  return target_frame_buff_;
+  return GetSamples(sample_num + ret);
+}
+
+AudioSamples AudioFrameResample::Flush() {
+  if (swr_ctx_ == nullptr) {
+    return {};
+  }
+  int ret = Convert(nullptr, 0, 0);
+  return ret < 0 ? AudioSamples() : GetSamples(ret);
+}
+
+void AudioFrameResample::Reset() {
+  if (swr_ctx_ != nullptr) {
+    // Reinitializing an open context drops its buffered samples and filter history.
+    swr_init(swr_ctx_.get());
+  }
+}
+
+int AudioFrameResample::GetSampleRate() const { return sample_rate_; }
+
+AVSampleFormat AudioFrameResample::GetSampleFormat() const { return sample_fmt_; }
+
+int64_t AudioFrameResample::GetChannelLayout() const { return channel_layout_; }
+
+int AudioFrameResample::GetChannels() const { return channels_; }
+
+int AudioFrameResample::InitConvert(int64_t in_channel_layout, AVSampleFormat in_sample_fmt,
+                                    int in_sample_rate) {
+  // Stays unset until this succeeds, so the next frame tries again.
+  in_sample_fmt_ = AV_SAMPLE_FMT_NONE;
+  swr_ctx_.reset();
+  sample_convert_func_ = nullptr;
+  // Same rate and layout is a plain format conversion, done by a kernel without swr.
+  if (in_sample_rate == sample_rate_ && in_channel_layout == channel_layout_) {
+    sample_convert_func_ = GetSampleConvertFunc(in_sample_fmt, sample_fmt_, channels_);
+  }
+  if (sample_convert_func_ == nullptr) {
+    int ret = InitSwr(in_channel_layout, in_sample_fmt, in_sample_rate);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  in_channel_layout_ = in_channel_layout;
+  in_sample_fmt_ = in_sample_fmt;
+  in_sample_rate_ = in_sample_rate;
+  return 0;
+}
+
+int AudioFrameResample::InitSwr(int64_t in_channel_layout, AVSampleFormat in_sample_fmt,
+                                int in_sample_rate) {
+  swr_ctx_.reset(swr_alloc_set_opts(nullptr, channel_layout_, sample_fmt_, sample_rate_,
+                                    in_channel_layout, in_sample_fmt, in_sample_rate, 0, nullptr),
+                 [](SwrContext*& ptr) { swr_free(&ptr); });
+  if (swr_ctx_ == nullptr) {
+    spdlog::error("swr_alloc_set_opts failed");
+    return AVERROR(ENOMEM);
+  }
+  int ret = swr_init(swr_ctx_.get());
+  if (ret < 0) {
+    spdlog::error("swr_init failed, ret {}", ret);
+    swr_ctx_.reset();
+    return ret;
+  }
+  return 0;
+}
+
+int AudioFrameResample::Convert(const uint8_t** in, int in_sample_num, int out_offset) {
+  // Upper bound for this input plus everything swr buffered so far.
+  int out_sample_num = swr_get_out_samples(swr_ctx_.get(), in_sample_num);
+  if (out_sample_num < 0) {
+    spdlog::error("swr_get_out_samples failed, ret {}", out_sample_num);
+    return out_sample_num;
+  }
+  auto** out = ReserveOutput(out_offset, out_sample_num);
+  int ret = swr_convert(swr_ctx_.get(), out, out_sample_num, in, in_sample_num);
+  if (ret < 0) {
+    spdlog::error("swr_convert failed, ret {}", ret);
+  }
+  return ret;
+}
+
+uint8_t** AudioFrameResample::ReserveOutput(int out_offset, int sample_num) {
+  size_t offset_size = static_cast<size_t>(out_offset) * plane_sample_size_;
+  size_t need_size = offset_size + static_cast<size_t>(sample_num) * plane_sample_size_;
+  for (size_t i = 0; i < planes_.size(); i++) {
+    if (plane_buffs_[i].size() < need_size) {
+      plane_buffs_[i].resize(need_size);
+    }
+    planes_[i] = plane_buffs_[i].data();
+    out_planes_[i] = planes_[i] + offset_size;
+  }
+  return out_planes_.data();
+}
+
+AudioSamples AudioFrameResample::GetSamples(int sample_num) const {
+  AudioSamples samples;
+  samples.planes = planes_.data();
+  samples.plane_num = static_cast<int>(planes_.size());
+  samples.sample_num = sample_num;
+  samples.plane_size = static_cast<size_t>(sample_num) * plane_sample_size_;
+  return samples;
 }
 
-}  // namespace ryoma
\ No newline at end of file
+}  // namespace ryoma
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "sample_convert.h"
+
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libswresample/swresample.h"
@@ -12,23 +15,74 @@ using namespace std;
 
 namespace ryoma {
 
+// Exactly the samples one call produced. Owned by the resampler and valid until its next call.
+struct AudioSamples {
+  uint8_t* const* planes = nullptr;  // one plane for packed formats, one per channel for planar
+  int plane_num = 0;
+  int sample_num = 0;     // per channel
+  size_t plane_size = 0;  // bytes of each plane
+
+  // The interleaved samples of a packed format.
+  const uint8_t* data() const { return plane_num > 0 ? planes[0] : nullptr; }
+  size_t size() const { return plane_size * plane_num; }
+  bool empty() const { return sample_num == 0; }
+};
+
+// Streaming resampler with a fixed output format. The input may change its channel layout,
+// sample format, rate or frame size from one frame to the next; swr is then rebuilt after
+// draining what the old one still held, so nothing is dropped at the switch. Input at the
+// output rate and layout skips swr for a SampleConvertFunc kernel when one exists. Output
+// buffers only grow, which after the first frames means no allocation per call.
 class AudioFrameResample {
  public:
+  // channel_layout 0 keeps the layout of the codec context.
   explicit AudioFrameResample(const AVCodecContext* audio_codec_ctx, int sample_rate = 44100,
-                              AVSampleFormat sample_fmt = AV_SAMPLE_FMT_S16);
+                              AVSampleFormat sample_fmt = AV_SAMPLE_FMT_S16,
+                              int64_t channel_layout = 0);
 
-  const vector<uint8_t>& Resample(AVFrame* frame);
+  AudioFrameResample(const AudioFrameResample&) = delete;
+  AudioFrameResample& operator=(const AudioFrameResample&) = delete;
+
+  // Empty on error, or while swr still buffers the first samples of a rate conversion.
+  AudioSamples Resample(const AVFrame* frame);
+  // The samples swr holds back for its filter; call once at the end of the stream.
+  AudioSamples Flush();
+  // Drops those samples instead, e.g. after a seek.
+  void Reset();
+
+  int GetSampleRate() const;
+  AVSampleFormat GetSampleFormat() const;
+  int64_t GetChannelLayout() const;
+  int GetChannels() const;
 
  private:
-  void Init();
+  int InitConvert(int64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate);
+  int InitSwr(int64_t in_channel_layout, AVSampleFormat in_sample_fmt, int in_sample_rate);
+  // Appends the output after out_offset samples, returns how many were produced.
+  int Convert(const uint8_t** in, int in_sample_num, int out_offset);
+  // Room for sample_num more samples after out_offset, returns the planes at that offset.
+  uint8_t** ReserveOutput(int out_offset, int sample_num);
+  AudioSamples GetSamples(int sample_num) const;
 
  private:
-  const AVCodecContext* audio_codec_ctx_;
   int sample_rate_ = 0;
   AVSampleFormat sample_fmt_;
+  int64_t channel_layout_ = 0;
+  int channels_ = 0;
+  // Bytes of one sample time in one plane, all channels for packed formats.
+  int plane_sample_size_ = 0;
+
+  // Input format swr_ctx_ was built for.
+  int64_t in_channel_layout_ = 0;
+  AVSampleFormat in_sample_fmt_ = AV_SAMPLE_FMT_NONE;
+  int in_sample_rate_ = 0;
+  shared_ptr<SwrContext> swr_ctx_;
+  // Set instead of swr_ctx_ when no resampling or remixing is needed.
+  SampleConvertFunc sample_convert_func_ = nullptr;
 
-  shared_ptr<SwrContext> sws_ctx_;
-  vector<uint8_t> target_frame_buff_;
+  vector<vector<uint8_t>> plane_buffs_;
+  vector<uint8_t*> planes_;
+  vector<uint8_t*> out_planes_;
 };
 
-}  // namespace ryoma
\ No newline at end of file
+}  // namespace ryoma
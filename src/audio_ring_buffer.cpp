@@ -0,0 +1,74 @@
+#include "audio_ring_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ryoma {
+
+AudioRingBuffer::AudioRingBuffer(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  buffer_.resize(size);
+  mask_ = size - 1;
+}
+
+size_t AudioRingBuffer::Write(const uint8_t* data, size_t size) {
+  uint64_t write_pos = write_pos_.load(memory_order_relaxed);
+  uint64_t read_pos = read_pos_.load(memory_order_acquire);
+  size_t free_size = buffer_.size() - static_cast<size_t>(write_pos - read_pos);
+  if (size > free_size) {
+    overrun_num_.fetch_add(1, memory_order_relaxed);
+    size = free_size;
+  }
+  if (size == 0) {
+    return 0;
+  }
+
+  size_t offset = static_cast<size_t>(write_pos) & mask_;
+  size_t first = min(size, buffer_.size() - offset);
+  memcpy(buffer_.data() + offset, data, first);
+  memcpy(buffer_.data(), data + first, size - first);
+  write_pos_.store(write_pos + size, memory_order_release);
+  return size;
+}
+
+size_t AudioRingBuffer::Read(uint8_t* data, size_t size) {
+  uint64_t read_pos = read_pos_.load(memory_order_relaxed);
+  uint64_t write_pos = write_pos_.load(memory_order_acquire);
+  size_t buffered_size = static_cast<size_t>(write_pos - read_pos);
+  if (size > buffered_size) {
+    underrun_num_.fetch_add(1, memory_order_relaxed);
+    size = buffered_size;
+  }
+  if (size == 0) {
+    return 0;
+  }
+
+  size_t offset = static_cast<size_t>(read_pos) & mask_;
+  size_t first = min(size, buffer_.size() - offset);
+  memcpy(data, buffer_.data() + offset, first);
+  memcpy(data + first, buffer_.data(), size - first);
+  read_pos_.store(read_pos + size, memory_order_release);
+  return size;
+}
+
+size_t AudioRingBuffer::Size() const {
+  return static_cast<size_t>(write_pos_.load(memory_order_acquire) -
+                             read_pos_.load(memory_order_acquire));
+}
+
+size_t AudioRingBuffer::Capacity() const { return buffer_.size(); }
+
+void AudioRingBuffer::Clear() { read_pos_.store(write_pos_.load(memory_order_acquire)); }
+
+AudioRingBufferStats AudioRingBuffer::GetStats() const {
+  AudioRingBufferStats stats;
+  stats.buffered_bytes = Size();
+  stats.underrun_num = underrun_num_.load(memory_order_relaxed);
+  stats.overrun_num = overrun_num_.load(memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace ryoma {
+
+struct AudioRingBufferStats {
+  size_t buffered_bytes = 0;
+  uint64_t underrun_num = 0;  // reads that got less than asked for
+  uint64_t overrun_num = 0;   // writes that found the buffer full
+};
+
+// Lock-free byte FIFO for exactly one producer thread and one consumer thread, so the audio
+// callback never waits on a lock held by the decode side. Positions only ever grow; the
+// capacity is a power of two and they are masked into the storage.
+class AudioRingBuffer {
+ public:
+  explicit AudioRingBuffer(size_t capacity);
+
+  AudioRingBuffer(const AudioRingBuffer&) = delete;
+  AudioRingBuffer& operator=(const AudioRingBuffer&) = delete;
+
+  // Producer side. Copies as much as fits and returns the byte count.
+  size_t Write(const uint8_t* data, size_t size);
+  // Consumer side. Copies up to size bytes and returns the byte count.
+  size_t Read(uint8_t* data, size_t size);
+
+  size_t Size() const;
+  size_t Capacity() const;
+
+  // Drops the buffered bytes; only while the consumer is stopped.
+  void Clear();
+
+  AudioRingBufferStats GetStats() const;
+
+ private:
+  static constexpr size_t kCacheLineSize = 64;
+
+  vector<uint8_t> buffer_;
+  size_t mask_ = 0;
+
+  // Written by the consumer, read by the producer.
+  alignas(kCacheLineSize) atomic<uint64_t> read_pos_{0};
+  atomic<uint64_t> underrun_num_{0};
+  // Written by the producer, read by the consumer.
+  alignas(kCacheLineSize) atomic<uint64_t> write_pos_{0};
+  atomic<uint64_t> overrun_num_{0};
+};
+
+}  // namespace ryoma
@@ -0,0 +1,131 @@
+#include "av_clock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace ryoma {
+
+void AvClock::Set(double pts_sec) {
+  lock_guard<mutex> lock(mutex_);
+  pts_sec_ = pts_sec;
+  updated_sec_ = GetNowSec();
+}
+
+double AvClock::Get() const {
+  lock_guard<mutex> lock(mutex_);
+  if (is_paused_ || isnan(pts_sec_)) {
+    return pts_sec_;
+  }
+  return pts_sec_ + GetNowSec() - updated_sec_;
+}
+
+bool AvClock::IsValid() const {
+  lock_guard<mutex> lock(mutex_);
+  return !isnan(pts_sec_);
+}
+
+void AvClock::SetPaused(bool is_paused) {
+  lock_guard<mutex> lock(mutex_);
+  if (is_paused == is_paused_) {
+    return;
+  }
+  double now_sec = GetNowSec();
+  if (is_paused && !isnan(pts_sec_)) {
+    pts_sec_ += now_sec - updated_sec_;
+  }
+  updated_sec_ = now_sec;
+  is_paused_ = is_paused;
+}
+
+void AvClock::Reset() {
+  lock_guard<mutex> lock(mutex_);
+  pts_sec_ = NAN;
+  updated_sec_ = 0;
+  is_paused_ = false;
+}
+
+double AvClock::GetNowSec() {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SyncClock::SyncClock(SyncMaster sync_master) : sync_master_(sync_master) {}
+
+void SyncClock::SetSyncMaster(SyncMaster sync_master) { sync_master_ = sync_master; }
+
+AvClock* SyncClock::GetAudioClock() { return &audio_clock_; }
+
+AvClock* SyncClock::GetVideoClock() { return &video_clock_; }
+
+AvClock* SyncClock::GetExternalClock() { return &external_clock_; }
+
+double SyncClock::GetMasterClock() const {
+  double clock_sec = NAN;
+  switch (sync_master_) {
+    case SyncMaster::kAudio:
+      clock_sec = audio_clock_.Get();
+      break;
+    case SyncMaster::kVideo:
+      clock_sec = video_clock_.Get();
+      break;
+    case SyncMaster::kExternal:
+      break;
+  }
+  return isnan(clock_sec) ? external_clock_.Get() : clock_sec;
+}
+
+void SyncClock::SetPaused(bool is_paused) {
+  audio_clock_.SetPaused(is_paused);
+  video_clock_.SetPaused(is_paused);
+  external_clock_.SetPaused(is_paused);
+}
+
+void SyncClock::Reset() {
+  audio_clock_.Reset();
+  video_clock_.Reset();
+  external_clock_.Reset();
+}
+
+VideoScheduler::VideoScheduler(SyncClock* sync_clock) : sync_clock_(sync_clock) {}
+
+VideoScheduler::Action VideoScheduler::Schedule(double pts_sec, double duration_sec,
+                                                double* wait_sec) {
+  *wait_sec = 0;
+  if (!sync_clock_->GetExternalClock()->IsValid()) {
+    // First frame, start the wall clock on it.
+    sync_clock_->GetExternalClock()->Set(pts_sec);
+  }
+  double master_sec = sync_clock_->GetMasterClock();
+  double diff_sec = pts_sec - master_sec;
+  if (isnan(diff_sec) || fabs(diff_sec) > kNoSyncThresholdSec) {
+    return Action::kPresent;
+  }
+  if (diff_sec > kSyncToleranceSec) {
+    *wait_sec = diff_sec;
+    return Action::kWait;
+  }
+  if (diff_sec + duration_sec < 0) {
+    return Action::kLate;
+  }
+  return Action::kPresent;
+}
+
+void VideoScheduler::OnPresented(double pts_sec, double duration_sec) {
+  double late_sec = sync_clock_->GetMasterClock() - pts_sec;
+  if (!isnan(late_sec) && late_sec > duration_sec) {
+    stats_.late_frame_num++;
+  }
+  if (!isnan(late_sec)) {
+    stats_.max_late_sec = max(stats_.max_late_sec, late_sec);
+  }
+  stats_.presented_frame_num++;
+  sync_clock_->GetVideoClock()->Set(pts_sec);
+}
+
+void VideoScheduler::OnDropped() { stats_.dropped_frame_num++; }
+
+VideoSchedulerStats VideoScheduler::GetStats() const { return stats_; }
+
+void VideoScheduler::Reset() { stats_ = VideoSchedulerStats(); }
+
+}  // namespace ryoma
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+using namespace std;
+
+namespace ryoma {
+
+// A presentation time in seconds that keeps advancing on the monotonic clock between updates,
+// so it can be read at any moment, not only when a frame or audio block was handed out.
+class AvClock {
+ public:
+  void Set(double pts_sec);
+  // NAN until the first Set.
+  double Get() const;
+  bool IsValid() const;
+
+  void SetPaused(bool is_paused);
+  void Reset();
+
+  static double GetNowSec();
+
+ private:
+  mutable mutex mutex_;
+  double pts_sec_ = NAN;
+  double updated_sec_ = 0;
+  bool is_paused_ = false;
+};
+
+enum class SyncMaster {
+  kAudio,     // follow what the audio device actually played
+  kVideo,     // follow the last presented frame
+  kExternal,  // free running wall clock started at the first frame
+};
+
+// The audio, video and external clocks of one playback, and which of them video follows.
+class SyncClock {
+ public:
+  explicit SyncClock(SyncMaster sync_master = SyncMaster::kAudio);
+
+  void SetSyncMaster(SyncMaster sync_master);
+
+  AvClock* GetAudioClock();
+  AvClock* GetVideoClock();
+  AvClock* GetExternalClock();
+
+  // Falls back to the external clock while the master has no time yet, e.g. before the audio
+  // device started.
+  double GetMasterClock() const;
+
+  void SetPaused(bool is_paused);
+  void Reset();
+
+ private:
+  SyncMaster sync_master_;
+  AvClock audio_clock_;
+  AvClock video_clock_;
+  AvClock external_clock_;
+};
+
+struct VideoSchedulerStats {
+  uint64_t presented_frame_num = 0;
+  uint64_t dropped_frame_num = 0;
+  uint64_t late_frame_num = 0;  // presented after their duration had already passed
+  double max_late_sec = 0;
+};
+
+// Decides when the next decoded frame goes on screen relative to the master clock.
+class VideoScheduler {
+ public:
+  enum class Action {
+    kWait,     // not due yet, come back after wait_sec
+    kPresent,  // due now
+    kLate,     // its whole duration already passed; drop it if a newer frame is ready
+  };
+
+ public:
+  explicit VideoScheduler(SyncClock* sync_clock);
+
+  Action Schedule(double pts_sec, double duration_sec, double* wait_sec);
+
+  void OnPresented(double pts_sec, double duration_sec);
+  void OnDropped();
+
+  VideoSchedulerStats GetStats() const;
+  void Reset();
+
+ private:
+  // Frames this close to their deadline are shown rather than waited for.
+  static constexpr double kSyncToleranceSec = 0.005;
+  // Larger gaps are a discontinuity, not drift; show the frame and let the clocks catch up.
+  static constexpr double kNoSyncThresholdSec = 10.0;
+
+  SyncClock* sync_clock_ = nullptr;
+  VideoSchedulerStats stats_;
+};
+
+}  // namespace ryoma
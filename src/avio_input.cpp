@@ -0,0 +1,114 @@
+#include "avio_input.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+}
+
+namespace ryoma {
+
+AvioInput::~AvioInput() { mapped_file_.Close(); }
+
+int AvioInput::OpenFile(const string& path, AccessHint hint) {
+  int ret = mapped_file_.Open(path);
+  if (ret < 0) {
+    spdlog::error("MappedFile::Open {} failed, ret {}", path, ret);
+    return ret;
+  }
+  mapped_file_.Advise(hint);
+  data_ = mapped_file_.GetData();
+  size_ = mapped_file_.GetSize();
+  name_ = path;
+  is_open_ = true;
+  return 0;
+}
+
+int AvioInput::OpenBuffer(const uint8_t* data, size_t size, const string& name) {
+  if (data == nullptr && size > 0) {
+    return AVERROR(EINVAL);
+  }
+  mapped_file_.Close();
+  data_ = data;
+  size_ = static_cast<int64_t>(size);
+  name_ = name;
+  is_open_ = true;
+  return 0;
+}
+
+void AvioInput::Advise(AccessHint hint) { mapped_file_.Advise(hint); }
+
+shared_ptr<AVIOContext> AvioInput::CreateAvioCtx() {
+  auto* buffer = static_cast<uint8_t*>(av_malloc(kAvioBufferSize));
+  if (buffer == nullptr) {
+    return nullptr;
+  }
+  auto* cursor = new Cursor();
+  cursor->input = this;
+  AVIOContext* avio_ctx =
+      avio_alloc_context(buffer, kAvioBufferSize, 0, cursor, &AvioInput::ReadPacket, nullptr,
+                         &AvioInput::Seek);
+  if (avio_ctx == nullptr) {
+    av_free(buffer);
+    delete cursor;
+    return nullptr;
+  }
+  return shared_ptr<AVIOContext>(avio_ctx, [](AVIOContext* ptr) {
+    delete static_cast<Cursor*>(ptr->opaque);
+    // The context may have replaced the buffer it was given.
+    av_freep(&ptr->buffer);
+    avio_context_free(&ptr);
+  });
+}
+
+const string& AvioInput::GetName() const { return name_; }
+
+int64_t AvioInput::GetSize() const { return size_; }
+
+bool AvioInput::IsOpen() const { return is_open_; }
+
+int AvioInput::ReadPacket(void* opaque, uint8_t* buf, int buf_size) {
+  auto* cursor = static_cast<Cursor*>(opaque);
+  const auto* input = cursor->input;
+  if (cursor->pos >= input->size_) {
+    return AVERROR_EOF;
+  }
+  int size = static_cast<int>(min<int64_t>(buf_size, input->size_ - cursor->pos));
+  memcpy(buf, input->data_ + cursor->pos, size);
+  cursor->pos += size;
+  return size;
+}
+
+int64_t AvioInput::Seek(void* opaque, int64_t offset, int whence) {
+  auto* cursor = static_cast<Cursor*>(opaque);
+  int64_t size = cursor->input->size_;
+  int64_t pos = 0;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return size;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = cursor->pos + offset;
+      break;
+    case SEEK_END:
+      pos = size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  // Past the end is allowed, the next read reports EOF.
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  cursor->pos = pos;
+  return pos;
+}
+
+}  // namespace ryoma
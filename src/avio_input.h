@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "mapped_file.h"
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// Demux input read through a custom AVIOContext instead of FFmpeg's file protocol. The bytes
+// are already in memory, either a memory-mapped file or a buffer the caller holds, so a read is
+// one memcpy into the context's buffer and no syscall.
+class AvioInput {
+ public:
+  static constexpr int kAvioBufferSize = 256 * 1024;
+
+ public:
+  AvioInput() = default;
+  ~AvioInput();
+
+  AvioInput(const AvioInput&) = delete;
+  AvioInput& operator=(const AvioInput&) = delete;
+
+  // Maps the whole file; name becomes the path.
+  int OpenFile(const string& path, AccessHint hint = AccessHint::kSequential);
+  // Borrows data, which must stay valid and unchanged while any context reads it.
+  int OpenBuffer(const uint8_t* data, size_t size, const string& name = "memory");
+  // Switch e.g. to kRandom before seeking around; only mapped files take the hint.
+  void Advise(AccessHint hint);
+
+  // A context with its own read position, several can read the same input at once. Must be
+  // released before the input.
+  shared_ptr<AVIOContext> CreateAvioCtx();
+
+  const string& GetName() const;
+  int64_t GetSize() const;
+  bool IsOpen() const;
+
+ private:
+  struct Cursor {
+    const AvioInput* input = nullptr;
+    int64_t pos = 0;
+  };
+
+  static int ReadPacket(void* opaque, uint8_t* buf, int buf_size);
+  static int64_t Seek(void* opaque, int64_t offset, int whence);
+
+ private:
+  MappedFile mapped_file_;
+  const uint8_t* data_ = nullptr;
+  int64_t size_ = 0;
+  string name_;
+  bool is_open_ = false;
+};
+
+}  // namespace ryoma
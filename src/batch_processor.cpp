@@ -0,0 +1,197 @@
+#include "batch_processor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "ffmpeg_decoder.h"
+#include "spdlog/spdlog.h"
+#include "work_stealing_pool.h"
+
+namespace ryoma {
+
+namespace {
+
+uint64_t GetFileSize(const string& path) {
+  error_code ec;
+  auto size = filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+}  // namespace
+
+BatchProcessor::BatchProcessor(const BatchOptions& options) : options_(options) {}
+
+int BatchProcessor::LoadManifest(const string& manifest_path, vector<BatchJob>& jobs) {
+  ifstream manifest(manifest_path);
+  if (!manifest) {
+    spdlog::error("open manifest {} failed", manifest_path);
+    return AVERROR(ENOENT);
+  }
+  string line;
+  int line_num = 0;
+  while (getline(manifest, line)) {
+    line_num++;
+    line = line.substr(0, line.find('#'));
+    istringstream fields(line);
+    string type;
+    if (!(fields >> type)) {
+      continue;
+    }
+    BatchJob job;
+    if (!(fields >> job.input_path >> job.output_path)) {
+      spdlog::error("{}:{} needs an input and an output", manifest_path, line_num);
+      return AVERROR(EINVAL);
+    }
+    string option;
+    fields >> option;
+    if (type == "remux") {
+      job.type = BatchJobType::kRemux;
+      if (option == "video") {
+        job.streams = BatchStreams::kVideo;
+      } else if (option == "audio") {
+        job.streams = BatchStreams::kAudio;
+      } else if (!option.empty() && option != "all") {
+        spdlog::error("{}:{} unknown streams {}", manifest_path, line_num, option);
+        return AVERROR(EINVAL);
+      }
+    } else if (type == "yuv") {
+      job.type = BatchJobType::kExportYuv;
+    } else if (type == "thumbnails") {
+      job.type = BatchJobType::kThumbnails;
+      if (!option.empty()) {
+        job.interval_sec = atof(option.c_str());
+      }
+      if (job.interval_sec <= 0) {
+        spdlog::error("{}:{} bad interval {}", manifest_path, line_num, option);
+        return AVERROR(EINVAL);
+      }
+    } else {
+      spdlog::error("{}:{} unknown job {}", manifest_path, line_num, type);
+      return AVERROR(EINVAL);
+    }
+    jobs.push_back(move(job));
+  }
+  return 0;
+}
+
+int BatchProcessor::Run(vector<BatchJob> jobs) {
+  stats_ = BatchStats();
+  failed_num_ = 0;
+  decoded_frame_num_ = 0;
+  first_error_ = 0;
+  if (jobs.empty()) {
+    return 0;
+  }
+
+  int core_num = max<int>(1, std::thread::hardware_concurrency());
+  int worker_num = options_.worker_num > 0 ? options_.worker_num : core_num;
+  worker_num = min<int>(worker_num, static_cast<int>(jobs.size()));
+  int decoder_thread_num = options_.decoder_thread_num > 0 ? options_.decoder_thread_num
+                                                           : max(1, core_num / worker_num);
+
+  vector<uint64_t> input_bytes(jobs.size());
+  for (size_t i = 0; i < jobs.size(); i++) {
+    input_bytes[i] = GetFileSize(jobs[i].input_path);
+    stats_.input_bytes += input_bytes[i];
+  }
+  // Workers take their newest job first, so submitting smallest first starts the largest files
+  // early and leaves the short ones to fill the tail.
+  vector<size_t> order(jobs.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(),
+       [&](size_t lhs, size_t rhs) { return input_bytes[lhs] < input_bytes[rhs]; });
+
+  auto start = chrono::steady_clock::now();
+  {
+    WorkStealingPool pool(worker_num);
+    for (size_t index : order) {
+      pool.Submit([this, &jobs, index, decoder_thread_num] {
+        int ret = RunJob(jobs[index], decoder_thread_num);
+        if (ret < 0) {
+          spdlog::error("batch job {} {} failed, ret {}", index, jobs[index].input_path, ret);
+          failed_num_++;
+          int expected = 0;
+          first_error_.compare_exchange_strong(expected, ret);
+        }
+      });
+    }
+    pool.Wait();
+    stats_.stolen_num = pool.GetStolenNum();
+  }
+
+  stats_.elapsed_sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  stats_.job_num = jobs.size();
+  stats_.failed_num = failed_num_;
+  stats_.decoded_frame_num = decoded_frame_num_;
+  stats_.worker_num = worker_num;
+  stats_.decoder_thread_num = decoder_thread_num;
+
+  double elapsed_sec = max(stats_.elapsed_sec, 1e-9);
+  spdlog::info(
+      "batch of {} jobs, {} failed, in {:.2f}s on {} workers x {} decoder threads: "
+      "{:.1f} jobs/s, {:.1f} MiB/s input, {:.1f} decoded fps, {} jobs stolen",
+      stats_.job_num, stats_.failed_num, stats_.elapsed_sec, worker_num, decoder_thread_num,
+      stats_.job_num / elapsed_sec, stats_.input_bytes / elapsed_sec / (1 << 20),
+      stats_.decoded_frame_num / elapsed_sec, stats_.stolen_num);
+  return first_error_;
+}
+
+BatchStats BatchProcessor::GetStats() const { return stats_; }
+
+int BatchProcessor::RunJob(const BatchJob& job, int decoder_thread_num) {
+  FFmpegDecoderConfig config;
+  config.decoder_thread_num = decoder_thread_num;
+  // Remux jobs never open a codec, exports never open the audio one.
+  config.lazy_codec_open = true;
+  config.log_startup = false;
+  FFmpegDecoder ffmpeg_decoder(job.input_path, config);
+  int ret = ffmpeg_decoder.Init();
+  if (ret < 0) {
+    spdlog::error("FFmpegDecoder::Init {} failed, ret {}", job.input_path, ret);
+    return ret;
+  }
+
+  switch (job.type) {
+    case BatchJobType::kRemux: {
+      RemuxOutput output{job.output_path, {}};
+      if (job.streams != BatchStreams::kAudio) {
+        output.stream_indexes.push_back(ffmpeg_decoder.GetVideoStream()->index);
+      }
+      if (job.streams != BatchStreams::kVideo) {
+        output.stream_indexes.push_back(ffmpeg_decoder.GetAudioStream()->index);
+      }
+      return ffmpeg_decoder.SaveStreams({output});
+    }
+    case BatchJobType::kExportYuv:
+      // The pool already runs one file per core, so no segment-parallel export.
+      ret = ffmpeg_decoder.ExportYuv420(job.output_path, 1);
+      break;
+    case BatchJobType::kThumbnails: {
+      error_code ec;
+      filesystem::create_directories(job.output_path, ec);
+      if (ec) {
+        spdlog::error("create directory {} failed, {}", job.output_path, ec.message());
+        return AVERROR(EIO);
+      }
+      ThumbnailOptions options;
+      options.mode = ThumbnailMode::kInterval;
+      options.interval_sec = job.interval_sec;
+      options.writer_options.worker_num = 1;
+      ret = ffmpeg_decoder.DecimatedFrame(job.output_path, options);
+      break;
+    }
+  }
+  if (auto* frame_decoder = ffmpeg_decoder.GetVideoFrameDecoder()) {
+    decoded_frame_num_ += frame_decoder->GetDecodedFrameNum();
+  }
+  return ret;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace ryoma {
+
+enum class BatchJobType {
+  kRemux,       // copy streams into a new container, no decoding
+  kExportYuv,   // raw planar pictures of the video stream
+  kThumbnails,  // one JPEG every interval_sec
+};
+
+enum class BatchStreams {
+  kAll,
+  kVideo,
+  kAudio,
+};
+
+struct BatchJob {
+  BatchJobType type = BatchJobType::kRemux;
+  string input_path;
+  string output_path;  // a file, or a directory for thumbnails
+  BatchStreams streams = BatchStreams::kAll;  // kRemux only
+  double interval_sec = 10.0;                 // kThumbnails only
+};
+
+struct BatchOptions {
+  // Files processed at once, 0: one per core, or fewer when there are fewer jobs.
+  int worker_num = 0;
+  // Codec threads of each file, 0: the cores left per worker. Many files with one thread each
+  // scale better than few files with many threads, and never oversubscribe the machine.
+  int decoder_thread_num = 0;
+};
+
+struct BatchStats {
+  uint64_t job_num = 0;
+  uint64_t failed_num = 0;
+  uint64_t input_bytes = 0;
+  uint64_t decoded_frame_num = 0;
+  uint64_t stolen_num = 0;
+  int worker_num = 0;
+  int decoder_thread_num = 0;
+  double elapsed_sec = 0;
+};
+
+// Runs the jobs of many files on a WorkStealingPool, one FFmpegDecoder per job.
+class BatchProcessor {
+ public:
+  explicit BatchProcessor(const BatchOptions& options = BatchOptions());
+
+  // One job per line, fields split by whitespace, so paths must not contain any; # starts a
+  // comment.
+  //   remux       <input> <output> [all|video|audio]
+  //   yuv         <input> <output>
+  //   thumbnails  <input> <output_dir> [interval_sec]
+  static int LoadManifest(const string& manifest_path, vector<BatchJob>& jobs);
+
+  // Returns 0 when every job succeeded, the error of a failed one otherwise.
+  int Run(vector<BatchJob> jobs);
+
+  BatchStats GetStats() const;
+
+ private:
+  int RunJob(const BatchJob& job, int decoder_thread_num);
+
+ private:
+  BatchOptions options_;
+  BatchStats stats_;
+
+  atomic<uint64_t> failed_num_{0};
+  atomic<uint64_t> decoded_frame_num_{0};
+  atomic<int> first_error_{0};
+};
+
+}  // namespace ryoma
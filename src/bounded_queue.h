@@ -0,0 +1,125 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+namespace ryoma {
+
+struct QueueStats {
+  size_t depth = 0;
+  size_t max_depth = 0;
+  uint64_t push_stall_num = 0;  // pushes that had to wait for space
+  uint64_t pop_stall_num = 0;   // pops that had to wait for an item
+};
+
+// Blocking FIFO with a fixed capacity. Push waits while full (backpressure), Pop waits while
+// empty. Close lets consumers drain what is left, Abort wakes every waiter immediately.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity == 0 ? 1 : capacity) {}
+
+  bool Push(T item) {
+    unique_lock<mutex> lock(mutex_);
+    if (!aborted_ && !closed_ && items_.size() >= capacity_) {
+      stats_.push_stall_num++;
+      not_full_.wait(lock, [this] { return aborted_ || closed_ || items_.size() < capacity_; });
+    }
+    if (aborted_ || closed_) {
+      return false;
+    }
+    items_.push_back(move(item));
+    stats_.max_depth = max(stats_.max_depth, items_.size());
+    not_empty_.notify_one();
+    return true;
+  }
+
+  bool Pop(T& item) {
+    unique_lock<mutex> lock(mutex_);
+    if (!aborted_ && !closed_ && items_.empty()) {
+      stats_.pop_stall_num++;
+      not_empty_.wait(lock, [this] { return aborted_ || closed_ || !items_.empty(); });
+    }
+    return PopLocked(item);
+  }
+
+  bool TryPop(T& item) {
+    lock_guard<mutex> lock(mutex_);
+    return PopLocked(item);
+  }
+
+  void Close() {
+    lock_guard<mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  void Abort() {
+    lock_guard<mutex> lock(mutex_);
+    aborted_ = true;
+    items_.clear();
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  void Clear() {
+    lock_guard<mutex> lock(mutex_);
+    items_.clear();
+    not_full_.notify_all();
+  }
+
+  void Reset() {
+    lock_guard<mutex> lock(mutex_);
+    items_.clear();
+    closed_ = false;
+    aborted_ = false;
+  }
+
+  size_t Size() const {
+    lock_guard<mutex> lock(mutex_);
+    return items_.size();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  bool IsFinished() const {
+    lock_guard<mutex> lock(mutex_);
+    return aborted_ || (closed_ && items_.empty());
+  }
+
+  QueueStats GetStats() const {
+    lock_guard<mutex> lock(mutex_);
+    QueueStats stats = stats_;
+    stats.depth = items_.size();
+    return stats;
+  }
+
+ private:
+  bool PopLocked(T& item) {
+    if (aborted_ || items_.empty()) {
+      return false;
+    }
+    item = move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+ private:
+  const size_t capacity_;
+
+  mutable mutex mutex_;
+  condition_variable not_empty_;
+  condition_variable not_full_;
+  deque<T> items_;
+  bool closed_ = false;
+  bool aborted_ = false;
+  QueueStats stats_;
+};
+
+}  // namespace ryoma
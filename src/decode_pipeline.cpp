@@ -0,0 +1,184 @@
+#include "decode_pipeline.h"
+
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+DecodePipeline::DecodePipeline(FFmpegDecoder* ffmpeg_decoder) : ffmpeg_decoder_(ffmpeg_decoder) {}
+
+DecodePipeline::~DecodePipeline() { Stop(); }
+
+int DecodePipeline::Start() {
+  if (ffmpeg_decoder_ == nullptr) {
+    spdlog::error("ffmpeg_decoder is nullptr");
+    return -1;
+  }
+  // With lazy_codec_open the codecs open here, a failure leaves no decoder to run.
+  auto* video_frame_decoder = ffmpeg_decoder_->GetVideoFrameDecoder();
+  auto* audio_frame_decoder = ffmpeg_decoder_->GetAudioFrameDecoder();
+  if (video_frame_decoder == nullptr || audio_frame_decoder == nullptr) {
+    spdlog::error("no {} decoder, cannot start the pipeline",
+                  video_frame_decoder == nullptr ? "video" : "audio");
+    return AVERROR_DECODER_NOT_FOUND;
+  }
+  Stop();
+  exit_ = false;
+  for (auto* queue : {&video_packet_queue_, &audio_packet_queue_}) {
+    queue->Reset();
+  }
+  for (auto* queue : {&video_frame_queue_, &audio_frame_queue_}) {
+    queue->Reset();
+  }
+  ffmpeg_decoder_->GetVideoFramePool()->Reset();
+  ffmpeg_decoder_->GetAudioFramePool()->Reset();
+
+  demux_thread_ = thread(&DecodePipeline::DemuxLoop, this);
+  video_decode_thread_ =
+      thread(&DecodePipeline::DecodeLoop, this, video_frame_decoder,
+             ffmpeg_decoder_->GetVideoFramePool(), &video_packet_queue_, &video_frame_queue_);
+  audio_decode_thread_ =
+      thread(&DecodePipeline::DecodeLoop, this, audio_frame_decoder,
+             ffmpeg_decoder_->GetAudioFramePool(), &audio_packet_queue_, &audio_frame_queue_);
+  return 0;
+}
+
+void DecodePipeline::Stop() {
+  exit_ = true;
+  for (auto* queue : {&video_packet_queue_, &audio_packet_queue_}) {
+    queue->Abort();
+  }
+  for (auto* queue : {&video_frame_queue_, &audio_frame_queue_}) {
+    queue->Abort();
+  }
+  if (ffmpeg_decoder_ != nullptr) {
+    // Decode threads may wait for a free frame handle.
+    ffmpeg_decoder_->GetVideoFramePool()->Abort();
+    ffmpeg_decoder_->GetAudioFramePool()->Abort();
+  }
+  for (auto* worker : {&demux_thread_, &video_decode_thread_, &audio_decode_thread_}) {
+    if (worker->joinable()) {
+      worker->join();
+    }
+  }
+}
+
+int DecodePipeline::Seek(double timestamp_sec, SeekMode mode) {
+  // Stopping drops every queued packet and frame; the decoders are flushed by the seek.
+  Stop();
+  int ret = ffmpeg_decoder_->Seek(timestamp_sec, mode);
+  if (ret < 0) {
+    spdlog::error("FFmpegDecoder::Seek {} failed, ret {}", timestamp_sec, ret);
+  }
+  // Even a failed seek leaves a usable position, keep playing from there.
+  int ret_start = Start();
+  return ret < 0 ? ret : ret_start;
+}
+
+bool DecodePipeline::PopVideoFrame(FramePtr& frame) {
+  return video_frame_queue_.Pop(frame);
+}
+
+bool DecodePipeline::PopAudioFrame(FramePtr& frame) {
+  return audio_frame_queue_.Pop(frame);
+}
+
+bool DecodePipeline::TryPopVideoFrame(FramePtr& frame) {
+  return video_frame_queue_.TryPop(frame);
+}
+
+bool DecodePipeline::TryPopAudioFrame(FramePtr& frame) {
+  return audio_frame_queue_.TryPop(frame);
+}
+
+bool DecodePipeline::IsFinished() const {
+  return video_frame_queue_.IsFinished() && audio_frame_queue_.IsFinished();
+}
+
+void DecodePipeline::SetVideoFrameCallback(FrameCallback on_video_frame) {
+  on_video_frame_ = move(on_video_frame);
+}
+
+DecodePipelineStats DecodePipeline::GetStats() const {
+  DecodePipelineStats stats;
+  stats.video_packet_queue = video_packet_queue_.GetStats();
+  stats.audio_packet_queue = audio_packet_queue_.GetStats();
+  stats.video_frame_queue = video_frame_queue_.GetStats();
+  stats.audio_frame_queue = audio_frame_queue_.GetStats();
+  // Also called after a Start that failed for want of a decoder.
+  if (auto* video_frame_decoder = ffmpeg_decoder_->GetVideoFrameDecoder()) {
+    stats.video_frame_num = video_frame_decoder->GetDecodedFrameNum();
+    stats.video_dropped_frame_num = video_frame_decoder->GetDroppedFrameNum();
+  }
+  if (auto* audio_frame_decoder = ffmpeg_decoder_->GetAudioFrameDecoder()) {
+    stats.audio_frame_num = audio_frame_decoder->GetDecodedFrameNum();
+    stats.audio_dropped_frame_num = audio_frame_decoder->GetDroppedFrameNum();
+  }
+  stats.packet_pool = ffmpeg_decoder_->GetPacketPool()->GetStats();
+  stats.video_frame_pool = ffmpeg_decoder_->GetVideoFramePool()->GetStats();
+  stats.audio_frame_pool = ffmpeg_decoder_->GetAudioFramePool()->GetStats();
+  return stats;
+}
+
+void DecodePipeline::DemuxLoop() {
+  auto* av_ctx = ffmpeg_decoder_->GetFormatCtx();
+  auto* packet_pool = ffmpeg_decoder_->GetPacketPool();
+  int video_stream_index = ffmpeg_decoder_->GetVideoStream()->index;
+  int audio_stream_index = ffmpeg_decoder_->GetAudioStream()->index;
+
+  while (!exit_) {
+    auto av_packet = packet_pool->Acquire();
+    int ret = av_read_frame(av_ctx, av_packet.get());
+    if (ret < 0) {
+      if (ret != AVERROR_EOF) {
+        spdlog::error("av_read_frame failed, ret {}", ret);
+      }
+      break;
+    }
+    // Queued packets must not point into demuxer memory that the next read reuses.
+    ret = packet_pool->MakeRefcounted(av_packet.get());
+    if (ret < 0) {
+      break;
+    }
+    if (av_packet->stream_index == video_stream_index) {
+      video_packet_queue_.Push(move(av_packet));
+    } else if (av_packet->stream_index == audio_stream_index) {
+      audio_packet_queue_.Push(move(av_packet));
+    }
+  }
+  video_packet_queue_.Close();
+  audio_packet_queue_.Close();
+}
+
+void DecodePipeline::DecodeLoop(FrameDecoder* frame_decoder, FramePool* frame_pool,
+                                PacketQueue* packet_queue, FrameQueue* frame_queue) {
+  auto media_type = frame_decoder->GetCodecCtx()->codec_type;
+  auto push_frame = [&](AVFrame* decoded_frame) {
+    if (ffmpeg_decoder_->IsBeforeSeekTarget(decoded_frame, media_type)) {
+      return 0;
+    }
+    // The handle takes over the decoded buffers, no pixels are copied.
+    auto frame = frame_pool->Move(decoded_frame);
+    if (frame == nullptr) {
+      return AVERROR_EXIT;
+    }
+    if (!frame_queue->Push(move(frame))) {
+      return AVERROR_EXIT;
+    }
+    if (frame_queue == &video_frame_queue_ && on_video_frame_) {
+      on_video_frame_();
+    }
+    return 0;
+  };
+
+  PacketPtr av_packet;
+  while (!exit_ && packet_queue->Pop(av_packet)) {
+    frame_decoder->Decode(av_packet.get(), push_frame);
+    av_packet.reset();
+  }
+  if (!exit_) {
+    frame_decoder->Flush(push_frame);
+  }
+  frame_queue->Close();
+}
+
+}  // namespace ryoma
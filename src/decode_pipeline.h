@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "ffmpeg_decoder.h"
+#include "frame_decoder.h"
+#include "frame_pool.h"
+#include "packet_pool.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct DecodePipelineStats {
+  QueueStats video_packet_queue;
+  QueueStats audio_packet_queue;
+  QueueStats video_frame_queue;
+  QueueStats audio_frame_queue;
+  uint64_t video_frame_num = 0;
+  uint64_t video_dropped_frame_num = 0;
+  uint64_t audio_frame_num = 0;
+  uint64_t audio_dropped_frame_num = 0;
+  PacketPoolStats packet_pool;
+  FramePoolStats video_frame_pool;
+  FramePoolStats audio_frame_pool;
+};
+
+// Demux thread -> per-stream packet queues -> audio/video decode threads -> frame queues.
+// The consumer only pops frames that are already decoded.
+class DecodePipeline {
+ public:
+  using PacketQueue = BoundedQueue<PacketPtr>;
+  using FrameQueue = BoundedQueue<FramePtr>;
+  using FrameCallback = function<void()>;
+
+  static constexpr size_t kVideoPacketQueueSize = 256;
+  static constexpr size_t kAudioPacketQueueSize = 256;
+  static constexpr size_t kVideoFrameQueueSize = 8;
+  static constexpr size_t kAudioFrameQueueSize = 32;
+
+ public:
+  explicit DecodePipeline(FFmpegDecoder* ffmpeg_decoder);
+  ~DecodePipeline();
+
+  int Start();
+  void Stop();
+  // Restarts the threads at the new position. Frames the consumer still holds are not touched.
+  int Seek(double timestamp_sec, SeekMode mode);
+
+  bool PopVideoFrame(FramePtr& frame);
+  bool PopAudioFrame(FramePtr& frame);
+  bool TryPopVideoFrame(FramePtr& frame);
+  bool TryPopAudioFrame(FramePtr& frame);
+
+  bool IsFinished() const;
+
+  // Called from the video decode thread after each frame it queues, so a consumer that found
+  // the queue empty can sleep instead of polling. Set before Start.
+  void SetVideoFrameCallback(FrameCallback on_video_frame);
+
+  DecodePipelineStats GetStats() const;
+
+ private:
+  void DemuxLoop();
+  void DecodeLoop(FrameDecoder* frame_decoder, FramePool* frame_pool, PacketQueue* packet_queue,
+                  FrameQueue* frame_queue);
+
+ private:
+  FFmpegDecoder* ffmpeg_decoder_ = nullptr;
+
+  PacketQueue video_packet_queue_{kVideoPacketQueueSize};
+  PacketQueue audio_packet_queue_{kAudioPacketQueueSize};
+  FrameQueue video_frame_queue_{kVideoFrameQueueSize};
+  FrameQueue audio_frame_queue_{kAudioFrameQueueSize};
+
+  atomic<bool> exit_{false};
+  FrameCallback on_video_frame_;
+
+  thread demux_thread_;
+  thread video_decode_thread_;
+  thread audio_decode_thread_;
+};
+
+}  // namespace ryoma
@@ -2,218 +2,279 @@
 
 #include <libavutil/avutil.h>
 
-#include <fstream>
+#include <chrono>
 #include <thread>
 
 #include "fmt/printf.h"
+#include "parallel_yuv_exporter.h"
 #include "spdlog/spdlog.h"
-#include "video_frame_convert.h"
-
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image.h"
-#include "stb_image_write.h"
+#include "thumbnail_extractor.h"
 
 namespace ryoma {
 
-FFmpegDecoder::FFmpegDecoder(const string& av_path) : av_path_(av_path) {
+namespace {
+
+double GetElapsedMs(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+FFmpegDecoder::FFmpegDecoder(const string& av_path, const FFmpegDecoderConfig& config)
+    : av_path_(av_path),
+      config_(config),
+      packet_pool_(make_shared<PacketPool>()),
+      video_frame_pool_(make_shared<FramePool>(config.video_frame_pool_size)),
+      audio_frame_pool_(make_shared<FramePool>(config.audio_frame_pool_size)) {
   audio_frame_buff_.resize(kMaxAudioFrameBufferSize);
 }
 
+FFmpegDecoder::FFmpegDecoder(shared_ptr<AvioInput> avio_input, const FFmpegDecoderConfig& config)
+    : FFmpegDecoder(avio_input->GetName(), config) {
+  avio_input_ = move(avio_input);
+}
+
 int FFmpegDecoder::Init() {
+  init_profile_ = DecoderInitProfile();
+  auto start = chrono::steady_clock::now();
   int ret = InitAvCtx();
   if (ret != 0) {
     spdlog::error("InitAvCtx failed, ret {}", ret);
     return ret;
   }
+  init_profile_.open_input_ms = GetElapsedMs(start);
 
   ret = InitAvCodecCtx();
   if (ret != 0) {
     spdlog::error("InitAvCodecCtx failed, ret {}", ret);
     return ret;
   }
-
-  ret = InitAvFrame();
-  if (ret != 0) {
-    spdlog::error("InitAvFrame failed, ret {}", ret);
-    return ret;
+  init_profile_.total_ms = GetElapsedMs(start);
+  if (config_.log_startup) {
+    const auto& profile = init_profile_;
+    spdlog::info(
+        "Init {} in {:.1f} ms: open input {:.1f}, index cache {:.1f}, stream info {:.1f}{}, "
+        "video codec {:.1f}, audio codec {:.1f}",
+        av_path_, profile.total_ms, profile.open_input_ms, profile.index_cache_ms,
+        profile.find_stream_info_ms, profile.stream_info_skipped ? " (skipped)" : "",
+        profile.open_video_codec_ms, profile.open_audio_codec_ms);
   }
   return 0;
 }
 
 void FFmpegDecoder::SaveVideoStream(const string& target_path) {
-  ResetAvStream();
-  AVFormatContext* target_ctx_ptr = nullptr;
-  int ret = avformat_alloc_output_context2(&target_ctx_ptr, NULL, NULL, target_path.c_str());
-  if (ret != 0) {
-    spdlog::error("avformat_alloc_output_context2 failed, path {} ret {}", target_path, ret);
-    return;
-  }
-  shared_ptr<AVFormatContext> target_ctx(target_ctx_ptr,
-                                         [](AVFormatContext*& ptr) { avformat_close_input(&ptr); });
-  AVStream* video_target_stream = avformat_new_stream(target_ctx.get(), nullptr);
-  avio_open(&target_ctx->pb, target_ctx->url, AVIO_FLAG_WRITE);
+  SaveStreams({RemuxOutput{target_path, {video_stream_->index}}});
+}
 
-  video_target_stream->time_base = video_stream_->time_base;
-  avcodec_parameters_copy(video_target_stream->codecpar, video_stream_->codecpar);
+void FFmpegDecoder::SaveAudioStream(const string& target_path) {
+  SaveStreams({RemuxOutput{target_path, {audio_stream_->index}}});
+}
 
-  ret = avformat_write_header(target_ctx.get(), nullptr);
+int FFmpegDecoder::SaveStreams(const vector<RemuxOutput>& outputs) {
+  ResetAvStream();
+  StreamRemuxer stream_remuxer(av_ctx_.get(), packet_pool_.get());
+  for (const auto& output : outputs) {
+    int ret = stream_remuxer.AddOutput(output);
+    if (ret < 0) {
+      spdlog::error("StreamRemuxer::AddOutput {} failed, ret {}", output.path, ret);
+      return ret;
+    }
+  }
+  int ret = stream_remuxer.Run();
   if (ret < 0) {
-    spdlog::error("avformat_write_header failed, ret {}", ret);
-    return;
+    spdlog::error("StreamRemuxer::Run failed, ret {}", ret);
   }
-  av_dump_format(target_ctx.get(), 0, target_ctx->url, 1);
+  return ret;
+}
 
-  AVPacket av_packet;
-  while (av_read_frame(av_ctx_.get(), &av_packet) == 0) {
-    if (av_packet.stream_index == video_stream_->index) {
-      av_interleaved_write_frame(target_ctx.get(), &av_packet);
+int FFmpegDecoder::ExportYuv420(const string& prefix_path, int worker_num,
+                                 RawVideoLayout layout) {
+  if (worker_num > 1) {
+    ParallelYuvExporter parallel_yuv_exporter(av_path_, worker_num, layout,
+                                              config_.decoder_thread_num);
+    int ret = parallel_yuv_exporter.Export(prefix_path);
+    if (ret == 0) {
+      video_frame_num_ += parallel_yuv_exporter.GetExportedFrameNum();
+      return 0;
     }
+    spdlog::warn("parallel export failed, ret {}, falling back to serial export", ret);
   }
-  av_write_trailer(target_ctx.get());
-}
 
-void FFmpegDecoder::SaveAudioStream(const string& target_path) {
+  int ret = InitVideoCodecCtx();
+  if (ret < 0) {
+    return ret;
+  }
   ResetAvStream();
-  AVFormatContext* target_ctx_ptr = nullptr;
-  int ret = avformat_alloc_output_context2(&target_ctx_ptr, nullptr, nullptr, target_path.c_str());
-  if (ret != 0) {
-    spdlog::error("avformat_alloc_output_context2 failed, path {} ret {}", target_path, ret);
-    return;
+  RawVideoWriter raw_video_writer(layout);
+  ret = raw_video_writer.Open(prefix_path);
+  if (ret < 0) {
+    spdlog::error("RawVideoWriter::Open {} failed, ret {}", prefix_path, ret);
+    return ret;
   }
-  shared_ptr<AVFormatContext> target_ctx(target_ctx_ptr,
-                                         [](AVFormatContext*& ptr) { avformat_close_input(&ptr); });
-  AVStream* audio_target_stream = avformat_new_stream(target_ctx.get(), nullptr);
-  avio_open(&target_ctx->pb, target_ctx->url, AVIO_FLAG_WRITE);
 
-  audio_target_stream->time_base = audio_stream_->time_base;
-  avcodec_parameters_copy(audio_target_stream->codecpar, audio_stream_->codecpar);
+  auto write_frame = [&](AVFrame* frame) {
+    int ret = raw_video_writer.WriteFrame(frame);
+    if (ret < 0) {
+      spdlog::error("RawVideoWriter::WriteFrame failed, ret {}", ret);
+      return ret;
+    }
+    video_frame_num_++;
+    return 0;
+  };
 
-  ret = avformat_write_header(target_ctx.get(), nullptr);
+  while (true) {
+    auto av_packet = packet_pool_->Acquire();
+    if (av_read_frame(av_ctx_.get(), av_packet.get()) < 0) {
+      break;
+    }
+    if (av_packet->stream_index == video_stream_->index) {
+      video_frame_decoder_->Decode(av_packet.get(), write_frame);
+    }
+  }
+  video_frame_decoder_->Flush(write_frame);
+  ret = raw_video_writer.Close();
   if (ret < 0) {
-    spdlog::error("avformat_write_header failed, ret {}", ret);
-    return;
+    spdlog::error("RawVideoWriter::Close failed, ret {}", ret);
   }
-  av_dump_format(target_ctx.get(), 0, target_ctx->url, 1);
+  spdlog::info("ExportYuv420 decoded {} dropped {}, {} bytes",
+               video_frame_decoder_->GetDecodedFrameNum(),
+               video_frame_decoder_->GetDroppedFrameNum(), raw_video_writer.GetWrittenBytes());
+  return ret;
+}
 
-  AVPacket av_packet;
-  while (av_read_frame(av_ctx_.get(), &av_packet) == 0) {
-    if (av_packet.stream_index == audio_stream_->index) {
-      av_packet.stream_index = 0;
-      av_interleaved_write_frame(target_ctx.get(), &av_packet);
-    }
+int FFmpegDecoder::DecimatedFrame(const string& target_dir, const ThumbnailOptions& options) {
+  ResetAvStream();
+  ThumbnailExtractor thumbnail_extractor(this);
+  int ret = thumbnail_extractor.Extract(target_dir, options);
+  if (ret < 0) {
+    spdlog::error("ThumbnailExtractor::Extract {} failed, ret {}", target_dir, ret);
   }
-  av_write_trailer(target_ctx.get());
+  return ret;
 }
 
-void FFmpegDecoder::ExportYuv420(const string& prefix_path) {
-  ResetAvStream();
-  ofstream fout(prefix_path, ios::out | ios::trunc | ios::binary);
+int FFmpegDecoder::GetNextFrame(FramePtr& frame) {
+  frame.reset();
+  int ret = InitVideoCodecCtx();
+  if (ret < 0 || (ret = InitAudioCodecCtx()) < 0) {
+    return ret;
+  }
 
-  int video_width = video_codec_ctx_->width;
-  int video_height = video_codec_ctx_->height;
-  int pixel_size = video_width * video_height;
+  while (true) {
+    // Frames already held by the decoders go out before more input is read, so a send never
+    // meets a full decoder.
+    ret = ReceiveNextFrame(frame);
+    if (ret != AVERROR(EAGAIN)) {
+      return ret;
+    }
+    if (demux_eof_) {
+      return AVERROR_EOF;
+    }
 
-  AVPacket av_packet;
-  while (av_read_frame(av_ctx_.get(), &av_packet) == 0) {
-    if (av_packet.stream_index == video_stream_->index) {
-      int ret = avcodec_send_packet(video_codec_ctx_.get(), &av_packet);
-      if (ret < 0) {
-        continue;
-      }
-      if (av_packet.size <= 0) {
-        continue;
-      }
-      ret = avcodec_receive_frame(video_codec_ctx_.get(), video_frame_.get());
-      if (ret == 0) {
-        // yuv420: yyyyyyyyuuvv|yyyyyyyyuuvv
-        fout.write(reinterpret_cast<char*>(video_frame_->data[0]), pixel_size);
-        fout.write(reinterpret_cast<char*>(video_frame_->data[1]), pixel_size / 4);
-        fout.write(reinterpret_cast<char*>(video_frame_->data[2]), pixel_size / 4);
-        video_frame_num_++;
-      }
+    auto av_packet = packet_pool_->Acquire();
+    ret = av_read_frame(av_ctx_.get(), av_packet.get());
+    if (ret < 0) {
+      demux_eof_ = true;
+      video_frame_decoder_->Send(nullptr);
+      audio_frame_decoder_->Send(nullptr);
+      continue;
+    }
+    if (av_packet->stream_index == video_stream_->index) {
+      video_frame_decoder_->Send(av_packet.get());
+    } else if (av_packet->stream_index == audio_stream_->index) {
+      audio_frame_decoder_->Send(av_packet.get());
     }
   }
-  fout.close();
 }
 
-void FFmpegDecoder::DecimatedFrame(const string& target_dir) {
-  ResetAvStream();
-  ryoma::VideoFrameConvert video_frame_convert(video_codec_ctx_.get(), AV_PIX_FMT_RGB24);
-
-  AVPacket av_packet;
-  while (av_read_frame(av_ctx_.get(), &av_packet) == 0) {
-    if (av_packet.stream_index == video_stream_->index) {
-      int ret = avcodec_send_packet(video_codec_ctx_.get(), &av_packet);
-      if (ret < 0) {
-        continue;
-      }
-      if (av_packet.size <= 0) {
+int FFmpegDecoder::ReceiveNextFrame(FramePtr& frame) {
+  int ret = AVERROR(EAGAIN);
+  for (auto media_type : {AVMEDIA_TYPE_VIDEO, AVMEDIA_TYPE_AUDIO}) {
+    bool is_video = media_type == AVMEDIA_TYPE_VIDEO;
+    auto* frame_decoder = is_video ? video_frame_decoder_.get() : audio_frame_decoder_.get();
+    auto* frame_pool = is_video ? video_frame_pool_.get() : audio_frame_pool_.get();
+    // A handle only for the decoder asked next, an exhausted pool must not hold up the other
+    // stream.
+    auto decoded_frame = frame_pool->Acquire(false);
+    if (decoded_frame == nullptr) {
+      ret = AVERROR(ENOBUFS);
+      continue;
+    }
+    while (frame_decoder->Receive(decoded_frame.get()) == 0) {
+      if (IsBeforeSeekTarget(decoded_frame.get(), media_type)) {
+        av_frame_unref(decoded_frame.get());
         continue;
       }
-      ret = avcodec_receive_frame(video_codec_ctx_.get(), video_frame_.get());
-      if (ret == 0) {
-        SaveVideoPixel(target_dir, video_frame_->width, video_frame_->height,
-                       video_frame_convert.ConvertToBytes(video_frame_.get()));
-        video_frame_num_++;
-      }
+      (is_video ? video_frame_num_ : audio_frame_num_)++;
+      frame = move(decoded_frame);
+      return 0;
     }
   }
+  return ret;
 }
 
-int FFmpegDecoder::GetNextFrame(AVFrame*& frame) {
-  frame = nullptr;
+AVFormatContext* FFmpegDecoder::GetFormatCtx() { return av_ctx_.get(); }
 
-  AVPacket av_packet;
-  while (av_read_frame(av_ctx_.get(), &av_packet) == 0) {
-    /*
-    if (av_packet.stream_index == video_stream_->index) {
-      int ret = avcodec_send_packet(video_codec_ctx_.get(), &av_packet);
-      if (ret < 0) {
-        spdlog::error("avcodec_send_packet failed, ret {}", ret);
-        continue;
-      }
-      ret = avcodec_receive_frame(video_codec_ctx_.get(), video_frame_.get());
-      if (ret < 0) {
-        spdlog::error("avcodec_receive_frame failed, ret {}", ret);
-        continue;
-      }
-      video_frame_num_++;
-      frame = video_frame_.get();
-      break;
-    }
-    */
+AVCodecContext* FFmpegDecoder::GetVideoCodecCtx() {
+  InitVideoCodecCtx();
+  return video_codec_ctx_.get();
+}
 
-    if (av_packet.stream_index == audio_stream_->index) {
-      int ret = avcodec_send_packet(audio_codec_ctx_.get(), &av_packet);
-      if (ret < 0) {
-        spdlog::error("avcodec_send_packet failed, ret {}", ret);
-        continue;
-      }
-      ret = avcodec_receive_frame(audio_codec_ctx_.get(), audio_frame_.get());
-      if (ret < 0) {
-        spdlog::error("avcodec_receive_frame failed, ret {}", ret);
-        continue;
-      }
-      audio_frame_num_++;
-      frame = audio_frame_.get();
-      spdlog::error("frame: {}, pts: {}, size: {}", audio_frame_num_, av_packet.pts,
-                    av_packet.size);
-      break;
-    }
-  }
-  return 0;
+AVCodecContext* FFmpegDecoder::GetAudioCodecCtx() {
+  InitAudioCodecCtx();
+  return audio_codec_ctx_.get();
 }
 
-AVCodecContext* FFmpegDecoder::GetVideoCodecCtx() { return video_codec_ctx_.get(); }
+PacketPool* FFmpegDecoder::GetPacketPool() { return packet_pool_.get(); }
+
+FramePool* FFmpegDecoder::GetVideoFramePool() { return video_frame_pool_.get(); }
 
-AVCodecContext* FFmpegDecoder::GetAudioCodecCtx() { return audio_codec_ctx_.get(); }
+FramePool* FFmpegDecoder::GetAudioFramePool() { return audio_frame_pool_.get(); }
+
+AVStream* FFmpegDecoder::GetVideoStream() { return video_stream_; }
+
+AVStream* FFmpegDecoder::GetAudioStream() { return audio_stream_; }
+
+FrameDecoder* FFmpegDecoder::GetVideoFrameDecoder() {
+  InitVideoCodecCtx();
+  return video_frame_decoder_.get();
+}
+
+FrameDecoder* FFmpegDecoder::GetAudioFrameDecoder() {
+  InitAudioCodecCtx();
+  return audio_frame_decoder_.get();
+}
 
 int FFmpegDecoder::InitAvCtx() {
   const auto& path = av_path_;
 
+  auto* input_format = config_.input_format.empty()
+                           ? nullptr
+                           : av_find_input_format(config_.input_format.c_str());
+  if (!config_.input_format.empty() && input_format == nullptr) {
+    spdlog::warn("unknown input format {}, probing instead", config_.input_format);
+  }
+  AVDictionary* options = nullptr;
+  if (config_.probesize > 0) {
+    av_dict_set_int(&options, "probesize", config_.probesize, 0);
+  }
+  if (config_.analyze_duration_us > 0) {
+    av_dict_set_int(&options, "analyzeduration", config_.analyze_duration_us, 0);
+  }
+
   AVFormatContext* av_ctx_ptr = nullptr;
-  int ret = avformat_open_input(&av_ctx_ptr, path.c_str(), nullptr, nullptr);
+  if (avio_input_ != nullptr) {
+    avio_ctx_ = avio_input_->CreateAvioCtx();
+    av_ctx_ptr = avformat_alloc_context();
+    if (avio_ctx_ == nullptr || av_ctx_ptr == nullptr) {
+      avformat_free_context(av_ctx_ptr);
+      av_dict_free(&options);
+      return AVERROR(ENOMEM);
+    }
+    av_ctx_ptr->pb = avio_ctx_.get();
+    av_ctx_ptr->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+  int ret = avformat_open_input(&av_ctx_ptr, path.c_str(), input_format, &options);
+  av_dict_free(&options);
   if (ret < 0) {
     spdlog::error("avformat open {} failed, ret {}", path, ret);
     return ret;
@@ -223,28 +284,92 @@ int FFmpegDecoder::InitAvCtx() {
 }
 
 int FFmpegDecoder::InitAvCodecCtx() {
-  av_dump_format(av_ctx_.get(), 0, av_ctx_->url, 0);
-  int ret = avformat_find_stream_info(av_ctx_.get(), nullptr);
-  if (ret < 0) {
-    spdlog::error("avformat_find_stream_info failed, ret {}", ret);
-    return ret;
+  if (config_.log_startup) {
+    av_dump_format(av_ctx_.get(), 0, av_ctx_->url, 0);
+  }
+  auto start = chrono::steady_clock::now();
+  IndexCache index_cache;
+  bool is_index_cached = config_.use_index_cache && LoadIndexCache(index_cache) == 0;
+  init_profile_.index_cache_ms = GetElapsedMs(start);
+
+  int ret = 0;
+  init_profile_.stream_info_skipped =
+      is_index_cached || (config_.skip_stream_info && IsStreamInfoComplete());
+  if (!init_profile_.stream_info_skipped) {
+    start = chrono::steady_clock::now();
+    ret = avformat_find_stream_info(av_ctx_.get(), nullptr);
+    if (ret < 0) {
+      spdlog::error("avformat_find_stream_info failed, ret {}", ret);
+      return ret;
+    }
+    init_profile_.find_stream_info_ms = GetElapsedMs(start);
   }
 
-  ret = InitVideoCodecCtx();
+  ret = InitVideoStream();
   if (ret < 0) {
-    spdlog::error("InitVideoCodecCtx failed, ret {}", ret);
+    spdlog::error("InitVideoStream failed, ret {}", ret);
     return ret;
   }
-
-  ret = InitAudioCodecCtx();
+  ret = InitAudioStream();
   if (ret < 0) {
-    spdlog::error("InitVideoCodecCtx failed, ret {}", ret);
+    spdlog::error("InitAudioStream failed, ret {}", ret);
     return ret;
   }
+
+  if (!config_.lazy_codec_open) {
+    ret = InitVideoCodecCtx();
+    if (ret < 0) {
+      spdlog::error("InitVideoCodecCtx failed, ret {}", ret);
+      return ret;
+    }
+
+    ret = InitAudioCodecCtx();
+    if (ret < 0) {
+      spdlog::error("InitAudioCodecCtx failed, ret {}", ret);
+      return ret;
+    }
+  }
+
+  if (is_index_cached && index_cache.GetVideoStreamIndex() == video_stream_->index) {
+    keyframe_index_ = make_unique<KeyframeIndex>();
+    index_cache.LoadKeyframeIndex(keyframe_index_.get());
+    spdlog::info("keyframe index of {} keyframes {} packets, from {}", keyframe_index_->GetSize(),
+                 keyframe_index_->GetPackets().size(), GetIndexCachePath());
+  } else if (config_.use_index_cache) {
+    // Not fatal, the next Init just probes again. Building the index may have seeked to load the
+    // demuxer's own, demuxing starts over from the beginning.
+    SaveIndexCache();
+    ResetAvStream();
+  }
   return 0;
 }
 
-int FFmpegDecoder::InitVideoCodecCtx() {
+bool FFmpegDecoder::IsStreamInfoComplete() const {
+  // Streams may still show up while reading packets.
+  if (av_ctx_->ctx_flags & AVFMTCTX_NOHEADER) {
+    return false;
+  }
+  for (unsigned int i = 0; i < av_ctx_->nb_streams; i++) {
+    const auto* codecpar = av_ctx_->streams[i]->codecpar;
+    if (codecpar->codec_type != AVMEDIA_TYPE_VIDEO && codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+      continue;
+    }
+    if (codecpar->codec_id == AV_CODEC_ID_NONE || codecpar->format < 0) {
+      return false;
+    }
+    if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+        (codecpar->width <= 0 || codecpar->height <= 0)) {
+      return false;
+    }
+    if (codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+        (codecpar->sample_rate <= 0 || codecpar->channels <= 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int FFmpegDecoder::InitVideoStream() {
   int video_stream_index =
       av_find_best_stream(av_ctx_.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
   if (video_stream_index == AVERROR_STREAM_NOT_FOUND) {
@@ -252,6 +377,32 @@ int FFmpegDecoder::InitVideoCodecCtx() {
     return AVERROR_STREAM_NOT_FOUND;
   }
   video_stream_ = av_ctx_->streams[video_stream_index];
+  return 0;
+}
+
+int FFmpegDecoder::InitAudioStream() {
+  int audio_stream_index =
+      av_find_best_stream(av_ctx_.get(), AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+  if (audio_stream_index == AVERROR_STREAM_NOT_FOUND) {
+    spdlog::error("not found audio stream");
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+  audio_stream_ = av_ctx_->streams[audio_stream_index];
+  return 0;
+}
+
+int FFmpegDecoder::GetDecoderThreadNum() const {
+  if (config_.decoder_thread_num > 0) {
+    return config_.decoder_thread_num;
+  }
+  return max<int>(1, std::thread::hardware_concurrency());
+}
+
+int FFmpegDecoder::InitVideoCodecCtx() {
+  if (video_frame_decoder_ != nullptr) {
+    return 0;
+  }
+  auto start = chrono::steady_clock::now();
   auto* video_codec = avcodec_find_decoder(video_stream_->codecpar->codec_id);
   if (video_codec == nullptr) {
     spdlog::error("not found video codec, codec_id {}", video_stream_->codecpar->codec_id);
@@ -264,7 +415,8 @@ int FFmpegDecoder::InitVideoCodecCtx() {
     return -1;
   }
   int ret = avcodec_parameters_to_context(video_codec_ctx_.get(), video_stream_->codecpar);
-  video_codec_ctx_->thread_count = std::thread::hardware_concurrency();
+  video_codec_ctx_->thread_count = GetDecoderThreadNum();
+  video_frame_pool_->Attach(video_codec_ctx_.get());
   if (ret < 0) {
     spdlog::error("avcodec_parameters_to_context failed, ret {}", ret);
     return ret;
@@ -274,17 +426,16 @@ int FFmpegDecoder::InitVideoCodecCtx() {
     spdlog::error("avcodec_open2 failed, ret {}", ret);
     return ret;
   }
+  video_frame_decoder_ = make_shared<FrameDecoder>(video_codec_ctx_.get());
+  init_profile_.open_video_codec_ms = GetElapsedMs(start);
   return 0;
 }
 
 int FFmpegDecoder::InitAudioCodecCtx() {
-  int audio_stream_index =
-      av_find_best_stream(av_ctx_.get(), AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-  if (audio_stream_index == AVERROR_STREAM_NOT_FOUND) {
-    spdlog::error("not found audio stream");
-    return AVERROR_STREAM_NOT_FOUND;
+  if (audio_frame_decoder_ != nullptr) {
+    return 0;
   }
-  audio_stream_ = av_ctx_->streams[audio_stream_index];
+  auto start = chrono::steady_clock::now();
   auto* audio_codec = avcodec_find_decoder(audio_stream_->codecpar->codec_id);
   if (audio_codec == nullptr) {
     spdlog::error("not found audio codec, codec_id {}", audio_stream_->codecpar->codec_id);
@@ -297,7 +448,7 @@ int FFmpegDecoder::InitAudioCodecCtx() {
     return -1;
   }
   int ret = avcodec_parameters_to_context(audio_codec_ctx_.get(), audio_stream_->codecpar);
-  audio_codec_ctx_->thread_count = std::thread::hardware_concurrency();
+  audio_codec_ctx_->thread_count = GetDecoderThreadNum();
   if (ret < 0) {
     spdlog::error("avcodec_parameters_to_context failed, ret {}", ret);
     return ret;
@@ -307,16 +458,22 @@ int FFmpegDecoder::InitAudioCodecCtx() {
     spdlog::error("avcodec_open2 failed, ret {}", ret);
     return ret;
   }
-  return 0;
-}
-
-int FFmpegDecoder::InitAvFrame() {
-  video_frame_.reset(av_frame_alloc(), [](AVFrame*& ptr) { av_frame_free(&ptr); });
-  audio_frame_.reset(av_frame_alloc(), [](AVFrame*& ptr) { av_frame_free(&ptr); });
+  audio_frame_decoder_ = make_shared<FrameDecoder>(audio_codec_ctx_.get());
+  init_profile_.open_audio_codec_ms = GetElapsedMs(start);
   return 0;
 }
 
 void FFmpegDecoder::ResetAvStream() {
+  // Drop whatever the decoders still hold from the previous pass, a flushed decoder would
+  // refuse new packets otherwise. Codecs lazy_codec_open has not opened yet hold nothing.
+  for (auto* frame_decoder : {video_frame_decoder_.get(), audio_frame_decoder_.get()}) {
+    if (frame_decoder != nullptr) {
+      frame_decoder->Reset();
+    }
+  }
+  demux_eof_ = false;
+  seek_target_sec_ = NAN;
+
   avio_seek(av_ctx_->pb, 0, SEEK_SET);
   int ret = avformat_seek_file(av_ctx_.get(), video_stream_->index, 0, 0, INT64_MAX,
                                AVSEEK_FLAG_BACKWARD);
@@ -326,16 +483,126 @@ void FFmpegDecoder::ResetAvStream() {
   }
 }
 
-void FFmpegDecoder::SaveVideoPixel(const string& target_dir, int image_width, int image_height,
-                                   const vector<uint8_t>& rgb_pixel) {
-  if (video_frame_num_ % 100 == 0) {
-    string image_path = fmt::format("{}/demo_{}.jpg", target_dir, video_frame_num_);
-    int ret =
-        stbi_write_jpg(image_path.c_str(), image_width, image_height, 3, rgb_pixel.data(), 80);
-    if (ret < 0) {
-      spdlog::error("stbi_write_jpg {} failed, ret {}", image_path, ret);
+int FFmpegDecoder::Seek(double timestamp_sec, SeekMode mode) {
+  if (keyframe_index_ == nullptr) {
+    BuildKeyframeIndex(true);
+  }
+  auto time_base = video_stream_->time_base;
+  int64_t start_pts = video_stream_->start_time == AV_NOPTS_VALUE ? 0 : video_stream_->start_time;
+  int64_t target_pts = start_pts + av_rescale_q(llround(max(timestamp_sec, 0.0) * AV_TIME_BASE),
+                                                AVRational{1, AV_TIME_BASE}, time_base);
+
+  const auto* keyframe = keyframe_index_->FindBefore(target_pts);
+  int ret = -1;
+  if (keyframe != nullptr && keyframe_index_->GetSource() == KeyframeIndexSource::kScan &&
+      keyframe->pos >= 0 && !(av_ctx_->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+    // The demuxer has no index of its own and would bisect the file; the scan knows the byte.
+    ret = avformat_seek_file(av_ctx_.get(), -1, INT64_MIN, keyframe->pos, keyframe->pos,
+                             AVSEEK_FLAG_BYTE);
+  }
+  if (ret < 0) {
+    int64_t seek_pts = keyframe != nullptr ? keyframe->pts : target_pts;
+    ret = avformat_seek_file(av_ctx_.get(), video_stream_->index, INT64_MIN, seek_pts, seek_pts,
+                             0);
+  }
+  if (ret < 0) {
+    spdlog::error("avformat_seek_file {} failed, ret {}", target_pts, ret);
+    return ret;
+  }
+
+  for (auto* frame_decoder : {video_frame_decoder_.get(), audio_frame_decoder_.get()}) {
+    if (frame_decoder != nullptr) {
+      frame_decoder->Reset();
+    }
+  }
+  demux_eof_ = false;
+  seek_target_sec_ = mode == SeekMode::kAccurate ? target_pts * av_q2d(time_base) : NAN;
+  return 0;
+}
+
+bool FFmpegDecoder::IsBeforeSeekTarget(const AVFrame* frame, AVMediaType media_type) const {
+  if (isnan(seek_target_sec_) || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+    return false;
+  }
+  const auto* stream = media_type == AVMEDIA_TYPE_VIDEO ? video_stream_ : audio_stream_;
+  double time_base_sec = av_q2d(stream->time_base);
+  double end_sec = frame->best_effort_timestamp * time_base_sec;
+  if (media_type == AVMEDIA_TYPE_AUDIO && frame->sample_rate > 0) {
+    end_sec += static_cast<double>(frame->nb_samples) / frame->sample_rate;
+  } else {
+    end_sec += frame->pkt_duration * time_base_sec;
+  }
+  // The frame that covers the target is kept.
+  return end_sec <= seek_target_sec_;
+}
+
+double FFmpegDecoder::GetStartSec() const {
+  if (video_stream_->start_time == AV_NOPTS_VALUE) {
+    return 0;
+  }
+  return video_stream_->start_time * av_q2d(video_stream_->time_base);
+}
+
+const DecoderInitProfile& FFmpegDecoder::GetInitProfile() const { return init_profile_; }
+
+const KeyframeIndex* FFmpegDecoder::GetKeyframeIndex() {
+  if (keyframe_index_ == nullptr) {
+    BuildKeyframeIndex(false);
+  }
+  return keyframe_index_.get();
+}
+
+int FFmpegDecoder::BuildKeyframeIndex(bool is_seek_allowed) {
+  int64_t duration = video_stream_->duration;
+  if (duration == AV_NOPTS_VALUE && av_ctx_->duration != AV_NOPTS_VALUE) {
+    duration = av_rescale_q(av_ctx_->duration, AVRational{1, AV_TIME_BASE},
+                            video_stream_->time_base);
+  }
+  keyframe_index_ = make_unique<KeyframeIndex>();
+  int ret = keyframe_index_->BuildFromStream(video_stream_, duration);
+  if (ret == AVERROR(EAGAIN) && is_seek_allowed) {
+    // Matroska parses cues stored after the clusters only when asked to seek.
+    int64_t start_pts = video_stream_->start_time == AV_NOPTS_VALUE ? 0 : video_stream_->start_time;
+    if (avformat_seek_file(av_ctx_.get(), video_stream_->index, INT64_MIN, start_pts, start_pts,
+                           0) >= 0) {
+      ret = keyframe_index_->BuildFromStream(video_stream_, duration);
     }
   }
+  if (ret < 0) {
+    ret = keyframe_index_->BuildFromScan(av_path_, video_stream_->index);
+  }
+  if (ret < 0) {
+    spdlog::warn("no keyframe index for {}, seeks rely on the demuxer", av_path_);
+    return ret;
+  }
+  spdlog::info("keyframe index of {} keyframes, from {}", keyframe_index_->GetSize(),
+               keyframe_index_->GetSource() == KeyframeIndexSource::kStream ? "stream" : "scan");
+  return 0;
+}
+
+string FFmpegDecoder::GetIndexCachePath() const {
+  return config_.index_cache_path.empty() ? av_path_ + ".ryidx" : config_.index_cache_path;
+}
+
+int FFmpegDecoder::LoadIndexCache(IndexCache& index_cache) {
+  int ret = index_cache.Load(GetIndexCachePath(), av_path_);
+  if (ret < 0) {
+    return ret;
+  }
+  return index_cache.Apply(av_ctx_.get());
+}
+
+int FFmpegDecoder::SaveIndexCache() {
+  if (keyframe_index_ == nullptr) {
+    // Every later Init takes the cached index as is, a partial stream index must not get there.
+    BuildKeyframeIndex(true);
+  }
+  int ret = IndexCache::Save(GetIndexCachePath(), av_path_, av_ctx_.get(), video_stream_->index,
+                             *keyframe_index_);
+  if (ret < 0) {
+    spdlog::warn("IndexCache::Save {} failed, ret {}", GetIndexCachePath(), ret);
+  }
+  return ret;
 }
 
-}  // namespace ryoma
\ No newline at end of file
+}  // namespace ryoma
\ No newline at end of file
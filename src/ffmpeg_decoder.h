@@ -1,10 +1,21 @@
 #pragma once
 
+#include <cmath>
 #include <memory>
 #include <string>
 #include <queue>
 #include <vector>
 
+#include "avio_input.h"
+#include "frame_decoder.h"
+#include "frame_pool.h"
+#include "index_cache.h"
+#include "keyframe_index.h"
+#include "packet_pool.h"
+#include "raw_video_writer.h"
+#include "stream_remuxer.h"
+#include "thumbnail_extractor.h"
+
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
@@ -16,50 +27,151 @@ using namespace std;
 
 namespace ryoma {
 
+struct FFmpegDecoderConfig {
+  // Upper bound of decoded frames handed out at the same time, which bounds picture memory.
+  size_t video_frame_pool_size = FramePool::kDefaultMaxFrameNum;
+  size_t audio_frame_pool_size = 64;
+  // Reuse the stream parameters and keyframe tables of an earlier Init, see IndexCache. The
+  // first Init of a file pays for a full keyframe scan when the container has no index.
+  bool use_index_cache = false;
+  string index_cache_path;  // empty: next to the input, with a .ryidx suffix
+
+  // Startup. The defaults match plain avformat_open_input + avformat_find_stream_info.
+  string input_format;              // e.g. "matroska", skips format probing when set
+  int64_t probesize = 0;            // bytes avformat_find_stream_info may read, 0: FFmpeg's
+  int64_t analyze_duration_us = 0;  // stream time it may analyze, 0: FFmpeg's
+  // Trust the container header and skip avformat_find_stream_info when it already gives every
+  // stream a codec, size or sample layout and pixel or sample format.
+  bool skip_stream_info = false;
+  // Open a codec on the first use of its stream instead of in Init, so remuxing and video-only
+  // exports never open the audio decoder and its threads.
+  bool lazy_codec_open = false;
+  bool log_startup = true;  // av_dump_format and the per stage timing of Init
+
+  // Threads of each codec context, 0: one per core. Lower it when many decoders run at once,
+  // see BatchProcessor.
+  int decoder_thread_num = 0;
+};
+
+// Wall time of each Init stage, in milliseconds.
+struct DecoderInitProfile {
+  double open_input_ms = 0;
+  double index_cache_ms = 0;
+  double find_stream_info_ms = 0;
+  double open_video_codec_ms = 0;
+  double open_audio_codec_ms = 0;
+  double total_ms = 0;
+  bool stream_info_skipped = false;
+};
+
+enum class SeekMode {
+  kKeyframe,  // land on the keyframe at or before the target, fastest
+  kAccurate,  // decode from that keyframe and drop frames until the target
+};
+
 class FFmpegDecoder {
  public:
-  explicit FFmpegDecoder(const string& av_path);
+  explicit FFmpegDecoder(const string& av_path,
+                         const FFmpegDecoderConfig& config = FFmpegDecoderConfig());
+  // Demuxes from a custom input instead of FFmpeg's file protocol; its name stands in for the
+  // path. Features that reopen the input by path, the parallel export and the keyframe scan,
+  // only work when that name is a real file.
+  explicit FFmpegDecoder(shared_ptr<AvioInput> avio_input,
+                         const FFmpegDecoderConfig& config = FFmpegDecoderConfig());
 
   int Init();
 
   void SaveVideoStream(const string& target_path);
   void SaveAudioStream(const string& target_path);
-  void ExportYuv420(const string& target_path);
-  void DecimatedFrame(const string& target_dir);
-
-  int GetNextFrame(AVFrame*& frame);
-
+  // Every output in one read of the input.
+  int SaveStreams(const vector<RemuxOutput>& outputs);
+  // With worker_num > 1 the file is split into GOP-aligned segments decoded in parallel.
+  int ExportYuv420(const string& target_path, int worker_num = 1,
+                   RawVideoLayout layout = RawVideoLayout::kPlanar);
+  int DecimatedFrame(const string& target_dir,
+                     const ThumbnailOptions& options = ThumbnailOptions());
+
+  // Returns the next decoded frame of either stream, AVERROR_EOF at the end, or
+  // AVERROR(ENOBUFS) while the caller still holds every frame of a pool.
+  int GetNextFrame(FramePtr& frame);
+
+  AVFormatContext* GetFormatCtx();
+  // The codec getters open the codec first when lazy_codec_open deferred it, nullptr if that
+  // fails.
   AVCodecContext* GetVideoCodecCtx();
   AVCodecContext* GetAudioCodecCtx();
+  PacketPool* GetPacketPool();
+  FramePool* GetVideoFramePool();
+  FramePool* GetAudioFramePool();
+  AVStream* GetVideoStream();
+  AVStream* GetAudioStream();
+  FrameDecoder* GetVideoFrameDecoder();
+  FrameDecoder* GetAudioFrameDecoder();
 
   void ResetAvStream();
 
+  // timestamp_sec counts from the start of the file. Flushes both decoders; frames handed out
+  // earlier are not touched.
+  int Seek(double timestamp_sec, SeekMode mode = SeekMode::kAccurate);
+  // True for frames an accurate seek decodes only to reach its target.
+  bool IsBeforeSeekTarget(const AVFrame* frame, AVMediaType media_type) const;
+  // Stream time of the first video frame, in seconds.
+  double GetStartSec() const;
+  const KeyframeIndex* GetKeyframeIndex();
+  const DecoderInitProfile& GetInitProfile() const;
+
  private:
   int InitAvCtx();
 
   int InitAvCodecCtx();
+  bool IsStreamInfoComplete() const;
+  int InitVideoStream();
+  int InitAudioStream();
+  int GetDecoderThreadNum() const;
+  // Both return 0 at once when the codec is already open.
   int InitVideoCodecCtx();
   int InitAudioCodecCtx();
 
-  int InitAvFrame();
+  int ReceiveNextFrame(FramePtr& frame);
 
-  void SaveVideoPixel(const string& target_dir, int image_width, int image_height,
-                      const vector<uint8_t>& rgb_pixel);
+  // With is_seek_allowed the demux position may move, so that a demuxer which loads its index on
+  // the first seek has done so; the caller repositions afterwards.
+  int BuildKeyframeIndex(bool is_seek_allowed);
+  string GetIndexCachePath() const;
+  int LoadIndexCache(IndexCache& index_cache);
+  int SaveIndexCache();
 
  private:
   string av_path_;
+  FFmpegDecoderConfig config_;
+  DecoderInitProfile init_profile_;
 
+  shared_ptr<AvioInput> avio_input_;
+  // Declared before av_ctx_, which reads through it until it is closed.
+  shared_ptr<AVIOContext> avio_ctx_;
   shared_ptr<AVFormatContext> av_ctx_;
-  shared_ptr<AVFrame> video_frame_;
+  shared_ptr<PacketPool> packet_pool_;
+  // Declared before the codec contexts, which call back into them until they are freed.
+  shared_ptr<FramePool> video_frame_pool_;
+  shared_ptr<FramePool> audio_frame_pool_;
+
   shared_ptr<AVCodecContext> video_codec_ctx_;
   AVStream* video_stream_ = nullptr;
+  shared_ptr<FrameDecoder> video_frame_decoder_;
   size_t video_frame_num_ = 0;
 
-  shared_ptr<AVFrame> audio_frame_;
   shared_ptr<AVCodecContext> audio_codec_ctx_;
   AVStream* audio_stream_ = nullptr;
+  shared_ptr<FrameDecoder> audio_frame_decoder_;
   size_t audio_frame_num_ = 0;
 
+  bool demux_eof_ = false;
+
+  // Built on the first seek, or loaded from the index cache.
+  unique_ptr<KeyframeIndex> keyframe_index_;
+  // Stream seconds, NAN when no accurate seek is pending.
+  double seek_target_sec_ = NAN;
+
   static constexpr size_t kMaxAudioFrameBufferSize = 192000;
   vector<uint8_t> audio_frame_buff_;
 };
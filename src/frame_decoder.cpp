@@ -0,0 +1,96 @@
+#include "frame_decoder.h"
+
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+FrameDecoder::FrameDecoder(AVCodecContext* codec_ctx) : codec_ctx_(codec_ctx) {
+  frame_.reset(av_frame_alloc(), [](AVFrame*& ptr) { av_frame_free(&ptr); });
+}
+
+int FrameDecoder::Decode(const AVPacket* packet, const FrameCallback& on_frame) {
+  int ret = Send(packet);
+  int drain_ret = 0;
+  if (ret == AVERROR(EAGAIN)) {
+    // The decoder is full: take all its frames out, then the packet is accepted. A packet left
+    // out here would corrupt every frame that references it.
+    drain_ret = Drain(on_frame, true);
+    ret = Send(packet);
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  if (drain_ret < 0) {
+    return drain_ret;
+  }
+  return Drain(on_frame);
+}
+
+int FrameDecoder::Flush(const FrameCallback& on_frame) {
+  int ret = Send(nullptr);
+  if (ret < 0 && ret != AVERROR_EOF) {
+    return ret;
+  }
+  ret = Drain(on_frame);
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+void FrameDecoder::Reset() {
+  avcodec_flush_buffers(codec_ctx_);
+  flushed_ = false;
+}
+
+int FrameDecoder::Send(const AVPacket* packet) {
+  if (flushed_) {
+    return AVERROR_EOF;
+  }
+  int ret = avcodec_send_packet(codec_ctx_, packet);
+  if (packet == nullptr) {
+    flushed_ = true;
+    return ret;
+  }
+  if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+    dropped_frame_num_++;
+    spdlog::warn("avcodec_send_packet failed, pts {} ret {}", packet->pts, ret);
+  }
+  return ret;
+}
+
+int FrameDecoder::Receive(AVFrame* frame) {
+  int ret = avcodec_receive_frame(codec_ctx_, frame);
+  if (ret == 0) {
+    decoded_frame_num_++;
+  } else if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+    dropped_frame_num_++;
+    spdlog::warn("avcodec_receive_frame failed, ret {}", ret);
+  }
+  return ret;
+}
+
+AVCodecContext* FrameDecoder::GetCodecCtx() const { return codec_ctx_; }
+
+uint64_t FrameDecoder::GetDecodedFrameNum() const { return decoded_frame_num_; }
+
+uint64_t FrameDecoder::GetDroppedFrameNum() const { return dropped_frame_num_; }
+
+int FrameDecoder::Drain(const FrameCallback& on_frame, bool is_exhaustive) {
+  int callback_ret = 0;
+  while (true) {
+    int ret = Receive(frame_.get());
+    if (ret == AVERROR(EAGAIN)) {
+      return callback_ret;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    if (callback_ret >= 0) {
+      callback_ret = on_frame(frame_.get());
+    }
+    av_frame_unref(frame_.get());
+    if (callback_ret < 0 && !is_exhaustive) {
+      return callback_ret;
+    }
+  }
+}
+
+}  // namespace ryoma
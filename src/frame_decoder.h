@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// Wraps the send/receive API of one codec context. Every packet is fully drained, EAGAIN on
+// send is resolved by draining first, and Flush sends the null packet that releases the frames
+// still held by the decoder (B-frame reordering, frame threads).
+class FrameDecoder {
+ public:
+  // Called for each decoded frame. The frame is unreferenced after the callback returns, so
+  // keep a reference (av_frame_ref) to hold on to it. A negative return stops the drain.
+  using FrameCallback = function<int(AVFrame* frame)>;
+
+ public:
+  explicit FrameDecoder(AVCodecContext* codec_ctx);
+
+  // The packet is always submitted before Decode returns, unless the decoder rejects it. When
+  // the callback stops the drain that makes room for the packet, the frames that still have to
+  // come out first are dropped unseen, and the callback's error is returned once the packet is
+  // in. Frames the packet yields stay in the decoder for the next Decode or Flush.
+  int Decode(const AVPacket* packet, const FrameCallback& on_frame);
+  int Flush(const FrameCallback& on_frame);
+  void Reset();
+
+  // Pull interface for callers that want one frame at a time: Send a packet, then Receive
+  // until it returns AVERROR(EAGAIN).
+  int Send(const AVPacket* packet);
+  int Receive(AVFrame* frame);
+
+  AVCodecContext* GetCodecCtx() const;
+  uint64_t GetDecodedFrameNum() const;
+  uint64_t GetDroppedFrameNum() const;
+
+ private:
+  // Stops at the first callback error, unless is_exhaustive: then every ready frame is taken
+  // out and the callback's first error is returned at the end.
+  int Drain(const FrameCallback& on_frame, bool is_exhaustive = false);
+
+ private:
+  AVCodecContext* codec_ctx_ = nullptr;
+  shared_ptr<AVFrame> frame_;
+  bool flushed_ = false;
+
+  atomic<uint64_t> decoded_frame_num_{0};
+  atomic<uint64_t> dropped_frame_num_{0};
+};
+
+}  // namespace ryoma
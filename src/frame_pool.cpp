@@ -0,0 +1,207 @@
+#include "frame_pool.h"
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+namespace ryoma {
+
+void FramePool::Releaser::operator()(AVFrame* frame) const {
+  if (pool == nullptr) {
+    av_frame_free(&frame);
+    return;
+  }
+  pool->Release(frame);
+}
+
+FramePool::FramePool(size_t max_frame_num) : max_frame_num_(max_frame_num == 0 ? 1 : max_frame_num) {
+  free_frames_.reserve(max_frame_num_);
+}
+
+FramePool::~FramePool() {
+  for (auto* frame : free_frames_) {
+    av_frame_free(&frame);
+  }
+  UninitBufferPools();
+}
+
+void FramePool::Attach(AVCodecContext* codec_ctx) {
+  codec_ctx->opaque = this;
+  codec_ctx->get_buffer2 = GetBuffer2;
+#if LIBAVCODEC_VERSION_MAJOR < 59
+  // Frame threads call get_buffer2 from their own threads; AllocVideoBuffer is locked.
+  codec_ctx->thread_safe_callbacks = 1;
+#endif
+}
+
+FramePtr FramePool::Acquire(bool wait) {
+  AVFrame* frame = nullptr;
+  {
+    unique_lock<mutex> lock(mutex_);
+    if (outstanding_frame_num_ >= max_frame_num_) {
+      if (!wait) {
+        return FramePtr(nullptr, Releaser{this});
+      }
+      acquire_stall_num_++;
+      released_.wait(lock,
+                     [this] { return aborted_ || outstanding_frame_num_ < max_frame_num_; });
+    }
+    if (outstanding_frame_num_ >= max_frame_num_) {
+      return FramePtr(nullptr, Releaser{this});
+    }
+    outstanding_frame_num_++;
+    if (!free_frames_.empty()) {
+      frame = free_frames_.back();
+      free_frames_.pop_back();
+    }
+  }
+  if (frame == nullptr) {
+    frame = av_frame_alloc();
+  }
+  return FramePtr(frame, Releaser{this});
+}
+
+FramePtr FramePool::Ref(const AVFrame* src, bool wait) {
+  auto frame = Acquire(wait);
+  if (frame != nullptr && av_frame_ref(frame.get(), src) < 0) {
+    frame.reset();
+  }
+  return frame;
+}
+
+FramePtr FramePool::Move(AVFrame* src, bool wait) {
+  auto frame = Acquire(wait);
+  if (frame != nullptr) {
+    av_frame_move_ref(frame.get(), src);
+  }
+  return frame;
+}
+
+void FramePool::Abort() {
+  lock_guard<mutex> lock(mutex_);
+  aborted_ = true;
+  released_.notify_all();
+}
+
+void FramePool::Reset() {
+  lock_guard<mutex> lock(mutex_);
+  aborted_ = false;
+}
+
+FramePoolStats FramePool::GetStats() const {
+  FramePoolStats stats;
+  {
+    lock_guard<mutex> lock(mutex_);
+    stats.outstanding_frame_num = outstanding_frame_num_;
+    stats.acquire_stall_num = acquire_stall_num_;
+  }
+  stats.pooled_buffer_num = pooled_buffer_num_;
+  stats.default_buffer_num = default_buffer_num_;
+  return stats;
+}
+
+int FramePool::GetBuffer2(AVCodecContext* codec_ctx, AVFrame* frame, int flags) {
+  auto* frame_pool = static_cast<FramePool*>(codec_ctx->opaque);
+  if (frame_pool != nullptr && codec_ctx->codec_type == AVMEDIA_TYPE_VIDEO &&
+      (codec_ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+    if (frame_pool->AllocVideoBuffer(codec_ctx, frame) == 0) {
+      frame_pool->pooled_buffer_num_++;
+      return 0;
+    }
+  }
+  if (frame_pool != nullptr) {
+    frame_pool->default_buffer_num_++;
+  }
+  return avcodec_default_get_buffer2(codec_ctx, frame, flags);
+}
+
+int FramePool::AllocVideoBuffer(AVCodecContext* codec_ctx, AVFrame* frame) {
+  lock_guard<mutex> lock(buffer_mutex_);
+  auto format = static_cast<AVPixelFormat>(frame->format);
+  if (frame->width != pool_width_ || frame->height != pool_height_ || format != pool_format_) {
+    int ret = InitBufferPools(codec_ctx, frame->width, frame->height, format);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  for (int i = 0; i < plane_num_; i++) {
+    frame->buf[i] = av_buffer_pool_get(plane_pools_[i]);
+    if (frame->buf[i] == nullptr) {
+      for (int j = 0; j < i; j++) {
+        av_buffer_unref(&frame->buf[j]);
+      }
+      return AVERROR(ENOMEM);
+    }
+    frame->data[i] = frame->buf[i]->data;
+    frame->linesize[i] = plane_linesize_[i];
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
+int FramePool::InitBufferPools(AVCodecContext* codec_ctx, int width, int height,
+                               AVPixelFormat format) {
+  UninitBufferPools();
+
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+  if (desc == nullptr ||
+      (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM))) {
+    return AVERROR(ENOSYS);
+  }
+
+  // Same padding the default allocator applies: codec alignment plus room for edge emulation.
+  int aligned_width = width;
+  int aligned_height = height;
+  int linesize_align[AV_NUM_DATA_POINTERS];
+  avcodec_align_dimensions2(codec_ctx, &aligned_width, &aligned_height, linesize_align);
+
+  int linesize[4] = {0};
+  int ret = av_image_fill_linesizes(linesize, format, aligned_width);
+  if (ret < 0) {
+    return ret;
+  }
+
+  plane_num_ = av_pix_fmt_count_planes(format);
+  for (int i = 0; i < plane_num_; i++) {
+    plane_linesize_[i] = FFALIGN(linesize[i], kStrideAlign);
+    bool is_chroma = (i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+    int plane_height = is_chroma ? AV_CEIL_RSHIFT(aligned_height, desc->log2_chroma_h)
+                                 : aligned_height;
+    int plane_size = plane_linesize_[i] * plane_height + 16 + kStrideAlign - 1;
+    plane_pools_[i] = av_buffer_pool_init(plane_size, nullptr);
+    if (plane_pools_[i] == nullptr) {
+      UninitBufferPools();
+      return AVERROR(ENOMEM);
+    }
+  }
+  pool_width_ = width;
+  pool_height_ = height;
+  pool_format_ = format;
+  spdlog::info("frame pool {}x{} {} planes {}", width, height, desc->name, plane_num_);
+  return 0;
+}
+
+void FramePool::UninitBufferPools() {
+  // Pictures still referenced keep their pool alive until they are released.
+  for (auto*& plane_pool : plane_pools_) {
+    av_buffer_pool_uninit(&plane_pool);
+  }
+  plane_num_ = 0;
+  pool_width_ = 0;
+  pool_height_ = 0;
+  pool_format_ = AV_PIX_FMT_NONE;
+}
+
+void FramePool::Release(AVFrame* frame) {
+  av_frame_unref(frame);
+  lock_guard<mutex> lock(mutex_);
+  outstanding_frame_num_--;
+  free_frames_.push_back(frame);
+  released_.notify_one();
+}
+
+}  // namespace ryoma
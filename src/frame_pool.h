@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct FramePoolStats {
+  size_t outstanding_frame_num = 0;
+  uint64_t acquire_stall_num = 0;
+  uint64_t pooled_buffer_num = 0;   // pictures decoded into pool buffers
+  uint64_t default_buffer_num = 0;  // pictures the pool could not take
+};
+
+// Refcounted frame handles with a bounded count. A FramePtr only references its buffers, so
+// Ref hands the same picture to another consumer without copying pixels. Attach installs a
+// get_buffer2 that decodes video pictures straight into per-plane AVBufferPools, so steady
+// state decoding reuses picture memory instead of allocating it.
+class FramePool {
+ public:
+  struct Releaser {
+    FramePool* pool = nullptr;
+    void operator()(AVFrame* frame) const;
+  };
+  using FramePtr = unique_ptr<AVFrame, Releaser>;
+
+  static constexpr size_t kDefaultMaxFrameNum = 16;
+
+ public:
+  explicit FramePool(size_t max_frame_num = kDefaultMaxFrameNum);
+  ~FramePool();
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // Must be called before avcodec_open2. The pool must outlive the codec context.
+  void Attach(AVCodecContext* codec_ctx);
+
+  // With wait, blocks while max_frame_num handles are out; otherwise returns nullptr.
+  FramePtr Acquire(bool wait = true);
+  FramePtr Ref(const AVFrame* src, bool wait = true);
+  FramePtr Move(AVFrame* src, bool wait = true);
+
+  // Wakes blocked Acquire calls, which then return nullptr until Reset.
+  void Abort();
+  void Reset();
+
+  FramePoolStats GetStats() const;
+
+ private:
+  static int GetBuffer2(AVCodecContext* codec_ctx, AVFrame* frame, int flags);
+  int AllocVideoBuffer(AVCodecContext* codec_ctx, AVFrame* frame);
+  int InitBufferPools(AVCodecContext* codec_ctx, int width, int height, AVPixelFormat format);
+  void UninitBufferPools();
+
+  void Release(AVFrame* frame);
+
+ private:
+  static constexpr int kStrideAlign = 64;
+
+  const size_t max_frame_num_;
+
+  mutable mutex mutex_;
+  condition_variable released_;
+  vector<AVFrame*> free_frames_;
+  size_t outstanding_frame_num_ = 0;
+  bool aborted_ = false;
+  uint64_t acquire_stall_num_ = 0;
+
+  mutex buffer_mutex_;
+  int pool_width_ = 0;
+  int pool_height_ = 0;
+  AVPixelFormat pool_format_ = AV_PIX_FMT_NONE;
+  int plane_num_ = 0;
+  array<int, 4> plane_linesize_{};
+  array<AVBufferPool*, 4> plane_pools_{};
+
+  atomic<uint64_t> pooled_buffer_num_{0};
+  atomic<uint64_t> default_buffer_num_{0};
+};
+
+using FramePtr = FramePool::FramePtr;
+
+}  // namespace ryoma
@@ -0,0 +1,288 @@
+#include "frame_sink.h"
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+namespace ryoma {
+
+namespace {
+
+bool IsVideoFormatSet(const FrameSinkFormat& format) {
+  return format.pixel_format != AV_PIX_FMT_NONE || format.width > 0 || format.height > 0;
+}
+
+// Bytes of one plane; packed audio has a single plane holding every channel.
+size_t GetAudioPlaneSize(const AVFrame* frame) {
+  auto sample_format = static_cast<AVSampleFormat>(frame->format);
+  size_t size = static_cast<size_t>(frame->nb_samples) * av_get_bytes_per_sample(sample_format);
+  return av_sample_fmt_is_planar(sample_format) ? size : size * frame->channels;
+}
+
+int GetAudioPlaneNum(const AVFrame* frame) {
+  return av_sample_fmt_is_planar(static_cast<AVSampleFormat>(frame->format)) ? frame->channels
+                                                                              : 1;
+}
+
+}  // namespace
+
+FrameSink::FrameSink(const FrameSinkFormat& format) : format_(format) {}
+
+FrameSink::~FrameSink() = default;
+
+int FrameSink::Open(const AVCodecContext* video_codec_ctx,
+                    const AVCodecContext* audio_codec_ctx) {
+  video_frame_num_ = 0;
+  audio_frame_num_ = 0;
+  video_frame_convert_.reset();
+  audio_frame_resample_.reset();
+
+  int ret = OnOpen(video_codec_ctx, audio_codec_ctx);
+  if (ret < 0) {
+    return ret;
+  }
+
+  // The video converter is built on the first frame, which carries the real size and format.
+  if (audio_codec_ctx != nullptr && format_.sample_format != AV_SAMPLE_FMT_NONE) {
+    int sample_rate = format_.sample_rate > 0 ? format_.sample_rate : audio_codec_ctx->sample_rate;
+    if (format_.sample_format != audio_codec_ctx->sample_fmt ||
+        sample_rate != audio_codec_ctx->sample_rate) {
+      audio_frame_resample_ =
+          make_unique<AudioFrameResample>(audio_codec_ctx, sample_rate, format_.sample_format);
+      // extended_data may point into the resampler, which av_frame_free must not release.
+      resampled_frame_.reset(av_frame_alloc(), [](AVFrame* ptr) {
+        if (ptr != nullptr) {
+          ptr->extended_data = ptr->data;
+        }
+        av_frame_free(&ptr);
+      });
+      if (resampled_frame_ == nullptr) {
+        return AVERROR(ENOMEM);
+      }
+    }
+  }
+  return 0;
+}
+
+int FrameSink::PushVideoFrame(AVFrame* frame) {
+  const AVFrame* target_frame = frame;
+  if (IsVideoFormatSet(format_)) {
+    target_frame = GetFrameConvert(frame)->Convert(frame);
+  }
+  int ret = OnVideoFrame(target_frame);
+  if (ret < 0) {
+    return ret;
+  }
+  video_frame_num_++;
+  return 0;
+}
+
+int FrameSink::PushAudioFrame(AVFrame* frame) {
+  const AVFrame* target_frame = frame;
+  if (audio_frame_resample_ != nullptr) {
+    auto samples = audio_frame_resample_->Resample(frame);
+    // Nothing yet while swr fills its filter, the samples come with later frames.
+    if (samples.empty()) {
+      return 0;
+    }
+    target_frame = WrapSamples(samples, frame);
+  }
+  int ret = OnAudioFrame(target_frame);
+  if (ret < 0) {
+    return ret;
+  }
+  audio_frame_num_++;
+  return 0;
+}
+
+int FrameSink::Close() {
+  int ret = 0;
+  if (audio_frame_resample_ != nullptr) {
+    auto samples = audio_frame_resample_->Flush();
+    if (!samples.empty()) {
+      ret = OnAudioFrame(WrapSamples(samples, nullptr));
+      if (ret >= 0) {
+        audio_frame_num_++;
+      }
+    }
+  }
+  int ret_close = OnClose();
+  ret = ret < 0 ? ret : ret_close;
+  video_frame_convert_.reset();
+  audio_frame_resample_.reset();
+  resampled_frame_.reset();
+  return ret;
+}
+
+uint64_t FrameSink::GetVideoFrameNum() const { return video_frame_num_; }
+
+uint64_t FrameSink::GetAudioFrameNum() const { return audio_frame_num_; }
+
+int FrameSink::OnOpen(const AVCodecContext* video_codec_ctx,
+                      const AVCodecContext* audio_codec_ctx) {
+  return 0;
+}
+
+int FrameSink::OnClose() { return 0; }
+
+FrameSinkFormat& FrameSink::GetFormat() { return format_; }
+
+const AVFrame* FrameSink::WrapSamples(const AudioSamples& samples, const AVFrame* src) {
+  auto* frame = resampled_frame_.get();
+  frame->format = audio_frame_resample_->GetSampleFormat();
+  frame->sample_rate = audio_frame_resample_->GetSampleRate();
+  frame->channel_layout = audio_frame_resample_->GetChannelLayout();
+  frame->channels = audio_frame_resample_->GetChannels();
+  frame->nb_samples = samples.sample_num;
+  // The flushed tail has no source frame and no timestamp of its own.
+  frame->pts = src != nullptr ? src->pts : AV_NOPTS_VALUE;
+  frame->best_effort_timestamp = src != nullptr ? src->best_effort_timestamp : AV_NOPTS_VALUE;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+    frame->data[i] = i < samples.plane_num ? samples.planes[i] : nullptr;
+  }
+  frame->linesize[0] = static_cast<int>(samples.plane_size);
+  frame->extended_data = const_cast<uint8_t**>(samples.planes);
+  return frame;
+}
+
+VideoFrameConvert* FrameSink::GetFrameConvert(const AVFrame* frame) {
+  if (video_frame_convert_ == nullptr || video_frame_convert_->GetSrcWidth() != frame->width ||
+      video_frame_convert_->GetSrcHeight() != frame->height ||
+      video_frame_convert_->GetSrcPixelFormat() != frame->format) {
+    auto pixel_format = static_cast<AVPixelFormat>(frame->format);
+    VideoFrameConvertConfig config;
+    config.target_width = format_.width;
+    config.target_height = format_.height;
+    config.preset = format_.scale_preset;
+    // The decoder already keeps the other cores busy.
+    config.thread_num = 1;
+    video_frame_convert_ = make_unique<VideoFrameConvert>(
+        frame->width, frame->height, pixel_format,
+        format_.pixel_format != AV_PIX_FMT_NONE ? format_.pixel_format : pixel_format, config);
+  }
+  return video_frame_convert_.get();
+}
+
+int NullSink::OnVideoFrame(const AVFrame* frame) { return 0; }
+
+int NullSink::OnAudioFrame(const AVFrame* frame) { return 0; }
+
+RawFileSink::RawFileSink(const string& video_path, const string& audio_path,
+                         const FrameSinkFormat& format, RawVideoLayout layout)
+    : FrameSink(format), video_path_(video_path), audio_path_(audio_path),
+      raw_video_writer_(layout) {}
+
+int RawFileSink::OnOpen(const AVCodecContext* video_codec_ctx,
+                        const AVCodecContext* audio_codec_ctx) {
+  if (!video_path_.empty() && video_codec_ctx != nullptr) {
+    int ret = raw_video_writer_.Open(video_path_);
+    if (ret < 0) {
+      spdlog::error("RawVideoWriter::Open {} failed, ret {}", video_path_, ret);
+      return ret;
+    }
+  }
+  if (!audio_path_.empty() && audio_codec_ctx != nullptr) {
+    auto& format = GetFormat();
+    // Raw PCM files are interleaved unless asked otherwise.
+    if (format.sample_format == AV_SAMPLE_FMT_NONE) {
+      format.sample_format = av_get_packed_sample_fmt(audio_codec_ctx->sample_fmt);
+    }
+    int ret = audio_file_.Open(audio_path_);
+    if (ret < 0) {
+      spdlog::error("RawFile::Open {} failed, ret {}", audio_path_, ret);
+      return ret;
+    }
+    audio_offset_ = 0;
+  }
+  return 0;
+}
+
+int RawFileSink::OnVideoFrame(const AVFrame* frame) {
+  if (video_path_.empty()) {
+    return 0;
+  }
+  return raw_video_writer_.WriteFrame(frame);
+}
+
+int RawFileSink::OnAudioFrame(const AVFrame* frame) {
+  if (!audio_file_.IsOpen()) {
+    return 0;
+  }
+  int plane_num = GetAudioPlaneNum(frame);
+  size_t plane_size = GetAudioPlaneSize(frame);
+  for (int i = 0; i < plane_num; i++) {
+    int ret = audio_file_.PWrite(frame->extended_data[i], plane_size, audio_offset_);
+    if (ret < 0) {
+      spdlog::error("RawFile::PWrite {} failed, ret {}", audio_path_, ret);
+      return ret;
+    }
+    audio_offset_ += plane_size;
+  }
+  return 0;
+}
+
+int RawFileSink::OnClose() {
+  int ret = 0;
+  if (!video_path_.empty()) {
+    ret = raw_video_writer_.Close();
+  }
+  audio_file_.Close();
+  return ret;
+}
+
+CallbackSink::CallbackSink(Callback on_video_frame, Callback on_audio_frame,
+                           const FrameSinkFormat& format)
+    : FrameSink(format), on_video_frame_(move(on_video_frame)),
+      on_audio_frame_(move(on_audio_frame)) {}
+
+int CallbackSink::OnVideoFrame(const AVFrame* frame) {
+  return on_video_frame_ ? on_video_frame_(frame) : 0;
+}
+
+int CallbackSink::OnAudioFrame(const AVFrame* frame) {
+  return on_audio_frame_ ? on_audio_frame_(frame) : 0;
+}
+
+uint32_t ChecksumSink::GetVideoChecksum() const { return video_checksum_; }
+
+uint32_t ChecksumSink::GetAudioChecksum() const { return audio_checksum_; }
+
+int ChecksumSink::OnVideoFrame(const AVFrame* frame) {
+  auto pixel_format = static_cast<AVPixelFormat>(frame->format);
+  const auto* desc = av_pix_fmt_desc_get(pixel_format);
+  if (desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+    return AVERROR(EINVAL);
+  }
+  int plane_num = av_pix_fmt_count_planes(pixel_format);
+  for (int plane = 0; plane < plane_num; plane++) {
+    int row_size = av_image_get_linesize(pixel_format, frame->width, plane);
+    bool is_chroma = (plane == 1 || plane == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+    int height = is_chroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+    // Only the visible bytes of each row, the padding differs between decoders.
+    const uint8_t* row = frame->data[plane];
+    for (int y = 0; y < height; y++, row += frame->linesize[plane]) {
+      video_checksum_ = av_adler32_update(video_checksum_, row, row_size);
+    }
+  }
+  return 0;
+}
+
+int ChecksumSink::OnAudioFrame(const AVFrame* frame) {
+  int plane_num = GetAudioPlaneNum(frame);
+  size_t plane_size = GetAudioPlaneSize(frame);
+  for (int i = 0; i < plane_num; i++) {
+    audio_checksum_ = av_adler32_update(audio_checksum_, frame->extended_data[i], plane_size);
+  }
+  return 0;
+}
+
+int ChecksumSink::OnClose() {
+  spdlog::info("checksum video {:08x} ({} frames), audio {:08x} ({} frames)", video_checksum_,
+               GetVideoFrameNum(), audio_checksum_, GetAudioFrameNum());
+  return 0;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "audio_frame_resample.h"
+#include "raw_file.h"
+#include "raw_video_writer.h"
+#include "video_frame_convert.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/adler32.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// What a sink wants to receive. Zero and NONE keep what the decoder produces.
+struct FrameSinkFormat {
+  AVPixelFormat pixel_format = AV_PIX_FMT_NONE;
+  int width = 0;
+  int height = 0;
+  ScalePreset scale_preset = ScalePreset::kBilinear;
+  AVSampleFormat sample_format = AV_SAMPLE_FMT_NONE;
+  int sample_rate = 0;
+};
+
+// Consumer of decoded frames with no window, no audio device and no clock; FrameSinkRunner
+// pushes frames as fast as the decoder makes them. A sink that asked for a format gets its
+// frames converted first. Video and audio frames arrive on two different threads, but each
+// kind always from the same one.
+class FrameSink {
+ public:
+  explicit FrameSink(const FrameSinkFormat& format = FrameSinkFormat());
+  virtual ~FrameSink();
+
+  FrameSink(const FrameSink&) = delete;
+  FrameSink& operator=(const FrameSink&) = delete;
+
+  int Open(const AVCodecContext* video_codec_ctx, const AVCodecContext* audio_codec_ctx);
+  int PushVideoFrame(AVFrame* frame);
+  int PushAudioFrame(AVFrame* frame);
+  int Close();
+
+  uint64_t GetVideoFrameNum() const;
+  uint64_t GetAudioFrameNum() const;
+
+ protected:
+  // Runs before the converters are set up, the sink may still adjust its format.
+  virtual int OnOpen(const AVCodecContext* video_codec_ctx,
+                     const AVCodecContext* audio_codec_ctx);
+  virtual int OnVideoFrame(const AVFrame* frame) = 0;
+  virtual int OnAudioFrame(const AVFrame* frame) = 0;
+  virtual int OnClose();
+
+  FrameSinkFormat& GetFormat();
+
+ private:
+  VideoFrameConvert* GetFrameConvert(const AVFrame* frame);
+  // Describes resampled samples as a frame, src gives the timestamps.
+  const AVFrame* WrapSamples(const AudioSamples& samples, const AVFrame* src);
+
+ private:
+  FrameSinkFormat format_;
+
+  unique_ptr<VideoFrameConvert> video_frame_convert_;
+  unique_ptr<AudioFrameResample> audio_frame_resample_;
+  // Describes the resampled samples, which stay owned by the resampler.
+  shared_ptr<AVFrame> resampled_frame_;
+
+  atomic<uint64_t> video_frame_num_{0};
+  atomic<uint64_t> audio_frame_num_{0};
+};
+
+// Decodes and drops, for measuring the decoder alone.
+class NullSink : public FrameSink {
+ public:
+  using FrameSink::FrameSink;
+
+ protected:
+  int OnVideoFrame(const AVFrame* frame) override;
+  int OnAudioFrame(const AVFrame* frame) override;
+};
+
+// Raw pictures through RawVideoWriter and raw PCM, interleaved unless a planar sample format is
+// asked for. An empty path skips that stream.
+class RawFileSink : public FrameSink {
+ public:
+  RawFileSink(const string& video_path, const string& audio_path,
+              const FrameSinkFormat& format = FrameSinkFormat(),
+              RawVideoLayout layout = RawVideoLayout::kPlanar);
+
+ protected:
+  int OnOpen(const AVCodecContext* video_codec_ctx,
+             const AVCodecContext* audio_codec_ctx) override;
+  int OnVideoFrame(const AVFrame* frame) override;
+  int OnAudioFrame(const AVFrame* frame) override;
+  int OnClose() override;
+
+ private:
+  string video_path_;
+  string audio_path_;
+  RawVideoWriter raw_video_writer_;
+  RawFile audio_file_;
+  int64_t audio_offset_ = 0;
+};
+
+class CallbackSink : public FrameSink {
+ public:
+  using Callback = function<int(const AVFrame*)>;
+
+  // A null callback ignores that stream.
+  CallbackSink(Callback on_video_frame, Callback on_audio_frame,
+               const FrameSinkFormat& format = FrameSinkFormat());
+
+ protected:
+  int OnVideoFrame(const AVFrame* frame) override;
+  int OnAudioFrame(const AVFrame* frame) override;
+
+ private:
+  Callback on_video_frame_;
+  Callback on_audio_frame_;
+};
+
+// Adler-32 over the visible pixels and the samples, independent of strides and padding, so two
+// runs or two builds can be compared for bit-exact output.
+class ChecksumSink : public FrameSink {
+ public:
+  using FrameSink::FrameSink;
+
+  uint32_t GetVideoChecksum() const;
+  uint32_t GetAudioChecksum() const;
+
+ protected:
+  int OnVideoFrame(const AVFrame* frame) override;
+  int OnAudioFrame(const AVFrame* frame) override;
+  int OnClose() override;
+
+ private:
+  AVAdler video_checksum_ = 1;
+  AVAdler audio_checksum_ = 1;
+};
+
+}  // namespace ryoma
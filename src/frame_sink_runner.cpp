@@ -0,0 +1,91 @@
+#include "frame_sink_runner.h"
+
+#include <chrono>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+FrameSinkRunner::FrameSinkRunner(FFmpegDecoder* ffmpeg_decoder)
+    : ffmpeg_decoder_(ffmpeg_decoder) {}
+
+void FrameSinkRunner::AddSink(shared_ptr<FrameSink> sink) { sinks_.push_back(move(sink)); }
+
+int FrameSinkRunner::Run() {
+  if (ffmpeg_decoder_ == nullptr || sinks_.empty()) {
+    spdlog::error("FrameSinkRunner needs a decoder and at least one sink");
+    return AVERROR(EINVAL);
+  }
+  stats_ = FrameSinkRunnerStats();
+  sink_rets_ = make_unique<atomic<int>[]>(sinks_.size());
+  vector<bool> is_opened(sinks_.size());
+  for (size_t i = 0; i < sinks_.size(); i++) {
+    int ret = sinks_[i]->Open(ffmpeg_decoder_->GetVideoCodecCtx(),
+                              ffmpeg_decoder_->GetAudioCodecCtx());
+    if (ret < 0) {
+      spdlog::error("FrameSink::Open {} failed, ret {}", i, ret);
+    }
+    sink_rets_[i] = ret;
+    is_opened[i] = ret >= 0;
+  }
+
+  auto start = chrono::steady_clock::now();
+  ffmpeg_decoder_->ResetAvStream();
+  DecodePipeline pipeline(ffmpeg_decoder_);
+  int ret = pipeline.Start();
+  if (ret < 0) {
+    spdlog::error("DecodePipeline::Start failed, ret {}", ret);
+  } else {
+    thread video_thread(&FrameSinkRunner::DrainLoop, this, &pipeline, true);
+    DrainLoop(&pipeline, false);
+    video_thread.join();
+  }
+  stats_.pipeline = pipeline.GetStats();
+  pipeline.Stop();
+  stats_.elapsed_sec =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  for (size_t i = 0; i < sinks_.size(); i++) {
+    // A sink that failed mid-stream is still closed, so its files are complete up to the error.
+    int ret_close = is_opened[i] ? sinks_[i]->Close() : 0;
+    int sink_ret = sink_rets_[i] < 0 ? sink_rets_[i].load() : ret_close;
+    if (ret >= 0 && sink_ret < 0) {
+      ret = sink_ret;
+    }
+  }
+  if (stats_.elapsed_sec > 0) {
+    stats_.video_fps = stats_.video_frame_num / stats_.elapsed_sec;
+  }
+  spdlog::info("sinks took {} video and {} audio frames in {:.3f}s, {:.1f} fps",
+               stats_.video_frame_num, stats_.audio_frame_num, stats_.elapsed_sec,
+               stats_.video_fps);
+  return ret;
+}
+
+FrameSinkRunnerStats FrameSinkRunner::GetStats() const { return stats_; }
+
+void FrameSinkRunner::DrainLoop(DecodePipeline* pipeline, bool is_video) {
+  PushFunc push = is_video ? &FrameSink::PushVideoFrame : &FrameSink::PushAudioFrame;
+  uint64_t frame_num = 0;
+  FramePtr frame;
+  while (is_video ? pipeline->PopVideoFrame(frame) : pipeline->PopAudioFrame(frame)) {
+    for (size_t i = 0; i < sinks_.size(); i++) {
+      if (sink_rets_[i] < 0) {
+        continue;
+      }
+      int ret = (sinks_[i].get()->*push)(frame.get());
+      if (ret < 0) {
+        spdlog::error("FrameSink {} failed on a {} frame, ret {}", i, is_video ? "video" : "audio",
+                      ret);
+        // Both drain threads skip it from now on.
+        sink_rets_[i] = ret;
+      }
+    }
+    frame.reset();
+    frame_num++;
+  }
+  (is_video ? stats_.video_frame_num : stats_.audio_frame_num) = frame_num;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "decode_pipeline.h"
+#include "ffmpeg_decoder.h"
+#include "frame_sink.h"
+
+using namespace std;
+
+namespace ryoma {
+
+struct FrameSinkRunnerStats {
+  uint64_t video_frame_num = 0;
+  uint64_t audio_frame_num = 0;
+  double elapsed_sec = 0;
+  double video_fps = 0;
+  DecodePipelineStats pipeline;
+};
+
+// Drives sinks from a DecodePipeline as fast as it decodes, no SDL and no A/V pacing. Video and
+// audio are drained by their own threads, so a slow sink on one stream never stalls the other's
+// decoder through a full frame queue. Every sink sees every frame; a sink that fails is skipped
+// from then on and the rest keep going.
+class FrameSinkRunner {
+ public:
+  explicit FrameSinkRunner(FFmpegDecoder* ffmpeg_decoder);
+
+  void AddSink(shared_ptr<FrameSink> sink);
+
+  // Decodes from the start to the end of the input. Returns the first sink error, if any.
+  int Run();
+
+  FrameSinkRunnerStats GetStats() const;
+
+ private:
+  using PushFunc = int (FrameSink::*)(AVFrame*);
+
+  void DrainLoop(DecodePipeline* pipeline, bool is_video);
+
+ private:
+  FFmpegDecoder* ffmpeg_decoder_ = nullptr;
+  vector<shared_ptr<FrameSink>> sinks_;
+  // Per sink, written by both drain threads.
+  unique_ptr<atomic<int>[]> sink_rets_;
+
+  FrameSinkRunnerStats stats_;
+};
+
+}  // namespace ryoma
@@ -0,0 +1,437 @@
+#include "index_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "raw_file.h"
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+namespace {
+
+constexpr char kMagic[8] = {'R', 'Y', 'I', 'D', 'X', 0, 0, 0};
+// Written as is, reads back differently on a machine of the other byte order.
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+struct KeyframeRecord {
+  int64_t pts;
+  int64_t pos;
+};
+
+struct PacketRecord {
+  int64_t pts;
+  int64_t pos;
+  int32_t is_key;
+  int32_t reserved;
+};
+
+int64_t AlignUp(int64_t size) { return (size + 7) & ~int64_t(7); }
+
+// Size and modification time identify the version of the input the cache was written for.
+int GetFileIdentity(const string& path, int64_t& file_size, int64_t& mtime) {
+  error_code ec;
+  auto size = filesystem::file_size(path, ec);
+  if (ec) {
+    spdlog::error("file_size {} failed, {}", path, ec.message());
+    return AVERROR(EIO);
+  }
+  auto write_time = filesystem::last_write_time(path, ec);
+  if (ec) {
+    spdlog::error("last_write_time {} failed, {}", path, ec.message());
+    return AVERROR(EIO);
+  }
+  file_size = static_cast<int64_t>(size);
+  mtime = static_cast<int64_t>(write_time.time_since_epoch().count());
+  return 0;
+}
+
+string GetAbsolutePath(const string& path) {
+  error_code ec;
+  auto absolute_path = filesystem::absolute(path, ec);
+  return ec ? path : absolute_path.lexically_normal().string();
+}
+
+void Append(vector<uint8_t>& buffer, const void* data, size_t size) {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  buffer.insert(buffer.end(), bytes, bytes + size);
+  buffer.resize(AlignUp(buffer.size()));
+}
+
+}  // namespace
+
+struct IndexCache::FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int64_t file_size;
+  int64_t mtime;
+  uint32_t path_size;
+  uint32_t stream_num;
+  int32_t video_stream_index;
+  int32_t index_source;
+  uint64_t keyframe_num;
+  uint64_t packet_num;
+  int64_t start_time;
+  int64_t duration;
+  int64_t bit_rate;
+};
+
+// AVCodecParameters plus the stream fields avformat_find_stream_info fills in.
+struct IndexCache::StreamRecord {
+  int32_t codec_type;
+  int32_t codec_id;
+  uint32_t codec_tag;
+  int32_t format;
+  int64_t bit_rate;
+  int32_t bits_per_coded_sample;
+  int32_t bits_per_raw_sample;
+  int32_t profile;
+  int32_t level;
+  int32_t width;
+  int32_t height;
+  int32_t sample_aspect_ratio_num;
+  int32_t sample_aspect_ratio_den;
+  int32_t field_order;
+  int32_t color_range;
+  int32_t color_primaries;
+  int32_t color_trc;
+  int32_t color_space;
+  int32_t chroma_location;
+  int32_t video_delay;
+  int32_t channels;
+  uint64_t channel_layout;
+  int32_t sample_rate;
+  int32_t block_align;
+  int32_t frame_size;
+  int32_t initial_padding;
+  int32_t trailing_padding;
+  int32_t seek_preroll;
+  int32_t time_base_num;
+  int32_t time_base_den;
+  int64_t start_time;
+  int64_t duration;
+  int64_t nb_frames;
+  int32_t avg_frame_rate_num;
+  int32_t avg_frame_rate_den;
+  int32_t r_frame_rate_num;
+  int32_t r_frame_rate_den;
+  int32_t disposition;
+  uint32_t extradata_size;
+};
+
+int IndexCache::Save(const string& cache_path, const string& av_path, AVFormatContext* av_ctx,
+                     int video_stream_index, const KeyframeIndex& keyframe_index) {
+  // Records are copied byte for byte, padding would differ between compilers.
+  static_assert(sizeof(FileHeader) == 88, "FileHeader must have no padding");
+  static_assert(sizeof(StreamRecord) == 176, "StreamRecord must have no padding");
+  static_assert(sizeof(KeyframeRecord) == 16 && sizeof(PacketRecord) == 24,
+                "records must have no padding");
+
+  FileHeader header = {};
+  int ret = GetFileIdentity(av_path, header.file_size, header.mtime);
+  if (ret < 0) {
+    return ret;
+  }
+  string path = GetAbsolutePath(av_path);
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byte_order = kByteOrderMark;
+  header.path_size = static_cast<uint32_t>(path.size());
+  header.stream_num = av_ctx->nb_streams;
+  header.video_stream_index = video_stream_index;
+  header.index_source = static_cast<int32_t>(keyframe_index.GetSource());
+  header.keyframe_num = keyframe_index.GetEntries().size();
+  header.packet_num = keyframe_index.GetPackets().size();
+  header.start_time = av_ctx->start_time;
+  header.duration = av_ctx->duration;
+  header.bit_rate = av_ctx->bit_rate;
+
+  vector<uint8_t> buffer;
+  buffer.reserve(sizeof(header) + header.keyframe_num * sizeof(KeyframeRecord) +
+                 header.packet_num * sizeof(PacketRecord) + 4096);
+  Append(buffer, &header, sizeof(header));
+  Append(buffer, path.data(), path.size());
+
+  for (unsigned int i = 0; i < av_ctx->nb_streams; i++) {
+    const auto* stream = av_ctx->streams[i];
+    const auto* codecpar = stream->codecpar;
+    StreamRecord record = {};
+    record.codec_type = codecpar->codec_type;
+    record.codec_id = codecpar->codec_id;
+    record.codec_tag = codecpar->codec_tag;
+    record.format = codecpar->format;
+    record.bit_rate = codecpar->bit_rate;
+    record.bits_per_coded_sample = codecpar->bits_per_coded_sample;
+    record.bits_per_raw_sample = codecpar->bits_per_raw_sample;
+    record.profile = codecpar->profile;
+    record.level = codecpar->level;
+    record.width = codecpar->width;
+    record.height = codecpar->height;
+    record.sample_aspect_ratio_num = codecpar->sample_aspect_ratio.num;
+    record.sample_aspect_ratio_den = codecpar->sample_aspect_ratio.den;
+    record.field_order = codecpar->field_order;
+    record.color_range = codecpar->color_range;
+    record.color_primaries = codecpar->color_primaries;
+    record.color_trc = codecpar->color_trc;
+    record.color_space = codecpar->color_space;
+    record.chroma_location = codecpar->chroma_location;
+    record.video_delay = codecpar->video_delay;
+    record.channels = codecpar->channels;
+    record.channel_layout = codecpar->channel_layout;
+    record.sample_rate = codecpar->sample_rate;
+    record.block_align = codecpar->block_align;
+    record.frame_size = codecpar->frame_size;
+    record.initial_padding = codecpar->initial_padding;
+    record.trailing_padding = codecpar->trailing_padding;
+    record.seek_preroll = codecpar->seek_preroll;
+    record.time_base_num = stream->time_base.num;
+    record.time_base_den = stream->time_base.den;
+    record.start_time = stream->start_time;
+    record.duration = stream->duration;
+    record.nb_frames = stream->nb_frames;
+    record.avg_frame_rate_num = stream->avg_frame_rate.num;
+    record.avg_frame_rate_den = stream->avg_frame_rate.den;
+    record.r_frame_rate_num = stream->r_frame_rate.num;
+    record.r_frame_rate_den = stream->r_frame_rate.den;
+    record.disposition = stream->disposition;
+    record.extradata_size = codecpar->extradata_size > 0 ? codecpar->extradata_size : 0;
+    Append(buffer, &record, sizeof(record));
+    Append(buffer, codecpar->extradata, record.extradata_size);
+  }
+
+  for (const auto& entry : keyframe_index.GetEntries()) {
+    KeyframeRecord record = {entry.pts, entry.pos};
+    Append(buffer, &record, sizeof(record));
+  }
+  for (const auto& packet : keyframe_index.GetPackets()) {
+    PacketRecord record = {packet.pts, packet.pos, packet.is_key, 0};
+    Append(buffer, &record, sizeof(record));
+  }
+
+  string temp_path = cache_path + ".tmp";
+  RawFile raw_file;
+  ret = raw_file.Open(temp_path);
+  if (ret < 0) {
+    return ret;
+  }
+  ret = raw_file.PWrite(buffer.data(), buffer.size(), 0);
+  raw_file.Close();
+  error_code ec;
+  if (ret == 0) {
+    filesystem::rename(temp_path, cache_path, ec);
+    if (ec) {
+      spdlog::error("rename {} to {} failed, {}", temp_path, cache_path, ec.message());
+      ret = AVERROR(EIO);
+    }
+  }
+  if (ret < 0) {
+    filesystem::remove(temp_path, ec);
+    return ret;
+  }
+  spdlog::info("index cache {} saved, {} streams {} keyframes {} packets, {} bytes", cache_path,
+               header.stream_num, header.keyframe_num, header.packet_num, buffer.size());
+  return 0;
+}
+
+int IndexCache::Load(const string& cache_path, const string& av_path) {
+  int ret = mapped_file_.Open(cache_path);
+  if (ret < 0) {
+    return ret;
+  }
+  const uint8_t* data = mapped_file_.GetData();
+  int64_t size = mapped_file_.GetSize();
+  auto reject = [&](const char* reason) {
+    spdlog::info("index cache {} not used, {}", cache_path, reason);
+    mapped_file_.Close();
+    return AVERROR_INVALIDDATA;
+  };
+
+  if (size < static_cast<int64_t>(sizeof(FileHeader))) {
+    return reject("truncated header");
+  }
+  const auto* header = GetHeader();
+  if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->byte_order != kByteOrderMark) {
+    return reject("not an index cache");
+  }
+  if (header->version != kVersion) {
+    return reject("other version");
+  }
+  if (header->index_source < static_cast<int32_t>(KeyframeIndexSource::kNone) ||
+      header->index_source > static_cast<int32_t>(KeyframeIndexSource::kScan)) {
+    return reject("unknown index source");
+  }
+  int64_t file_size = 0;
+  int64_t mtime = 0;
+  if (GetFileIdentity(av_path, file_size, mtime) < 0) {
+    return reject("input not found");
+  }
+  if (header->file_size != file_size || header->mtime != mtime) {
+    return reject("input changed");
+  }
+
+  // Walk the records once so every later read is known to stay inside the mapping.
+  int64_t offset = sizeof(FileHeader);
+  if (header->path_size > size - offset) {
+    return reject("truncated path");
+  }
+  string path(reinterpret_cast<const char*>(data + offset), header->path_size);
+  if (path != GetAbsolutePath(av_path)) {
+    return reject("written for another path");
+  }
+  offset += AlignUp(header->path_size);
+
+  stream_offset_ = offset;
+  for (uint32_t i = 0; i < header->stream_num; i++) {
+    if (size - offset < static_cast<int64_t>(sizeof(StreamRecord))) {
+      return reject("truncated stream record");
+    }
+    const auto* record = reinterpret_cast<const StreamRecord*>(data + offset);
+    offset += sizeof(StreamRecord);
+    if (record->extradata_size > size - offset) {
+      return reject("truncated extradata");
+    }
+    offset += AlignUp(record->extradata_size);
+  }
+
+  keyframe_offset_ = offset;
+  packet_offset_ = keyframe_offset_ + header->keyframe_num * sizeof(KeyframeRecord);
+  uint64_t table_size = header->keyframe_num * sizeof(KeyframeRecord) +
+                        header->packet_num * sizeof(PacketRecord);
+  if (offset > size || header->keyframe_num > static_cast<uint64_t>(size) ||
+      header->packet_num > static_cast<uint64_t>(size) ||
+      table_size > static_cast<uint64_t>(size - offset)) {
+    return reject("truncated index tables");
+  }
+  return 0;
+}
+
+int IndexCache::Apply(AVFormatContext* av_ctx) const {
+  const auto* header = GetHeader();
+  if (header == nullptr) {
+    return AVERROR(EINVAL);
+  }
+  // Demuxers that only find their streams while probing, MPEG-TS for one, cannot use the cache.
+  if (av_ctx->nb_streams != header->stream_num) {
+    spdlog::info("index cache has {} streams, demuxer found {}", header->stream_num,
+                 av_ctx->nb_streams);
+    return AVERROR_INVALIDDATA;
+  }
+  const uint8_t* data = mapped_file_.GetData();
+  int64_t offset = stream_offset_;
+  for (uint32_t i = 0; i < header->stream_num; i++) {
+    const auto* record = reinterpret_cast<const StreamRecord*>(data + offset);
+    const auto* codecpar = av_ctx->streams[i]->codecpar;
+    if (record->codec_type != codecpar->codec_type ||
+        (codecpar->codec_id != AV_CODEC_ID_NONE && record->codec_id != codecpar->codec_id)) {
+      spdlog::info("index cache stream {} is codec {}, demuxer found {}", i, record->codec_id,
+                   codecpar->codec_id);
+      return AVERROR_INVALIDDATA;
+    }
+    offset += sizeof(StreamRecord) + AlignUp(record->extradata_size);
+  }
+
+  offset = stream_offset_;
+  for (uint32_t i = 0; i < header->stream_num; i++) {
+    const auto* record = reinterpret_cast<const StreamRecord*>(data + offset);
+    offset += sizeof(StreamRecord);
+    auto* stream = av_ctx->streams[i];
+    auto* codecpar = stream->codecpar;
+
+    uint8_t* extradata = nullptr;
+    if (record->extradata_size > 0) {
+      extradata = static_cast<uint8_t*>(
+          av_mallocz(record->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE));
+      if (extradata == nullptr) {
+        return AVERROR(ENOMEM);
+      }
+      memcpy(extradata, data + offset, record->extradata_size);
+      offset += AlignUp(record->extradata_size);
+    }
+    av_freep(&codecpar->extradata);
+    codecpar->extradata = extradata;
+    codecpar->extradata_size = static_cast<int>(record->extradata_size);
+
+    codecpar->codec_id = static_cast<AVCodecID>(record->codec_id);
+    codecpar->codec_tag = record->codec_tag;
+    codecpar->format = record->format;
+    codecpar->bit_rate = record->bit_rate;
+    codecpar->bits_per_coded_sample = record->bits_per_coded_sample;
+    codecpar->bits_per_raw_sample = record->bits_per_raw_sample;
+    codecpar->profile = record->profile;
+    codecpar->level = record->level;
+    codecpar->width = record->width;
+    codecpar->height = record->height;
+    codecpar->sample_aspect_ratio =
+        AVRational{record->sample_aspect_ratio_num, record->sample_aspect_ratio_den};
+    codecpar->field_order = static_cast<AVFieldOrder>(record->field_order);
+    codecpar->color_range = static_cast<AVColorRange>(record->color_range);
+    codecpar->color_primaries = static_cast<AVColorPrimaries>(record->color_primaries);
+    codecpar->color_trc = static_cast<AVColorTransferCharacteristic>(record->color_trc);
+    codecpar->color_space = static_cast<AVColorSpace>(record->color_space);
+    codecpar->chroma_location = static_cast<AVChromaLocation>(record->chroma_location);
+    codecpar->video_delay = record->video_delay;
+    codecpar->channels = record->channels;
+    codecpar->channel_layout = record->channel_layout;
+    codecpar->sample_rate = record->sample_rate;
+    codecpar->block_align = record->block_align;
+    codecpar->frame_size = record->frame_size;
+    codecpar->initial_padding = record->initial_padding;
+    codecpar->trailing_padding = record->trailing_padding;
+    codecpar->seek_preroll = record->seek_preroll;
+    stream->time_base = AVRational{record->time_base_num, record->time_base_den};
+    stream->start_time = record->start_time;
+    stream->duration = record->duration;
+    stream->nb_frames = record->nb_frames;
+    stream->avg_frame_rate = AVRational{record->avg_frame_rate_num, record->avg_frame_rate_den};
+    stream->r_frame_rate = AVRational{record->r_frame_rate_num, record->r_frame_rate_den};
+    stream->disposition = record->disposition;
+  }
+  av_ctx->start_time = header->start_time;
+  av_ctx->duration = header->duration;
+  av_ctx->bit_rate = header->bit_rate;
+  return 0;
+}
+
+void IndexCache::LoadKeyframeIndex(KeyframeIndex* keyframe_index) const {
+  const auto* header = GetHeader();
+  if (header == nullptr) {
+    return;
+  }
+  const uint8_t* data = mapped_file_.GetData();
+  vector<KeyframeEntry> entries(header->keyframe_num);
+  for (uint64_t i = 0; i < header->keyframe_num; i++) {
+    KeyframeRecord record;
+    memcpy(&record, data + keyframe_offset_ + i * sizeof(record), sizeof(record));
+    entries[i].pts = record.pts;
+    entries[i].pos = record.pos;
+  }
+  vector<PacketEntry> packets(header->packet_num);
+  for (uint64_t i = 0; i < header->packet_num; i++) {
+    PacketRecord record;
+    memcpy(&record, data + packet_offset_ + i * sizeof(record), sizeof(record));
+    packets[i].pts = record.pts;
+    packets[i].pos = record.pos;
+    packets[i].is_key = record.is_key != 0;
+  }
+  keyframe_index->Load(static_cast<KeyframeIndexSource>(header->index_source), move(entries),
+                       move(packets));
+}
+
+int IndexCache::GetVideoStreamIndex() const {
+  const auto* header = GetHeader();
+  return header == nullptr ? -1 : header->video_stream_index;
+}
+
+const IndexCache::FileHeader* IndexCache::GetHeader() const {
+  if (mapped_file_.GetData() == nullptr) {
+    return nullptr;
+  }
+  return reinterpret_cast<const FileHeader*>(mapped_file_.GetData());
+}
+
+}  // namespace ryoma
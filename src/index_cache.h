@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "keyframe_index.h"
+#include "mapped_file.h"
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// Sidecar file with what avformat_find_stream_info and the keyframe scan found for one input,
+// so reopening it neither probes nor scans. The file is memory-mapped and read in place; it is
+// only used while the input keeps the path, size and modification time it was written for.
+//
+// Layout, native byte order, every record 8-byte aligned:
+//   FileHeader
+//   input path, padded
+//   FileHeader::stream_num x (StreamRecord, extradata padded)
+//   FileHeader::keyframe_num x KeyframeRecord
+//   FileHeader::packet_num x PacketRecord
+class IndexCache {
+ public:
+  // 2: kStream indexes are only written once they cover the whole stream.
+  static constexpr uint32_t kVersion = 2;
+
+ public:
+  // Writes to a temporary file first, a crash never leaves a truncated cache behind.
+  static int Save(const string& cache_path, const string& av_path, AVFormatContext* av_ctx,
+                  int video_stream_index, const KeyframeIndex& keyframe_index);
+
+  // Fails with AVERROR_INVALIDDATA when the cache is damaged, of another version or written
+  // for another file, or for this file before it changed.
+  int Load(const string& cache_path, const string& av_path);
+  // Fills the stream parameters of av_ctx, an AVFormatContext freshly opened on the same input,
+  // in place of avformat_find_stream_info. Nothing is changed when the demuxer disagrees with
+  // the cache on the streams.
+  int Apply(AVFormatContext* av_ctx) const;
+  void LoadKeyframeIndex(KeyframeIndex* keyframe_index) const;
+
+  int GetVideoStreamIndex() const;
+
+ private:
+  struct FileHeader;
+  struct StreamRecord;
+
+  const FileHeader* GetHeader() const;
+
+ private:
+  MappedFile mapped_file_;
+  // Offsets into the mapping, found while validating it.
+  int64_t stream_offset_ = 0;
+  int64_t keyframe_offset_ = 0;
+  int64_t packet_offset_ = 0;
+};
+
+}  // namespace ryoma
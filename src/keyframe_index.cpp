@@ -0,0 +1,174 @@
+#include "keyframe_index.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "packet_pool.h"
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+namespace {
+
+// The index moved behind accessors in libavformat 58.78.
+int GetIndexEntryNum(AVStream* stream) {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+  return avformat_index_get_entries_count(stream);
+#else
+  return stream->nb_index_entries;
+#endif
+}
+
+const AVIndexEntry* GetIndexEntry(AVStream* stream, int index) {
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+  return avformat_index_get_entry(stream, index);
+#else
+  return &stream->index_entries[index];
+#endif
+}
+
+// How far before the end of the stream the last index entry may be and still count as
+// covering it: the last GOP of a long file, a tenth of a short one.
+constexpr int64_t kMaxIndexTailSec = 10;
+
+bool ComparePts(const KeyframeEntry& a, const KeyframeEntry& b) { return a.pts < b.pts; }
+
+bool ComparePacketPts(const PacketEntry& a, const PacketEntry& b) { return a.pts < b.pts; }
+
+}  // namespace
+
+int KeyframeIndex::BuildFromStream(AVStream* stream, int64_t duration) {
+  entries_.clear();
+  packets_.clear();
+  source_ = KeyframeIndexSource::kNone;
+  int entry_num = GetIndexEntryNum(stream);
+  for (int i = 0; i < entry_num; i++) {
+    const auto* entry = GetIndexEntry(stream, i);
+    PacketEntry packet;
+    packet.pts = entry->timestamp;
+    packet.pos = entry->pos;
+    packet.is_key = entry->flags & AVINDEX_KEYFRAME;
+    packets_.push_back(packet);
+    if (packet.is_key) {
+      KeyframeEntry keyframe;
+      keyframe.pts = entry->timestamp;
+      keyframe.pos = entry->pos;
+      entries_.push_back(keyframe);
+    }
+  }
+  sort(entries_.begin(), entries_.end(), ComparePts);
+  sort(packets_.begin(), packets_.end(), ComparePacketPts);
+  if (entries_.empty()) {
+    return AVERROR(ENOENT);
+  }
+
+  // Demuxers add entries as they parse them: Matroska only loads its cues on the first seek, and
+  // the generic index of raw streams grows with every packet read. A partial index would send
+  // every seek past its end back to the last keyframe seen so far.
+  int64_t start_pts = stream->start_time == AV_NOPTS_VALUE ? 0 : stream->start_time;
+  int64_t max_tail = min(av_rescale_q(kMaxIndexTailSec, AVRational{1, 1}, stream->time_base),
+                         duration / 10);
+  if (duration == AV_NOPTS_VALUE || duration <= 0 ||
+      packets_.back().pts < start_pts + duration - max_tail) {
+    entries_.clear();
+    packets_.clear();
+    return AVERROR(EAGAIN);
+  }
+  source_ = KeyframeIndexSource::kStream;
+  return 0;
+}
+
+int KeyframeIndex::BuildFromScan(const string& av_path, int stream_index) {
+  entries_.clear();
+  packets_.clear();
+  source_ = KeyframeIndexSource::kNone;
+
+  AVFormatContext* av_ctx_ptr = nullptr;
+  int ret = avformat_open_input(&av_ctx_ptr, av_path.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    spdlog::error("avformat open {} failed, ret {}", av_path, ret);
+    return ret;
+  }
+  shared_ptr<AVFormatContext> av_ctx(av_ctx_ptr,
+                                     [](AVFormatContext*& ptr) { avformat_close_input(&ptr); });
+  if (stream_index < 0 || stream_index >= static_cast<int>(av_ctx->nb_streams)) {
+    return AVERROR(EINVAL);
+  }
+  for (unsigned int i = 0; i < av_ctx->nb_streams; i++) {
+    if (static_cast<int>(i) != stream_index) {
+      av_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  // Only packet headers are needed here, nothing is decoded.
+  PacketPool packet_pool;
+  while (true) {
+    auto av_packet = packet_pool.Acquire();
+    if (av_read_frame(av_ctx.get(), av_packet.get()) < 0) {
+      break;
+    }
+    if (av_packet->stream_index != stream_index) {
+      continue;
+    }
+    PacketEntry packet;
+    packet.pts = av_packet->pts != AV_NOPTS_VALUE ? av_packet->pts : av_packet->dts;
+    packet.pos = av_packet->pos;
+    packet.is_key = av_packet->flags & AV_PKT_FLAG_KEY;
+    if (packet.pts == AV_NOPTS_VALUE) {
+      continue;
+    }
+    packets_.push_back(packet);
+    if (packet.is_key) {
+      KeyframeEntry keyframe;
+      keyframe.pts = packet.pts;
+      keyframe.pos = packet.pos;
+      entries_.push_back(keyframe);
+    }
+  }
+  sort(entries_.begin(), entries_.end(), ComparePts);
+  sort(packets_.begin(), packets_.end(), ComparePacketPts);
+  if (entries_.empty()) {
+    return AVERROR(ENOENT);
+  }
+  source_ = KeyframeIndexSource::kScan;
+  return 0;
+}
+
+void KeyframeIndex::Load(KeyframeIndexSource source, vector<KeyframeEntry> entries,
+                         vector<PacketEntry> packets) {
+  entries_ = move(entries);
+  packets_ = move(packets);
+  sort(entries_.begin(), entries_.end(), ComparePts);
+  sort(packets_.begin(), packets_.end(), ComparePacketPts);
+  source_ = entries_.empty() ? KeyframeIndexSource::kNone : source;
+}
+
+const KeyframeEntry* KeyframeIndex::FindBefore(int64_t pts) const {
+  auto it = upper_bound(entries_.begin(), entries_.end(), pts,
+                        [](int64_t pts, const KeyframeEntry& entry) { return pts < entry.pts; });
+  if (it == entries_.begin()) {
+    return nullptr;
+  }
+  return &*prev(it);
+}
+
+const PacketEntry* KeyframeIndex::FindPacket(int64_t pts) const {
+  auto it = lower_bound(packets_.begin(), packets_.end(), pts,
+                        [](const PacketEntry& packet, int64_t pts) { return packet.pts < pts; });
+  if (it == packets_.end() || it->pts != pts) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+bool KeyframeIndex::IsEmpty() const { return entries_.empty(); }
+
+size_t KeyframeIndex::GetSize() const { return entries_.size(); }
+
+KeyframeIndexSource KeyframeIndex::GetSource() const { return source_; }
+
+const vector<KeyframeEntry>& KeyframeIndex::GetEntries() const { return entries_; }
+
+const vector<PacketEntry>& KeyframeIndex::GetPackets() const { return packets_; }
+
+}  // namespace ryoma
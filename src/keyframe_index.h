@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct KeyframeEntry {
+  int64_t pts = AV_NOPTS_VALUE;  // stream time base
+  int64_t pos = -1;              // byte offset of the packet, -1 when unknown
+};
+
+// One packet of the indexed stream, for pts to byte offset lookups.
+struct PacketEntry {
+  int64_t pts = AV_NOPTS_VALUE;
+  int64_t pos = -1;
+  bool is_key = false;
+};
+
+enum class KeyframeIndexSource {
+  kNone,
+  kStream,  // the demuxer's own index: MKV cues, MP4 sample tables...
+  kScan,    // one pass over the packet headers, for containers without an index
+};
+
+// Sorted keyframe positions of one stream, so a seek goes straight to the keyframe before the
+// target instead of relying on the demuxer to search for it.
+class KeyframeIndex {
+ public:
+  // duration is in the stream time base. Fails with AVERROR(EAGAIN) when the demuxer's index
+  // stops short of it, which it does until it has loaded its index or read the whole file.
+  int BuildFromStream(AVStream* stream, int64_t duration);
+  // Opens av_path separately, the caller's demux position is left alone.
+  int BuildFromScan(const string& av_path, int stream_index);
+  // Takes tables built earlier, e.g. by an IndexCache; source is what originally built them.
+  void Load(KeyframeIndexSource source, vector<KeyframeEntry> entries,
+            vector<PacketEntry> packets);
+
+  // The last keyframe at or before pts, nullptr when pts is before the first one.
+  const KeyframeEntry* FindBefore(int64_t pts) const;
+  // The packet presented at pts, nullptr when the packet table does not have it.
+  const PacketEntry* FindPacket(int64_t pts) const;
+
+  bool IsEmpty() const;
+  size_t GetSize() const;
+  KeyframeIndexSource GetSource() const;
+  const vector<KeyframeEntry>& GetEntries() const;
+  // Every packet of the stream sorted by pts, may be empty when only keyframes are known.
+  const vector<PacketEntry>& GetPackets() const;
+
+ private:
+  vector<KeyframeEntry> entries_;
+  vector<PacketEntry> packets_;
+  KeyframeIndexSource source_ = KeyframeIndexSource::kNone;
+};
+
+}  // namespace ryoma
@@ -1,15 +1,64 @@
+#include <cstdlib>
+#include <memory>
 #include <string>
 
+#include "batch_processor.h"
 #include "ffmpeg_decoder.h"
+#include "frame_sink_runner.h"
 #include "sdl_player.h"
 #include "spdlog/spdlog.h"
 
 using namespace std;
 
-int main() {
+namespace {
+
+// null, checksum or raw:<prefix>, the last writes <prefix>.yuv and <prefix>.pcm.
+shared_ptr<ryoma::FrameSink> CreateSink(const string& name) {
+  if (name == "null") {
+    return make_shared<ryoma::NullSink>();
+  }
+  if (name == "checksum") {
+    return make_shared<ryoma::ChecksumSink>();
+  }
+  if (name.rfind("raw:", 0) == 0) {
+    string prefix = name.substr(4);
+    return make_shared<ryoma::RawFileSink>(prefix + ".yuv", prefix + ".pcm");
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+// learn-ffmpeg [av_path]                          plays with SDL
+// learn-ffmpeg --headless <sink> [av_path]        decodes into a FrameSink, no window or pacing
+// learn-ffmpeg --batch <manifest> [worker_num]    runs the jobs of BatchProcessor::LoadManifest
+int main(int argc, char* argv[]) {
   ios_base::sync_with_stdio(false);
 
+  if (argc > 2 && string(argv[1]) == "--batch") {
+    vector<ryoma::BatchJob> jobs;
+    if (ryoma::BatchProcessor::LoadManifest(argv[2], jobs) < 0) {
+      return 1;
+    }
+    ryoma::BatchOptions options;
+    if (argc > 3) {
+      options.worker_num = atoi(argv[3]);
+    }
+    ryoma::BatchProcessor batch_processor(options);
+    return batch_processor.Run(move(jobs)) < 0 ? 1 : 0;
+  }
+
   string av_path = "../static/demo.mkv";
+  string sink_name;
+  int arg_index = 1;
+  if (arg_index + 1 < argc && string(argv[arg_index]) == "--headless") {
+    sink_name = argv[arg_index + 1];
+    arg_index += 2;
+  }
+  if (arg_index < argc) {
+    av_path = argv[arg_index];
+  }
+
   ryoma::FFmpegDecoder ffmpeg_decoder(av_path);
   int ret = ffmpeg_decoder.Init();
   if (ret != 0) {
@@ -17,7 +66,7 @@ int main() {
     return ret;
   }
   // string yuv_path = "../static/demo_1280x720.yuv";
-  // ffmpeg_decoder.ExportYuv420(yuv_path);
+  // ffmpeg_decoder.ExportYuv420(yuv_path, thread::hardware_concurrency());
 
   // ffmpeg_decoder.DecimatedFrame("../static");
 
@@ -27,6 +76,21 @@ int main() {
   // string audio_path = "../static/dem/*o.aac";
   // ffmpeg_decoder.SaveAudioStream(audio_path);
 
+  // Both in one pass over the input.
+  // ffmpeg_decoder.SaveStreams({{video_path, {ffmpeg_decoder.GetVideoStream()->index}},
+  //                             {audio_path, {ffmpeg_decoder.GetAudioStream()->index}}});
+
+  if (!sink_name.empty()) {
+    auto sink = CreateSink(sink_name);
+    if (sink == nullptr) {
+      spdlog::error("unknown sink {}, expected null, checksum or raw:<prefix>", sink_name);
+      return 1;
+    }
+    ryoma::FrameSinkRunner runner(&ffmpeg_decoder);
+    runner.AddSink(sink);
+    return runner.Run() < 0 ? 1 : 0;
+  }
+
   ryoma::SdlPlayer player;
   player.Init("Simple video player", &ffmpeg_decoder);
   player.Play();
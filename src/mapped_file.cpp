@@ -0,0 +1,154 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+
+#include "spdlog/spdlog.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/error.h"
+}
+
+namespace ryoma {
+
+MappedFile::~MappedFile() { Close(); }
+
+#ifdef _WIN32
+
+int MappedFile::Open(const string& path) {
+  Close();
+  HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    spdlog::error("CreateFileA {} failed, error {}", path, GetLastError());
+    return AVERROR(EIO);
+  }
+  file_handle_ = file_handle;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_handle, &size)) {
+    spdlog::error("GetFileSizeEx {} failed, error {}", path, GetLastError());
+    Close();
+    return AVERROR(EIO);
+  }
+  size_ = size.QuadPart;
+  if (size_ == 0) {
+    // An empty file cannot be mapped, there is nothing to read anyway.
+    return 0;
+  }
+  HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_handle == nullptr) {
+    spdlog::error("CreateFileMappingA {} failed, error {}", path, GetLastError());
+    Close();
+    return AVERROR(EIO);
+  }
+  mapping_handle_ = mapping_handle;
+  data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+  if (data_ == nullptr) {
+    spdlog::error("MapViewOfFile {} failed, error {}", path, GetLastError());
+    Close();
+    return AVERROR(EIO);
+  }
+  return 0;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_handle_ != nullptr) {
+    CloseHandle(mapping_handle_);
+    mapping_handle_ = nullptr;
+  }
+  if (file_handle_ != nullptr) {
+    CloseHandle(file_handle_);
+    file_handle_ = nullptr;
+  }
+  size_ = 0;
+}
+
+void MappedFile::Advise(AccessHint hint) {}
+
+bool MappedFile::IsOpen() const { return file_handle_ != nullptr; }
+
+#else
+
+int MappedFile::Open(const string& path) {
+  Close();
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    int err = errno;
+    // A missing file is an ordinary outcome for callers probing for a cache.
+    if (err != ENOENT) {
+      spdlog::error("open {} failed, errno {}", path, err);
+    }
+    return AVERROR(err);
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) < 0) {
+    int err = errno;
+    spdlog::error("fstat {} failed, errno {}", path, err);
+    Close();
+    return AVERROR(err);
+  }
+  size_ = file_stat.st_size;
+  if (size_ == 0) {
+    // An empty file cannot be mapped, there is nothing to read anyway.
+    return 0;
+  }
+  void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED) {
+    int err = errno;
+    spdlog::error("mmap {} failed, errno {}", path, err);
+    Close();
+    return AVERROR(err);
+  }
+  data_ = static_cast<const uint8_t*>(data);
+  return 0;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+    data_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+
+void MappedFile::Advise(AccessHint hint) {
+  if (data_ == nullptr) {
+    return;
+  }
+  int advice = MADV_NORMAL;
+  if (hint == AccessHint::kSequential) {
+    advice = MADV_SEQUENTIAL;
+  } else if (hint == AccessHint::kRandom) {
+    advice = MADV_RANDOM;
+  }
+  if (madvise(const_cast<uint8_t*>(data_), size_, advice) < 0) {
+    spdlog::warn("madvise {} failed, errno {}", static_cast<int>(hint), errno);
+  }
+}
+
+bool MappedFile::IsOpen() const { return fd_ >= 0; }
+
+#endif
+
+const uint8_t* MappedFile::GetData() const { return data_; }
+
+int64_t MappedFile::GetSize() const { return size_; }
+
+}  // namespace ryoma
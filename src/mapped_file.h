@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+namespace ryoma {
+
+// How the mapping is about to be read, for the kernel's readahead.
+enum class AccessHint {
+  kNormal,
+  kSequential,  // read ahead aggressively, drop pages behind the reader early
+  kRandom,      // no readahead, every fault loads only its own page
+};
+
+// Read-only memory map of a whole file. The pages are loaded on first touch, so opening is
+// cheap however large the file is.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  int Open(const string& path);
+  void Close();
+  // A hint only, ignored where the platform has no equivalent.
+  void Advise(AccessHint hint);
+
+  const uint8_t* GetData() const;
+  int64_t GetSize() const;
+  bool IsOpen() const;
+
+ private:
+  const uint8_t* data_ = nullptr;
+  int64_t size_ = 0;
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+}  // namespace ryoma
@@ -0,0 +1,76 @@
+#include "packet_pool.h"
+
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+void PacketPool::Releaser::operator()(AVPacket* packet) const {
+  if (pool == nullptr) {
+    av_packet_free(&packet);
+    return;
+  }
+  pool->Release(packet);
+}
+
+PacketPool::PacketPool(size_t max_free_packet_num) : max_free_packet_num_(max_free_packet_num) {
+  free_packets_.reserve(max_free_packet_num_);
+}
+
+PacketPool::~PacketPool() {
+  for (auto* packet : free_packets_) {
+    av_packet_free(&packet);
+  }
+}
+
+PacketPtr PacketPool::Acquire() {
+  AVPacket* packet = nullptr;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (!free_packets_.empty()) {
+      packet = free_packets_.back();
+      free_packets_.pop_back();
+    }
+  }
+  if (packet != nullptr) {
+    reused_packet_num_++;
+  } else {
+    packet = av_packet_alloc();
+    allocated_packet_num_++;
+  }
+  return PacketPtr(packet, Releaser{this});
+}
+
+int PacketPool::MakeRefcounted(AVPacket* packet) {
+  if (packet->buf != nullptr || packet->size <= 0) {
+    return 0;
+  }
+  int ret = av_packet_make_refcounted(packet);
+  if (ret < 0) {
+    spdlog::error("av_packet_make_refcounted failed, size {}, ret {}", packet->size, ret);
+    return ret;
+  }
+  copied_payload_num_++;
+  return 0;
+}
+
+PacketPoolStats PacketPool::GetStats() const {
+  PacketPoolStats stats;
+  stats.allocated_packet_num = allocated_packet_num_;
+  stats.reused_packet_num = reused_packet_num_;
+  stats.copied_payload_num = copied_payload_num_;
+  return stats;
+}
+
+void PacketPool::Release(AVPacket* packet) {
+  av_packet_unref(packet);
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (free_packets_.size() < max_free_packet_num_) {
+      free_packets_.push_back(packet);
+      return;
+    }
+  }
+  av_packet_free(&packet);
+}
+
+}  // namespace ryoma
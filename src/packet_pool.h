@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct PacketPoolStats {
+  uint64_t allocated_packet_num = 0;
+  uint64_t reused_packet_num = 0;
+  uint64_t copied_payload_num = 0;
+};
+
+// Recycles AVPacket shells. A PacketPtr unreferences its payload and goes back to the pool when
+// it is destroyed, so a loop around av_read_frame never leaks and stops allocating packets once
+// it reaches steady state. Payloads are left to the demuxer, which hands out refcounted buffers
+// from av_read_frame. The pool must outlive every packet it handed out.
+class PacketPool {
+ public:
+  struct Releaser {
+    PacketPool* pool = nullptr;
+    void operator()(AVPacket* packet) const;
+  };
+  using PacketPtr = unique_ptr<AVPacket, Releaser>;
+
+  static constexpr size_t kMaxFreePacketNum = 1024;
+
+ public:
+  explicit PacketPool(size_t max_free_packet_num = kMaxFreePacketNum);
+  ~PacketPool();
+
+  PacketPool(const PacketPool&) = delete;
+  PacketPool& operator=(const PacketPool&) = delete;
+
+  PacketPtr Acquire();
+
+  // Packets that borrow memory (buf == nullptr), e.g. filled by hand rather than by
+  // av_read_frame, get their payload copied so they can be queued.
+  int MakeRefcounted(AVPacket* packet);
+
+  PacketPoolStats GetStats() const;
+
+ private:
+  void Release(AVPacket* packet);
+
+ private:
+  const size_t max_free_packet_num_;
+
+  mutable mutex mutex_;
+  vector<AVPacket*> free_packets_;
+
+  atomic<uint64_t> allocated_packet_num_{0};
+  atomic<uint64_t> reused_packet_num_{0};
+  atomic<uint64_t> copied_payload_num_{0};
+};
+
+using PacketPtr = PacketPool::PacketPtr;
+
+}  // namespace ryoma
@@ -0,0 +1,261 @@
+#include "parallel_yuv_exporter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "frame_decoder.h"
+#include "packet_pool.h"
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+ParallelYuvExporter::ParallelYuvExporter(const string& av_path, int worker_num,
+                                         RawVideoLayout layout, int decoder_thread_num)
+    : av_path_(av_path),
+      worker_num_(max(worker_num, 1)),
+      layout_(layout),
+      decoder_thread_num_(decoder_thread_num) {}
+
+int ParallelYuvExporter::Export(const string& target_path) {
+  int ret = ScanVideoStream();
+  if (ret < 0) {
+    spdlog::error("ScanVideoStream failed, ret {}", ret);
+    return ret;
+  }
+  PlanSegments();
+
+  RawFile raw_file;
+  ret = raw_file.Open(target_path, static_cast<int64_t>(frame_size_) * frame_pts_.size());
+  if (ret < 0) {
+    spdlog::error("RawFile::Open {} failed, ret {}", target_path, ret);
+    return ret;
+  }
+
+  vector<size_t> exported_frame_nums(segments_.size(), 0);
+  vector<int> results(segments_.size(), 0);
+  vector<thread> workers;
+  for (size_t i = 0; i < segments_.size(); i++) {
+    workers.emplace_back([&, i] {
+      results[i] = ExportSegment(segments_[i], &raw_file, &exported_frame_nums[i]);
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  raw_file.Close();
+
+  exported_frame_num_ = 0;
+  for (size_t i = 0; i < segments_.size(); i++) {
+    exported_frame_num_ += exported_frame_nums[i];
+    if (results[i] < 0) {
+      spdlog::error("segment {} failed, ret {}", i, results[i]);
+      return results[i];
+    }
+  }
+  if (exported_frame_num_ != frame_pts_.size()) {
+    spdlog::warn("exported {} of {} frames, missing slots are left blank", exported_frame_num_,
+                 frame_pts_.size());
+  }
+  return 0;
+}
+
+size_t ParallelYuvExporter::GetExportedFrameNum() const { return exported_frame_num_; }
+
+int ParallelYuvExporter::ScanVideoStream() {
+  shared_ptr<AVFormatContext> av_ctx;
+  int stream_index = -1;
+  int ret = OpenInput(av_ctx, stream_index);
+  if (ret < 0) {
+    return ret;
+  }
+  const auto* codecpar = av_ctx->streams[stream_index]->codecpar;
+  width_ = codecpar->width;
+  height_ = codecpar->height;
+  pixel_format_ = static_cast<AVPixelFormat>(codecpar->format);
+  frame_size_ = RawVideoWriter::GetFrameSize(pixel_format_, width_, height_);
+  if (frame_size_ <= 0) {
+    spdlog::error("unsupported video format {}x{} {}", width_, height_, codecpar->format);
+    return AVERROR(EINVAL);
+  }
+
+  // Only packet headers are needed here, nothing is decoded.
+  frame_pts_.clear();
+  keyframe_pts_.clear();
+  PacketPool packet_pool;
+  while (true) {
+    auto av_packet = packet_pool.Acquire();
+    if (av_read_frame(av_ctx.get(), av_packet.get()) < 0) {
+      break;
+    }
+    if (av_packet->stream_index != stream_index) {
+      continue;
+    }
+    if (av_packet->pts == AV_NOPTS_VALUE) {
+      spdlog::error("video packet without pts, cannot place frames");
+      return AVERROR(EINVAL);
+    }
+    frame_pts_.push_back(av_packet->pts);
+    if (av_packet->flags & AV_PKT_FLAG_KEY) {
+      keyframe_pts_.push_back(av_packet->pts);
+    }
+  }
+  sort(frame_pts_.begin(), frame_pts_.end());
+  sort(keyframe_pts_.begin(), keyframe_pts_.end());
+  if (frame_pts_.empty()) {
+    spdlog::error("no video packets in {}", av_path_);
+    return AVERROR(EINVAL);
+  }
+  return 0;
+}
+
+void ParallelYuvExporter::PlanSegments() {
+  size_t frame_num = frame_pts_.size();
+  size_t target_frame_num = (frame_num + worker_num_ - 1) / worker_num_;
+
+  segments_.clear();
+  Segment segment;
+  segment.start_pts = INT64_MIN;
+  for (auto keyframe_pts : keyframe_pts_) {
+    size_t rank = lower_bound(frame_pts_.begin(), frame_pts_.end(), keyframe_pts) -
+                  frame_pts_.begin();
+    if (rank - segment.first_frame < target_frame_num ||
+        segments_.size() + 1 >= static_cast<size_t>(worker_num_)) {
+      continue;
+    }
+    segment.end_pts = keyframe_pts;
+    segment.frame_num = rank - segment.first_frame;
+    segments_.push_back(segment);
+
+    segment = Segment();
+    segment.start_pts = keyframe_pts;
+    segment.first_frame = rank;
+  }
+  segment.end_pts = INT64_MAX;
+  segment.frame_num = frame_num - segment.first_frame;
+  segments_.push_back(segment);
+
+  spdlog::info("{} frames, {} keyframes, {} segments", frame_num, keyframe_pts_.size(),
+               segments_.size());
+}
+
+int ParallelYuvExporter::ExportSegment(const Segment& segment, RawFile* raw_file,
+                                       size_t* exported_frame_num) {
+  shared_ptr<AVFormatContext> av_ctx;
+  int stream_index = -1;
+  int ret = OpenInput(av_ctx, stream_index);
+  if (ret < 0) {
+    return ret;
+  }
+  auto* stream = av_ctx->streams[stream_index];
+  auto* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (codec == nullptr) {
+    spdlog::error("not found video codec, codec_id {}", stream->codecpar->codec_id);
+    return -1;
+  }
+  shared_ptr<AVCodecContext> codec_ctx(avcodec_alloc_context3(codec),
+                                       [](AVCodecContext*& ptr) { avcodec_free_context(&ptr); });
+  ret = avcodec_parameters_to_context(codec_ctx.get(), stream->codecpar);
+  if (ret < 0) {
+    spdlog::error("avcodec_parameters_to_context failed, ret {}", ret);
+    return ret;
+  }
+  // The segments run side by side; split the file's thread budget between the workers.
+  int thread_num = decoder_thread_num_ > 0 ? decoder_thread_num_
+                                           : static_cast<int>(std::thread::hardware_concurrency());
+  codec_ctx->thread_count = max(1, thread_num / worker_num_);
+  ret = avcodec_open2(codec_ctx.get(), codec, nullptr);
+  if (ret < 0) {
+    spdlog::error("avcodec_open2 failed, ret {}", ret);
+    return ret;
+  }
+
+  if (segment.start_pts != INT64_MIN) {
+    ret = avformat_seek_file(av_ctx.get(), stream_index, INT64_MIN, segment.start_pts,
+                             segment.start_pts, 0);
+    if (ret < 0) {
+      spdlog::error("avformat_seek_file {} failed, ret {}", segment.start_pts, ret);
+      return ret;
+    }
+  }
+
+  // Frames of one segment are contiguous in the file, so the writer batches them.
+  RawVideoWriter raw_video_writer(layout_);
+  raw_video_writer.Open(raw_file);
+  bool is_done = false;
+  int write_ret = 0;
+  auto write_frame = [&](AVFrame* frame) {
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts < segment.start_pts) {
+      // Leading frames of an open GOP belong to the previous segment.
+      return 0;
+    }
+    if (pts >= segment.end_pts) {
+      is_done = true;
+      return AVERROR_EXIT;
+    }
+    auto it = lower_bound(frame_pts_.begin(), frame_pts_.end(), pts);
+    if (it == frame_pts_.end() || *it != pts) {
+      spdlog::warn("frame pts {} has no slot", pts);
+      return 0;
+    }
+    if (frame->width != width_ || frame->height != height_ || frame->format != pixel_format_) {
+      spdlog::error("frame format changed to {}x{} {}", frame->width, frame->height,
+                    frame->format);
+      write_ret = AVERROR(EINVAL);
+      return write_ret;
+    }
+    int64_t offset = static_cast<int64_t>(it - frame_pts_.begin()) * frame_size_;
+    write_ret = raw_video_writer.WriteFrame(frame, offset);
+    if (write_ret < 0) {
+      return write_ret;
+    }
+    (*exported_frame_num)++;
+    return 0;
+  };
+
+  FrameDecoder frame_decoder(codec_ctx.get());
+  PacketPool packet_pool;
+  while (!is_done && write_ret == 0) {
+    auto av_packet = packet_pool.Acquire();
+    if (av_read_frame(av_ctx.get(), av_packet.get()) < 0) {
+      break;
+    }
+    if (av_packet->stream_index == stream_index) {
+      frame_decoder.Decode(av_packet.get(), write_frame);
+    }
+  }
+  if (!is_done && write_ret == 0) {
+    frame_decoder.Flush(write_frame);
+  }
+  int ret_close = raw_video_writer.Close();
+  return write_ret < 0 ? write_ret : ret_close;
+}
+
+int ParallelYuvExporter::OpenInput(shared_ptr<AVFormatContext>& av_ctx, int& stream_index) const {
+  AVFormatContext* av_ctx_ptr = nullptr;
+  int ret = avformat_open_input(&av_ctx_ptr, av_path_.c_str(), nullptr, nullptr);
+  if (ret < 0) {
+    spdlog::error("avformat open {} failed, ret {}", av_path_, ret);
+    return ret;
+  }
+  av_ctx.reset(av_ctx_ptr, [](AVFormatContext*& ptr) { avformat_close_input(&ptr); });
+  ret = avformat_find_stream_info(av_ctx.get(), nullptr);
+  if (ret < 0) {
+    spdlog::error("avformat_find_stream_info failed, ret {}", ret);
+    return ret;
+  }
+  stream_index = av_find_best_stream(av_ctx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (stream_index < 0) {
+    spdlog::error("not found video stream");
+    return stream_index;
+  }
+  for (unsigned int i = 0; i < av_ctx->nb_streams; i++) {
+    if (static_cast<int>(i) != stream_index) {
+      av_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+  return 0;
+}
+
+}  // namespace ryoma
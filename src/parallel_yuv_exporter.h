@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "raw_file.h"
+#include "raw_video_writer.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// Splits the video stream at keyframes into GOP-aligned segments and decodes each on its own
+// worker with a private AVFormatContext and AVCodecContext. Every frame's slot in the output is
+// known from its presentation rank, so workers write with positional writes into one
+// preallocated file. The output matches a serial export as long as every packet carries one
+// frame, which holds for the usual containers.
+class ParallelYuvExporter {
+ public:
+  // decoder_thread_num is the codec thread budget of the whole file, shared by the workers;
+  // 0: one per core, as FFmpegDecoderConfig::decoder_thread_num.
+  ParallelYuvExporter(const string& av_path, int worker_num,
+                      RawVideoLayout layout = RawVideoLayout::kPlanar, int decoder_thread_num = 0);
+
+  int Export(const string& target_path);
+
+  size_t GetExportedFrameNum() const;
+
+ private:
+  struct Segment {
+    int64_t start_pts = 0;
+    int64_t end_pts = INT64_MAX;
+    size_t first_frame = 0;
+    size_t frame_num = 0;
+  };
+
+  int ScanVideoStream();
+  void PlanSegments();
+  int ExportSegment(const Segment& segment, RawFile* raw_file, size_t* exported_frame_num);
+
+  int OpenInput(shared_ptr<AVFormatContext>& av_ctx, int& stream_index) const;
+
+ private:
+  string av_path_;
+  int worker_num_ = 1;
+  RawVideoLayout layout_;
+  int decoder_thread_num_ = 0;
+
+  int width_ = 0;
+  int height_ = 0;
+  AVPixelFormat pixel_format_ = AV_PIX_FMT_NONE;
+  int frame_size_ = 0;
+
+  // Presentation timestamps of every video packet, sorted; the index is the frame's slot.
+  vector<int64_t> frame_pts_;
+  vector<int64_t> keyframe_pts_;
+  vector<Segment> segments_;
+
+  size_t exported_frame_num_ = 0;
+};
+
+}  // namespace ryoma
@@ -0,0 +1,111 @@
+#include "presentation_timer.h"
+
+#include <algorithm>
+
+namespace ryoma {
+
+PresentationTimer::PresentationTimer(TickCallback on_tick) : on_tick_(move(on_tick)) {}
+
+PresentationTimer::~PresentationTimer() { Stop(); }
+
+void PresentationTimer::Start() {
+  if (timer_thread_.joinable()) {
+    return;
+  }
+  {
+    lock_guard<mutex> lock(mutex_);
+    is_stop_ = false;
+    is_tick_pending_ = false;
+    has_deadline_ = false;
+    stats_ = PresentationTimerStats();
+    jitter_sum_ms_ = 0;
+  }
+  timer_thread_ = thread(&PresentationTimer::TimerLoop, this);
+}
+
+void PresentationTimer::Stop() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    is_stop_ = true;
+  }
+  cond_.notify_all();
+  if (timer_thread_.joinable()) {
+    timer_thread_.join();
+  }
+}
+
+void PresentationTimer::Schedule(Clock::duration delay) { ScheduleAt(Clock::now() + delay); }
+
+void PresentationTimer::ScheduleAt(Clock::time_point deadline) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    deadline_ = deadline;
+    has_deadline_ = true;
+  }
+  cond_.notify_all();
+}
+
+void PresentationTimer::OnTickHandled() {
+  lock_guard<mutex> lock(mutex_);
+  is_tick_pending_ = false;
+}
+
+void PresentationTimer::SetPaused(bool is_paused) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    is_paused_ = is_paused;
+    // A deadline that passed while paused is due now; the pause is not wake up jitter.
+    if (!is_paused && has_deadline_) {
+      deadline_ = max(deadline_, Clock::now());
+    }
+  }
+  cond_.notify_all();
+}
+
+PresentationTimerStats PresentationTimer::GetStats() const {
+  lock_guard<mutex> lock(mutex_);
+  return stats_;
+}
+
+void PresentationTimer::TimerLoop() {
+  unique_lock<mutex> lock(mutex_);
+  while (!is_stop_) {
+    if (is_paused_ || !has_deadline_) {
+      cond_.wait(lock, [this] { return is_stop_ || (!is_paused_ && has_deadline_); });
+      continue;
+    }
+    // Woken early by a new deadline, a pause or Stop: start over with the new state.
+    auto deadline = deadline_;
+    if (cond_.wait_until(lock, deadline, [&] {
+          return is_stop_ || is_paused_ || !has_deadline_ || deadline_ != deadline;
+        })) {
+      continue;
+    }
+
+    double jitter_ms = chrono::duration<double, milli>(Clock::now() - deadline).count();
+    has_deadline_ = false;
+    if (is_tick_pending_) {
+      stats_.coalesced_tick_num++;
+      continue;
+    }
+    is_tick_pending_ = true;
+    stats_.tick_num++;
+    jitter_sum_ms_ += jitter_ms;
+    stats_.mean_jitter_ms = jitter_sum_ms_ / stats_.tick_num;
+    stats_.max_jitter_ms = max(stats_.max_jitter_ms, jitter_ms);
+
+    lock.unlock();
+    bool is_delivered = on_tick_();
+    lock.lock();
+    if (!is_delivered) {
+      // OnTickHandled will never come for a lost tick, which would fold every later one into it.
+      is_tick_pending_ = false;
+      if (!has_deadline_) {
+        deadline_ = Clock::now() + kRetryDelay;
+        has_deadline_ = true;
+      }
+    }
+  }
+}
+
+}  // namespace ryoma
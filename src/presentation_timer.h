@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace ryoma {
+
+struct PresentationTimerStats {
+  uint64_t tick_num = 0;
+  uint64_t coalesced_tick_num = 0;  // deadlines that passed while a tick was still unhandled
+  double mean_jitter_ms = 0;        // wake up time past the deadline
+  double max_jitter_ms = 0;
+};
+
+// Fires on_tick once per scheduled deadline from its own thread, sleeping on a steady clock
+// until then. At most one tick is outstanding: until the consumer calls OnTickHandled, further
+// deadlines are folded into it instead of queueing up. While paused or with nothing scheduled
+// the thread blocks and costs no CPU.
+class PresentationTimer {
+ public:
+  using Clock = chrono::steady_clock;
+  // Returns false when the tick could not be delivered (e.g. SDL_PushEvent failed). Nothing is
+  // left pending then, and the tick fires again after kRetryDelay unless rescheduled first.
+  using TickCallback = function<bool()>;
+
+  static constexpr chrono::milliseconds kRetryDelay{5};
+
+ public:
+  explicit PresentationTimer(TickCallback on_tick);
+  ~PresentationTimer();
+
+  void Start();
+  void Stop();
+
+  // Replaces the pending deadline.
+  void Schedule(Clock::duration delay);
+  void ScheduleAt(Clock::time_point deadline);
+  void OnTickHandled();
+
+  void SetPaused(bool is_paused);
+
+  PresentationTimerStats GetStats() const;
+
+ private:
+  void TimerLoop();
+
+ private:
+  TickCallback on_tick_;
+
+  mutable mutex mutex_;
+  condition_variable cond_;
+  Clock::time_point deadline_;
+  bool has_deadline_ = false;
+  bool is_tick_pending_ = false;
+  bool is_paused_ = false;
+  bool is_stop_ = false;
+
+  PresentationTimerStats stats_;
+  double jitter_sum_ms_ = 0;
+
+  thread timer_thread_;
+};
+
+}  // namespace ryoma
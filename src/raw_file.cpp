@@ -0,0 +1,140 @@
+#include "raw_file.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include "spdlog/spdlog.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+#include "libavutil/error.h"
+}
+
+namespace ryoma {
+
+RawFile::~RawFile() { Close(); }
+
+#ifdef _WIN32
+
+int RawFile::Open(const string& path, int64_t size) {
+  Close();
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    spdlog::error("CreateFileA {} failed, error {}", path, GetLastError());
+    return AVERROR(EIO);
+  }
+  handle_ = handle;
+  if (size > 0) {
+    return Truncate(size);
+  }
+  return 0;
+}
+
+int RawFile::PWrite(const uint8_t* data, size_t size, int64_t offset) {
+  while (size > 0) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD chunk = static_cast<DWORD>(min<size_t>(size, 1u << 30));
+    DWORD written = 0;
+    if (!WriteFile(handle_, data, chunk, &written, &overlapped)) {
+      spdlog::error("WriteFile failed, offset {} error {}", offset, GetLastError());
+      return AVERROR(EIO);
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+int RawFile::Truncate(int64_t size) {
+  LARGE_INTEGER position;
+  position.QuadPart = size;
+  if (!SetFilePointerEx(handle_, position, nullptr, FILE_BEGIN) || !SetEndOfFile(handle_)) {
+    spdlog::error("SetEndOfFile failed, size {} error {}", size, GetLastError());
+    return AVERROR(EIO);
+  }
+  return 0;
+}
+
+void RawFile::Close() {
+  if (handle_ != nullptr) {
+    CloseHandle(handle_);
+    handle_ = nullptr;
+  }
+}
+
+bool RawFile::IsOpen() const { return handle_ != nullptr; }
+
+#else
+
+int RawFile::Open(const string& path, int64_t size) {
+  Close();
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    int err = errno;
+    spdlog::error("open {} failed, errno {}", path, err);
+    return AVERROR(err);
+  }
+  if (size > 0) {
+    // Reserve the blocks so concurrent writers do not fragment the file; not every file
+    // system supports it, a sparse file is fine too.
+#ifdef __linux__
+    if (posix_fallocate(fd_, 0, size) == 0) {
+      return 0;
+    }
+#endif
+    return Truncate(size);
+  }
+  return 0;
+}
+
+int RawFile::PWrite(const uint8_t* data, size_t size, int64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd_, data, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int err = errno;
+      spdlog::error("pwrite failed, offset {} errno {}", offset, err);
+      return AVERROR(err);
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+int RawFile::Truncate(int64_t size) {
+  if (ftruncate(fd_, size) < 0) {
+    int err = errno;
+    spdlog::error("ftruncate failed, size {} errno {}", size, err);
+    return AVERROR(err);
+  }
+  return 0;
+}
+
+void RawFile::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool RawFile::IsOpen() const { return fd_ >= 0; }
+
+#endif
+
+}  // namespace ryoma
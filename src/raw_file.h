@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+namespace ryoma {
+
+// Output file written with positional writes. Several threads may call PWrite at the same
+// time as long as their ranges do not overlap.
+class RawFile {
+ public:
+  RawFile() = default;
+  ~RawFile();
+
+  RawFile(const RawFile&) = delete;
+  RawFile& operator=(const RawFile&) = delete;
+
+  // Truncates the file and, when size > 0, reserves that many bytes up front.
+  int Open(const string& path, int64_t size = 0);
+  int PWrite(const uint8_t* data, size_t size, int64_t offset);
+  int Truncate(int64_t size);
+  void Close();
+
+  bool IsOpen() const;
+
+ private:
+#ifdef _WIN32
+  void* handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+}  // namespace ryoma
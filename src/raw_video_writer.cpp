@@ -0,0 +1,276 @@
+#include "raw_video_writer.h"
+
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/pixdesc.h"
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RYOMA_HAVE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define RYOMA_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace ryoma {
+
+namespace {
+
+// Splits n interleaved 8-bit pairs (u0 v0 u1 v1 ...) into u[] and v[].
+void Deinterleave8(const uint8_t* src, uint8_t* u, uint8_t* v, int n) {
+  int i = 0;
+#if defined(RYOMA_HAVE_SSE2)
+  const __m128i low_byte = _mm_set1_epi16(0x00FF);
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+    __m128i even = _mm_packus_epi16(_mm_and_si128(a, low_byte), _mm_and_si128(b, low_byte));
+    __m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i), even);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), odd);
+  }
+#elif defined(RYOMA_HAVE_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16x2_t uv = vld2q_u8(src + 2 * i);
+    vst1q_u8(u + i, uv.val[0]);
+    vst1q_u8(v + i, uv.val[1]);
+  }
+#endif
+  for (; i < n; i++) {
+    u[i] = src[2 * i];
+    v[i] = src[2 * i + 1];
+  }
+}
+
+// Same for 16-bit samples (P010, P016, NV20...), each shifted right by shift bits.
+void Deinterleave16(const uint16_t* src, uint16_t* u, uint16_t* v, int n, int shift) {
+  int i = 0;
+#if defined(RYOMA_HAVE_SSE2)
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= n; i += 8) {
+    // u0 v0 u1 v1 u2 v2 u3 v3 -> u0 u1 u2 u3 v0 v1 v2 v3
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 8));
+    a = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0xD8), 0xD8), 0xD8);
+    b = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(b, 0xD8), 0xD8), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i),
+                     _mm_srl_epi16(_mm_unpacklo_epi64(a, b), count));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i),
+                     _mm_srl_epi16(_mm_unpackhi_epi64(a, b), count));
+  }
+#elif defined(RYOMA_HAVE_NEON)
+  const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-shift));
+  for (; i + 8 <= n; i += 8) {
+    uint16x8x2_t uv = vld2q_u16(src + 2 * i);
+    vst1q_u16(u + i, vshlq_u16(uv.val[0], count));
+    vst1q_u16(v + i, vshlq_u16(uv.val[1], count));
+  }
+#endif
+  for (; i < n; i++) {
+    u[i] = src[2 * i] >> shift;
+    v[i] = src[2 * i + 1] >> shift;
+  }
+}
+
+// Moves MSB-aligned 16-bit samples down to the low bits.
+void ShiftRight16(const uint16_t* src, uint16_t* dst, int n, int shift) {
+  int i = 0;
+#if defined(RYOMA_HAVE_SSE2)
+  const __m128i count = _mm_cvtsi32_si128(shift);
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_srl_epi16(a, count));
+  }
+#elif defined(RYOMA_HAVE_NEON)
+  const int16x8_t count = vdupq_n_s16(static_cast<int16_t>(-shift));
+  for (; i + 8 <= n; i += 8) {
+    vst1q_u16(dst + i, vshlq_u16(vld1q_u16(src + i), count));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i] >> shift;
+  }
+}
+
+int GetPlaneHeight(const AVPixFmtDescriptor* desc, int plane, int height) {
+  bool is_chroma = (plane == 1 || plane == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB);
+  return is_chroma ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+}
+
+}  // namespace
+
+RawVideoWriter::RawVideoWriter(RawVideoLayout layout, size_t staging_buffer_size)
+    : layout_(layout), staging_buffer_size_(staging_buffer_size) {}
+
+RawVideoWriter::~RawVideoWriter() { Close(); }
+
+int RawVideoWriter::Open(const string& path) {
+  own_raw_file_ = make_unique<RawFile>();
+  int ret = own_raw_file_->Open(path);
+  if (ret < 0) {
+    own_raw_file_.reset();
+    return ret;
+  }
+  return Open(own_raw_file_.get());
+}
+
+int RawVideoWriter::Open(RawFile* raw_file) {
+  raw_file_ = raw_file;
+  staging_size_ = 0;
+  staging_offset_ = 0;
+  written_bytes_ = 0;
+  return 0;
+}
+
+int RawVideoWriter::GetFrameSize(AVPixelFormat pixel_format, int width, int height) {
+  // Deinterleaving chroma does not change the size, both layouts share it.
+  return av_image_get_buffer_size(pixel_format, width, height, 1);
+}
+
+int RawVideoWriter::WriteFrame(const AVFrame* frame) {
+  return WriteFrame(frame, staging_offset_ + staging_size_);
+}
+
+int RawVideoWriter::WriteFrame(const AVFrame* frame, int64_t offset) {
+  if (raw_file_ == nullptr) {
+    return AVERROR(EINVAL);
+  }
+  int frame_size =
+      GetFrameSize(static_cast<AVPixelFormat>(frame->format), frame->width, frame->height);
+  if (frame_size <= 0) {
+    spdlog::error("unsupported frame {}x{} format {}", frame->width, frame->height,
+                  frame->format);
+    return AVERROR(EINVAL);
+  }
+
+  // Only contiguous frames are batched; a jump or a full buffer writes out what is staged.
+  if (offset != staging_offset_ + static_cast<int64_t>(staging_size_) ||
+      staging_size_ + frame_size > staging_buffer_size_) {
+    int ret = Flush();
+    if (ret < 0) {
+      return ret;
+    }
+    staging_offset_ = offset;
+  }
+  if (staging_buffer_ == nullptr || static_cast<size_t>(frame_size) > staging_buffer_size_) {
+    staging_buffer_size_ = max(staging_buffer_size_, static_cast<size_t>(frame_size));
+    staging_buffer_.reset(static_cast<uint8_t*>(av_malloc(staging_buffer_size_)), av_free);
+    if (staging_buffer_ == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  int ret = PackFrame(frame, staging_buffer_.get() + staging_size_);
+  if (ret < 0) {
+    return ret;
+  }
+  staging_size_ += frame_size;
+  return 0;
+}
+
+int RawVideoWriter::Flush() {
+  if (staging_size_ == 0) {
+    return 0;
+  }
+  int ret = raw_file_->PWrite(staging_buffer_.get(), staging_size_, staging_offset_);
+  if (ret < 0) {
+    return ret;
+  }
+  written_bytes_ += staging_size_;
+  staging_offset_ += staging_size_;
+  staging_size_ = 0;
+  return 0;
+}
+
+int RawVideoWriter::Close() {
+  int ret = 0;
+  if (raw_file_ != nullptr) {
+    ret = Flush();
+    raw_file_ = nullptr;
+  }
+  if (own_raw_file_ != nullptr) {
+    own_raw_file_->Close();
+    own_raw_file_.reset();
+  }
+  return ret;
+}
+
+uint64_t RawVideoWriter::GetWrittenBytes() const { return written_bytes_; }
+
+int RawVideoWriter::PackFrame(const AVFrame* frame, uint8_t* dst) const {
+  auto pixel_format = static_cast<AVPixelFormat>(frame->format);
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixel_format);
+  int row_bytes[4] = {0};
+  int ret = av_image_fill_linesizes(row_bytes, pixel_format, frame->width);
+  if (desc == nullptr || ret < 0) {
+    return AVERROR(EINVAL);
+  }
+
+  bool is_semi_planar = !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components >= 3 &&
+                        desc->comp[1].plane == desc->comp[2].plane &&
+                        desc->comp[1].plane != desc->comp[0].plane;
+  // Host order samples only, a big-endian P010 would need a byte swap as well.
+  int shift = layout_ == RawVideoLayout::kPlanar && is_semi_planar &&
+                      !(desc->flags & AV_PIX_FMT_FLAG_BE) && desc->comp[0].depth > 8
+                  ? desc->comp[0].shift
+                  : 0;
+  int plane_num = av_pix_fmt_count_planes(pixel_format);
+  for (int plane = 0; plane < plane_num; plane++) {
+    int plane_height = GetPlaneHeight(desc, plane, frame->height);
+    const uint8_t* src = frame->data[plane];
+    int src_linesize = frame->linesize[plane];
+
+    if (layout_ == RawVideoLayout::kPlanar && is_semi_planar && plane == desc->comp[1].plane) {
+      int sample_bytes = (desc->comp[1].depth + 7) / 8;
+      int sample_num = row_bytes[plane] / (2 * sample_bytes);
+      bool is_u_first = desc->comp[1].offset < desc->comp[2].offset;
+      uint8_t* u = dst;
+      uint8_t* v = dst + static_cast<size_t>(sample_num) * sample_bytes * plane_height;
+      if (!is_u_first) {
+        swap(u, v);
+      }
+      for (int y = 0; y < plane_height; y++) {
+        const uint8_t* row = src + static_cast<ptrdiff_t>(y) * src_linesize;
+        size_t row_offset = static_cast<size_t>(y) * sample_num * sample_bytes;
+        if (sample_bytes == 1) {
+          Deinterleave8(row, u + row_offset, v + row_offset, sample_num);
+        } else {
+          Deinterleave16(reinterpret_cast<const uint16_t*>(row),
+                         reinterpret_cast<uint16_t*>(u + row_offset),
+                         reinterpret_cast<uint16_t*>(v + row_offset), sample_num, shift);
+        }
+      }
+      dst += static_cast<size_t>(row_bytes[plane]) * plane_height;
+      continue;
+    }
+
+    if (shift > 0) {
+      int sample_num = row_bytes[plane] / 2;
+      for (int y = 0; y < plane_height; y++) {
+        const uint8_t* row = src + static_cast<ptrdiff_t>(y) * src_linesize;
+        ShiftRight16(reinterpret_cast<const uint16_t*>(row),
+                     reinterpret_cast<uint16_t*>(dst) + static_cast<size_t>(y) * sample_num,
+                     sample_num, shift);
+      }
+      dst += static_cast<size_t>(row_bytes[plane]) * plane_height;
+      continue;
+    }
+
+    if (src_linesize == row_bytes[plane]) {
+      memcpy(dst, src, static_cast<size_t>(row_bytes[plane]) * plane_height);
+    } else {
+      av_image_copy_plane(dst, row_bytes[plane], src, src_linesize, row_bytes[plane],
+                          plane_height);
+    }
+    dst += static_cast<size_t>(row_bytes[plane]) * plane_height;
+  }
+  return 0;
+}
+
+}  // namespace ryoma
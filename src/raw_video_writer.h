@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "raw_file.h"
+
+extern "C" {
+#include "libavutil/frame.h"
+#include "libavutil/pixfmt.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+enum class RawVideoLayout {
+  // Planes as the decoder produced them, e.g. NV12 stays NV12.
+  kNative,
+  // Interleaved chroma (NV12, NV21, NV16, NV24, P010...) is split into separate U and V planes,
+  // so the output is the matching yuv4xxp format at the same bit depth. MSB-aligned samples
+  // (P010, P210...) are shifted down as well, P010 gives yuv420p10le.
+  kPlanar,
+};
+
+// Writes raw pictures without the decoder's row padding. Rows are copied stride-correct into a
+// large aligned staging buffer, which goes to disk in few big positional writes.
+class RawVideoWriter {
+ public:
+  static constexpr size_t kStagingBufferSize = 8 << 20;
+
+ public:
+  explicit RawVideoWriter(RawVideoLayout layout = RawVideoLayout::kPlanar,
+                          size_t staging_buffer_size = kStagingBufferSize);
+  ~RawVideoWriter();
+
+  RawVideoWriter(const RawVideoWriter&) = delete;
+  RawVideoWriter& operator=(const RawVideoWriter&) = delete;
+
+  int Open(const string& path);
+  // Writes into a file shared with other writers; the caller owns raw_file.
+  int Open(RawFile* raw_file);
+
+  static int GetFrameSize(AVPixelFormat pixel_format, int width, int height);
+
+  // Appends after the previous frame, or places the frame at offset.
+  int WriteFrame(const AVFrame* frame);
+  int WriteFrame(const AVFrame* frame, int64_t offset);
+
+  int Flush();
+  int Close();
+
+  uint64_t GetWrittenBytes() const;
+
+ private:
+  int PackFrame(const AVFrame* frame, uint8_t* dst) const;
+
+ private:
+  RawVideoLayout layout_;
+  size_t staging_buffer_size_ = 0;
+  shared_ptr<uint8_t> staging_buffer_;
+  size_t staging_size_ = 0;
+
+  unique_ptr<RawFile> own_raw_file_;
+  RawFile* raw_file_ = nullptr;
+
+  // File offset of the first staged byte.
+  int64_t staging_offset_ = 0;
+  uint64_t written_bytes_ = 0;
+};
+
+}  // namespace ryoma
@@ -0,0 +1,273 @@
+#include "sample_convert.h"
+
+#include <cmath>
+
+extern "C" {
+#include "libavutil/cpu.h"
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RYOMA_HAVE_SSE2 1
+#define RYOMA_HAVE_AVX2 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define RYOMA_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RYOMA_TARGET_AVX2
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define RYOMA_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace ryoma {
+
+namespace {
+
+constexpr float kS16Scale = 32768.0f;
+constexpr float kS16Min = -32768.0f;
+constexpr float kS16Max = 32767.0f;
+
+// Same result as swr: lrintf(sample * 32768) clipped to int16. The clamp comes first because
+// lrintf of an out of range value is undefined; NaN ends up at the minimum, as with SSE2 and
+// NEON.
+inline int16_t FloatToS16(float sample) {
+  float scaled = sample * kS16Scale;
+  scaled = scaled > kS16Min ? scaled : kS16Min;
+  scaled = scaled < kS16Max ? scaled : kS16Max;
+  return static_cast<int16_t>(lrintf(scaled));
+}
+
+// Scalar tail of every kernel, from sample i on.
+inline void FltpToS16Tail(const uint8_t* const* src, int16_t* dst, int i, int sample_num,
+                          int channel_num) {
+  for (; i < sample_num; i++) {
+    for (int c = 0; c < channel_num; c++) {
+      dst[i * channel_num + c] = FloatToS16(reinterpret_cast<const float*>(src[c])[i]);
+    }
+  }
+}
+
+#if defined(RYOMA_HAVE_SSE2)
+constexpr int kBlockSize = 8;
+
+// 8 floats to 8 s16; cvtps rounds to nearest even like lrintf.
+inline __m128i FloatToS16x8(const float* src) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  const __m128 min_value = _mm_set1_ps(kS16Min);
+  const __m128 max_value = _mm_set1_ps(kS16Max);
+  __m128 a = _mm_mul_ps(_mm_loadu_ps(src), scale);
+  __m128 b = _mm_mul_ps(_mm_loadu_ps(src + 4), scale);
+  a = _mm_min_ps(_mm_max_ps(a, min_value), max_value);
+  b = _mm_min_ps(_mm_max_ps(b, min_value), max_value);
+  return _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+}
+
+inline void StoreS16x8(const float* src, int16_t* dst) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), FloatToS16x8(src));
+}
+
+inline void StoreS16x8Stereo(const float* left, const float* right, int16_t* dst) {
+  __m128i l = FloatToS16x8(left);
+  __m128i r = FloatToS16x8(right);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(l, r));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpackhi_epi16(l, r));
+}
+#elif defined(RYOMA_HAVE_NEON)
+constexpr int kBlockSize = 8;
+
+inline int16x8_t FloatToS16x8(const float* src) {
+  // vmaxnm takes the number over a NaN, so NaN clamps to the minimum as in the scalar path;
+  // vcvtnq alone would give 0. vcvtnq rounds to nearest even like lrintf.
+  const float32x4_t min_value = vdupq_n_f32(kS16Min);
+  const float32x4_t max_value = vdupq_n_f32(kS16Max);
+  float32x4_t a = vmulq_n_f32(vld1q_f32(src), kS16Scale);
+  float32x4_t b = vmulq_n_f32(vld1q_f32(src + 4), kS16Scale);
+  a = vminnmq_f32(vmaxnmq_f32(a, min_value), max_value);
+  b = vminnmq_f32(vmaxnmq_f32(b, min_value), max_value);
+  return vcombine_s16(vmovn_s32(vcvtnq_s32_f32(a)), vmovn_s32(vcvtnq_s32_f32(b)));
+}
+
+inline void StoreS16x8(const float* src, int16_t* dst) { vst1q_s16(dst, FloatToS16x8(src)); }
+
+inline void StoreS16x8Stereo(const float* left, const float* right, int16_t* dst) {
+  int16x8x2_t lr = {{FloatToS16x8(left), FloatToS16x8(right)}};
+  vst2q_s16(dst, lr);
+}
+#endif
+
+// kChannels 0 takes the count at run time.
+template <int kChannels>
+void FltpToS16(const uint8_t* const* src, uint8_t* dst, int sample_num, int channels) {
+  int channel_num = kChannels > 0 ? kChannels : channels;
+  auto* out = reinterpret_cast<int16_t*>(dst);
+  int i = 0;
+#if defined(RYOMA_HAVE_SSE2) || defined(RYOMA_HAVE_NEON)
+  const auto* first = reinterpret_cast<const float*>(src[0]);
+  for (; i + kBlockSize <= sample_num; i += kBlockSize) {
+    if constexpr (kChannels == 1) {
+      StoreS16x8(first + i, out + i);
+    } else if constexpr (kChannels == 2) {
+      StoreS16x8Stereo(first + i, reinterpret_cast<const float*>(src[1]) + i, out + 2 * i);
+    } else {
+      // Convert a block per channel, then scatter it into the interleaved rows.
+      int16_t block[kBlockSize];
+      for (int c = 0; c < channel_num; c++) {
+        StoreS16x8(reinterpret_cast<const float*>(src[c]) + i, block);
+        for (int j = 0; j < kBlockSize; j++) {
+          out[(i + j) * channel_num + c] = block[j];
+        }
+      }
+    }
+  }
+#endif
+  FltpToS16Tail(src, out, i, sample_num, channel_num);
+}
+
+#if defined(RYOMA_HAVE_AVX2)
+constexpr int kAvx2BlockSize = 16;
+
+RYOMA_TARGET_AVX2 inline __m256i FloatToS16x16(const float* src) {
+  const __m256 scale = _mm256_set1_ps(kS16Scale);
+  const __m256 min_value = _mm256_set1_ps(kS16Min);
+  const __m256 max_value = _mm256_set1_ps(kS16Max);
+  __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src), scale);
+  __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + 8), scale);
+  a = _mm256_min_ps(_mm256_max_ps(a, min_value), max_value);
+  b = _mm256_min_ps(_mm256_max_ps(b, min_value), max_value);
+  // packs works per 128-bit lane: a0-3 b0-3 a4-7 b4-7, put the quarters back in order.
+  __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+  return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+template <int kChannels>
+RYOMA_TARGET_AVX2 void FltpToS16Avx2(const uint8_t* const* src, uint8_t* dst, int sample_num,
+                                     int channels) {
+  int channel_num = kChannels > 0 ? kChannels : channels;
+  auto* out = reinterpret_cast<int16_t*>(dst);
+  const auto* first = reinterpret_cast<const float*>(src[0]);
+  int i = 0;
+  for (; i + kAvx2BlockSize <= sample_num; i += kAvx2BlockSize) {
+    if constexpr (kChannels == 1) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), FloatToS16x16(first + i));
+    } else if constexpr (kChannels == 2) {
+      __m256i l = FloatToS16x16(first + i);
+      __m256i r = FloatToS16x16(reinterpret_cast<const float*>(src[1]) + i);
+      // Per lane again: lo holds samples 0-3 and 8-11, hi 4-7 and 12-15.
+      __m256i lo = _mm256_unpacklo_epi16(l, r);
+      __m256i hi = _mm256_unpackhi_epi16(l, r);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                          _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 16),
+                          _mm256_permute2x128_si256(lo, hi, 0x31));
+    } else {
+      alignas(32) int16_t block[kAvx2BlockSize];
+      for (int c = 0; c < channel_num; c++) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(block),
+                           FloatToS16x16(reinterpret_cast<const float*>(src[c]) + i));
+        for (int j = 0; j < kAvx2BlockSize; j++) {
+          out[(i + j) * channel_num + c] = block[j];
+        }
+      }
+    }
+  }
+  FltpToS16Tail(src, out, i, sample_num, channel_num);
+}
+#endif
+
+// Packed float is a single channel of sample_num * channels samples.
+template <bool kUseAvx2>
+void FltToS16(const uint8_t* const* src, uint8_t* dst, int sample_num, int channels) {
+#if defined(RYOMA_HAVE_AVX2)
+  if constexpr (kUseAvx2) {
+    FltpToS16Avx2<1>(src, dst, sample_num * channels, 1);
+    return;
+  }
+#endif
+  FltpToS16<1>(src, dst, sample_num * channels, 1);
+}
+
+// Planar to interleaved without conversion, S16P -> S16 and FLTP -> FLT. Plain loops with a
+// compile-time channel count, which the compiler vectorizes well enough for a copy.
+template <typename T, int kChannels>
+void Interleave(const uint8_t* const* src, uint8_t* dst, int sample_num, int channels) {
+  int channel_num = kChannels > 0 ? kChannels : channels;
+  auto* out = reinterpret_cast<T*>(dst);
+  for (int c = 0; c < channel_num; c++) {
+    const auto* in = reinterpret_cast<const T*>(src[c]);
+    for (int i = 0; i < sample_num; i++) {
+      out[i * channel_num + c] = in[i];
+    }
+  }
+}
+
+template <int kChannels>
+SampleConvertFunc SelectFltpToS16(bool use_avx2) {
+#if defined(RYOMA_HAVE_AVX2)
+  if (use_avx2) {
+    return FltpToS16Avx2<kChannels>;
+  }
+#endif
+  return FltpToS16<kChannels>;
+}
+
+template <typename T>
+SampleConvertFunc SelectInterleave(int channels) {
+  switch (channels) {
+    case 1:
+      return Interleave<T, 1>;
+    case 2:
+      return Interleave<T, 2>;
+    case 6:
+      return Interleave<T, 6>;
+    case 8:
+      return Interleave<T, 8>;
+    default:
+      return Interleave<T, 0>;
+  }
+}
+
+bool HasAvx2() {
+#if defined(RYOMA_HAVE_AVX2)
+  static const bool has_avx2 = (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) != 0;
+  return has_avx2;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+SampleConvertFunc GetSampleConvertFunc(AVSampleFormat src_format, AVSampleFormat dst_format,
+                                       int channels) {
+  if (channels <= 0) {
+    return nullptr;
+  }
+  bool use_avx2 = HasAvx2();
+  if (src_format == AV_SAMPLE_FMT_FLTP && dst_format == AV_SAMPLE_FMT_S16) {
+    switch (channels) {
+      case 1:
+        return SelectFltpToS16<1>(use_avx2);
+      case 2:
+        return SelectFltpToS16<2>(use_avx2);
+      case 6:
+        return SelectFltpToS16<6>(use_avx2);
+      case 8:
+        return SelectFltpToS16<8>(use_avx2);
+      default:
+        return SelectFltpToS16<0>(use_avx2);
+    }
+  }
+  if (src_format == AV_SAMPLE_FMT_FLT && dst_format == AV_SAMPLE_FMT_S16) {
+    return use_avx2 ? FltToS16<true> : FltToS16<false>;
+  }
+  if (src_format == AV_SAMPLE_FMT_FLTP && dst_format == AV_SAMPLE_FMT_FLT) {
+    return SelectInterleave<float>(channels);
+  }
+  if (src_format == AV_SAMPLE_FMT_S16P && dst_format == AV_SAMPLE_FMT_S16) {
+    return SelectInterleave<int16_t>(channels);
+  }
+  return nullptr;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+extern "C" {
+#include "libavutil/samplefmt.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+// Sample format conversion to interleaved output, at the same rate and channel layout. src holds
+// one plane per channel for planar formats, one plane otherwise; sample_num counts per channel.
+using SampleConvertFunc = void (*)(const uint8_t* const* src, uint8_t* dst, int sample_num,
+                                   int channels);
+
+// Kernels are specialized per format pair and for 1, 2, 6 and 8 channels; float to s16 has
+// SSE2, AVX2 and NEON versions picked for the running CPU. nullptr when the pair has none.
+SampleConvertFunc GetSampleConvertFunc(AVSampleFormat src_format, AVSampleFormat dst_format,
+                                       int channels);
+
+}  // namespace ryoma
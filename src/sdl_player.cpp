@@ -1,8 +1,11 @@
 #include "sdl_player.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <memory>
+#include <thread>
 
-#include "audio_frame_resample.h"
 #include "spdlog/spdlog.h"
 #include "video_frame_convert.h"
 
@@ -10,26 +13,60 @@ extern "C" {
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_main.h"
 #include "SDL2/SDL_timer.h"
+#include "libavutil/pixdesc.h"
 }
 
 namespace ryoma {
 
-SdlPlayer::RefreshData SdlPlayer::refresh_data_;
+namespace {
+
+// Decoder formats SDL has a texture format for; their frames need no conversion.
+Uint32 GetTextureFormat(AVPixelFormat pixel_format) {
+  switch (pixel_format) {
+    case AV_PIX_FMT_YUV420P:
+      return SDL_PIXELFORMAT_IYUV;
+    case AV_PIX_FMT_NV12:
+      return SDL_PIXELFORMAT_NV12;
+    case AV_PIX_FMT_NV21:
+      return SDL_PIXELFORMAT_NV21;
+    case AV_PIX_FMT_YUYV422:
+      return SDL_PIXELFORMAT_YUY2;
+    case AV_PIX_FMT_UYVY422:
+      return SDL_PIXELFORMAT_UYVY;
+    case AV_PIX_FMT_YVYU422:
+      return SDL_PIXELFORMAT_YVYU;
+    case AV_PIX_FMT_RGB24:
+      return SDL_PIXELFORMAT_RGB24;
+    case AV_PIX_FMT_BGR24:
+      return SDL_PIXELFORMAT_BGR24;
+    // The byte order aliases, FFmpeg names these formats by their bytes too.
+    case AV_PIX_FMT_RGBA:
+      return SDL_PIXELFORMAT_RGBA32;
+    case AV_PIX_FMT_BGRA:
+      return SDL_PIXELFORMAT_BGRA32;
+    default:
+      return SDL_PIXELFORMAT_UNKNOWN;
+  }
+}
+
+}  // namespace
 
-atomic<int> SdlPlayer::audio_len_{0};
-atomic<const Uint8*> SdlPlayer::audio_data_{nullptr};
+SdlPlayer::RefreshData SdlPlayer::refresh_data_;
 
 SdlPlayer::~SdlPlayer() {
   SDL_CloseAudio();
   SDL_Quit();
 }
 
-int SdlPlayer::Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder) {
+int SdlPlayer::Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder,
+                    const SdlPlayerConfig& config) {
   if (ffmpeg_decoder == nullptr) {
     spdlog::error("ffmpeg_decoder is nullptr");
     return -1;
   }
   ffmpeg_decoder_ = ffmpeg_decoder;
+  config_ = config;
+  sync_clock_.SetSyncMaster(config_.sync_master);
 
   int ret = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
   if (ret < 0) {
@@ -56,33 +93,37 @@ int SdlPlayer::Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder) {
     return -1;
   }
 
-  texture_.reset(SDL_CreateTexture(renderer_.get(), SDL_PIXELFORMAT_IYUV,
-                                   SDL_TEXTUREACCESS_STREAMING, width, height),
-                 SDL_DestroyTexture);
-  if (texture_ == nullptr) {
-    spdlog::error("SDL_CreateTexture: {}", SDL_GetError());
-    return -1;
-  }
-
   rect_.x = 0;
   rect_.y = 0;
-
-  rect_.h = height;
-  rect_.w = width;
-
-  auto* tid = SDL_CreateThread(Refresh, nullptr, nullptr);
-  if (tid == nullptr) {
-    spdlog::error("SDL_CreateThread: {}", SDL_GetError());
-    return -1;
+  // The decoder's own format when SDL can take it, see PrepareTexture.
+  ret = PrepareTexture(video_codec_ctx->pix_fmt, width, height);
+  if (ret < 0) {
+    return ret;
   }
 
+  presentation_timer_ = make_unique<PresentationTimer>([] {
+    SDL_Event event{};
+    event.type = SDL_PALYER_EVENT_REFRESH;
+    // A full event queue or a filter drops the event.
+    return SDL_PushEvent(&event) > 0;
+  });
+
   audio_wanted_spec_.freq = audio_codec_ctx->sample_rate;
   audio_wanted_spec_.channels = audio_codec_ctx->channels;
   audio_wanted_spec_.format = AUDIO_S16SYS;
   audio_wanted_spec_.silence = 0;
   audio_wanted_spec_.samples = audio_codec_ctx->frame_size;
   audio_wanted_spec_.callback = FillAudio;
-  audio_wanted_spec_.userdata = reinterpret_cast<void*>(audio_codec_ctx);
+  audio_wanted_spec_.userdata = this;
+
+  // S16 interleaved, the format FeedAudio resamples to.
+  audio_bytes_per_second_ = static_cast<size_t>(audio_wanted_spec_.freq) *
+                            audio_wanted_spec_.channels * sizeof(int16_t);
+  audio_latency_bytes_ = audio_bytes_per_second_ * max(config_.audio_latency_ms, 1) / 1000;
+  // Room for the latency target plus a burst of decoded frames on top.
+  audio_ring_buffer_ = make_unique<AudioRingBuffer>(audio_latency_bytes_ * 2);
+
+  // Without an obtained spec SDL converts to exactly what was asked for.
   ret = SDL_OpenAudio(&audio_wanted_spec_, nullptr);
   if (ret < 0) {
     spdlog::error("SDL_OpenAudio: {}", SDL_GetError());
@@ -93,24 +134,64 @@ int SdlPlayer::Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder) {
 }
 
 int SdlPlayer::Play() {
-  auto* video_codec_ctx = ffmpeg_decoder_->GetVideoCodecCtx();
-  auto* audio_codec_ctx = ffmpeg_decoder_->GetAudioCodecCtx();
-  refresh_data_.delay_ms.store(video_codec_ctx->delay);
+  // Fallback for frames without a packet duration.
+  AVRational frame_rate = av_guess_frame_rate(ffmpeg_decoder_->GetFormatCtx(),
+                                              ffmpeg_decoder_->GetVideoStream(), nullptr);
+  video_frame_duration_sec_ = frame_rate.num > 0 ? av_q2d(av_inv_q(frame_rate)) : 0.04;
+  sync_clock_.Reset();
+  video_scheduler_.Reset();
+  audio_write_end_sec_ = NAN;
 
   ffmpeg_decoder_->ResetAvStream();
-  ryoma::VideoFrameConvert video_frame_convert(video_codec_ctx, AV_PIX_FMT_YUV420P);
 
-  ryoma::AudioFrameResample audio_frame_resample(audio_codec_ctx, 44100, AV_SAMPLE_FMT_S16);
+  decode_pipeline_ = make_shared<ryoma::DecodePipeline>(ffmpeg_decoder_);
+  decode_pipeline_->SetVideoFrameCallback([this] {
+    if (is_video_starved_.exchange(false)) {
+      presentation_timer_->Schedule(chrono::microseconds(0));
+    }
+  });
+  int ret = decode_pipeline_->Start();
+  if (ret < 0) {
+    spdlog::error("DecodePipeline::Start failed, ret {}", ret);
+    return ret;
+  }
+  StartAudioFeed();
+  presentation_timer_->Start();
+  presentation_timer_->Schedule(chrono::microseconds(0));
 
   SDL_Event event;
   bool is_loop = true;
-  AVFrame* frame = nullptr;
   while (is_loop) {
     SDL_WaitEvent(&event);
     switch (event.type) {
       case SDL_KEYDOWN:
-        if (event.key.keysym.sym == SDLK_SPACE) {
-          refresh_data_.pause.store(!refresh_data_.pause);
+        switch (event.key.keysym.sym) {
+          case SDLK_SPACE: {
+            bool is_paused = !refresh_data_.pause;
+            refresh_data_.pause.store(is_paused);
+            sync_clock_.SetPaused(is_paused);
+            presentation_timer_->SetPaused(is_paused);
+            if (is_audio_started_) {
+              SDL_PauseAudio(is_paused ? 1 : 0);
+            }
+            break;
+          }
+          // A held key scrubs from keyframe to keyframe, a single press lands exactly.
+          case SDLK_LEFT:
+            SeekBy(-kSeekStepSec, event.key.repeat ? SeekMode::kKeyframe : SeekMode::kAccurate);
+            break;
+          case SDLK_RIGHT:
+            SeekBy(kSeekStepSec, event.key.repeat ? SeekMode::kKeyframe : SeekMode::kAccurate);
+            break;
+          case SDLK_DOWN:
+            SeekBy(-kLongSeekStepSec,
+                   event.key.repeat ? SeekMode::kKeyframe : SeekMode::kAccurate);
+            break;
+          case SDLK_UP:
+            SeekBy(kLongSeekStepSec, event.key.repeat ? SeekMode::kKeyframe : SeekMode::kAccurate);
+            break;
+          default:
+            break;
         }
         break;
       case SDL_QUIT:
@@ -119,16 +200,11 @@ int SdlPlayer::Play() {
         break;
 
       case SDL_PALYER_EVENT_REFRESH: {
-        int ret = ffmpeg_decoder_->GetNextFrame(frame);
-        if (ret < 0) {
-          break;
-        }
-        if (frame == nullptr) {
-          break;
+        presentation_timer_->OnTickHandled();
+        auto delay = ScheduleVideo();
+        if (delay != kNoRefresh) {
+          presentation_timer_->Schedule(delay);
         }
-         refresh_data_.delay_ms.store(frame->pkt_duration);
-        // RendererFrame(video_frame_convert.Convert(frame));
-        PlayAudioFrame(audio_frame_resample.Resample(frame));
         break;
       }
       case SDL_PALYER_EVENT_STOP:
@@ -139,49 +215,288 @@ int SdlPlayer::Play() {
     }
   }
 
+  presentation_timer_->Stop();
+  RequestAudioFeedStop();
+  decode_pipeline_->Stop();
+  StopAudioFeed();
+
+  auto stats = decode_pipeline_->GetStats();
+  spdlog::info(
+      "video frames {} dropped {}, audio frames {} dropped {}, video packet queue max {} "
+      "stall {}/{}, video frame queue max {} stall {}/{}",
+      stats.video_frame_num, stats.video_dropped_frame_num, stats.audio_frame_num,
+      stats.audio_dropped_frame_num, stats.video_packet_queue.max_depth,
+      stats.video_packet_queue.push_stall_num, stats.video_packet_queue.pop_stall_num,
+      stats.video_frame_queue.max_depth, stats.video_frame_queue.push_stall_num,
+      stats.video_frame_queue.pop_stall_num);
+  pending_video_frame_.reset();
+  auto video_stats = video_scheduler_.GetStats();
+  spdlog::info("presented {} frames, dropped {}, late {}, max late {:.3f}s",
+               video_stats.presented_frame_num, video_stats.dropped_frame_num,
+               video_stats.late_frame_num, video_stats.max_late_sec);
+  auto timer_stats = presentation_timer_->GetStats();
+  spdlog::info("refresh ticks {}, coalesced {}, jitter mean {:.3f}ms max {:.3f}ms",
+               timer_stats.tick_num, timer_stats.coalesced_tick_num, timer_stats.mean_jitter_ms,
+               timer_stats.max_jitter_ms);
+  auto audio_stats = audio_ring_buffer_->GetStats();
+  spdlog::info("audio ring buffer {} bytes, underrun {}, overrun {}",
+               audio_ring_buffer_->Capacity(), audio_stats.underrun_num,
+               audio_stats.overrun_num);
   return 0;
 }
 
+void SdlPlayer::SeekBy(double delta_sec, SeekMode mode) {
+  double position_sec = sync_clock_.GetMasterClock() - ffmpeg_decoder_->GetStartSec();
+  if (isnan(position_sec)) {
+    position_sec = 0;
+  }
+  double target_sec = max(0.0, position_sec + delta_sec);
+
+  // Stopping the pipeline wakes the audio thread out of PopAudioFrame, which must then see a
+  // stop rather than the end of the stream.
+  RequestAudioFeedStop();
+  decode_pipeline_->Stop();
+  StopAudioFeed();
+  pending_video_frame_.reset();
+
+  int ret = decode_pipeline_->Seek(target_sec, mode);
+  if (ret < 0) {
+    spdlog::error("seek to {:.3f}s failed, ret {}", target_sec, ret);
+  }
+  sync_clock_.Reset();
+  sync_clock_.SetPaused(refresh_data_.pause);
+  StartAudioFeed();
+  presentation_timer_->Schedule(chrono::microseconds(0));
+}
+
+chrono::microseconds SdlPlayer::ScheduleVideo() {
+  auto* video_stream = ffmpeg_decoder_->GetVideoStream();
+  while (true) {
+    // Only take what the decode threads already produced, never decode here. Flagged before the
+    // pop, a frame queued right after it still wakes the timer.
+    if (pending_video_frame_ == nullptr) {
+      is_video_starved_ = true;
+      if (!decode_pipeline_->TryPopVideoFrame(pending_video_frame_)) {
+        return kNoRefresh;
+      }
+      is_video_starved_ = false;
+    }
+    double pts_sec = GetFrameSeconds(pending_video_frame_.get(), video_stream);
+    double duration_sec = pending_video_frame_->pkt_duration > 0
+                              ? pending_video_frame_->pkt_duration * av_q2d(video_stream->time_base)
+                              : video_frame_duration_sec_;
+    double wait_sec = 0;
+    auto action = video_scheduler_.Schedule(pts_sec, duration_sec, &wait_sec);
+    if (action == VideoScheduler::Action::kWait) {
+      return chrono::microseconds(llround(wait_sec * 1e6));
+    }
+    if (action == VideoScheduler::Action::kLate) {
+      // Skip the late frame only when a newer one can take its place right away.
+      FramePtr next_frame;
+      if (decode_pipeline_->TryPopVideoFrame(next_frame)) {
+        video_scheduler_.OnDropped();
+        pending_video_frame_ = move(next_frame);
+        continue;
+      }
+    }
+    RendererFrame(pending_video_frame_.get());
+    video_scheduler_.OnPresented(pts_sec, duration_sec);
+    pending_video_frame_.reset();
+    // Checked again once this frame's duration is over; an earlier refresh would find the
+    // next frame not due yet.
+    return chrono::microseconds(llround(duration_sec * 1e6));
+  }
+}
+
+double SdlPlayer::GetFrameSeconds(const AVFrame* frame, const AVStream* stream) const {
+  // Stream timestamps in seconds, audio and video share this timeline.
+  int64_t pts = frame->best_effort_timestamp;
+  if (pts == AV_NOPTS_VALUE) {
+    return NAN;
+  }
+  return pts * av_q2d(stream->time_base);
+}
+
 void SdlPlayer::RendererFrame(AVFrame* frame) {
-  SDL_UpdateYUVTexture(texture_.get(), &rect_, frame->data[0], frame->linesize[0], frame->data[1],
-                       frame->linesize[1], frame->data[2], frame->linesize[2]);
+  auto pixel_format = static_cast<AVPixelFormat>(frame->format);
+  if (PrepareTexture(pixel_format, frame->width, frame->height) < 0) {
+    return;
+  }
+  if (video_frame_convert_ != nullptr) {
+    frame = video_frame_convert_->Convert(frame);
+  }
+  if (UploadFrame(frame) < 0) {
+    spdlog::error("texture upload failed: {}", SDL_GetError());
+    return;
+  }
   SDL_RenderClear(renderer_.get());
   SDL_RenderCopy(renderer_.get(), texture_.get(), nullptr, &rect_);
   SDL_RenderPresent(renderer_.get());
 }
 
-void SdlPlayer::PlayAudioFrame(const vector<uint8_t>& audio_data) {
-  while (audio_len_ > 0) {
-    SDL_Delay(1);
+int SdlPlayer::PrepareTexture(AVPixelFormat pixel_format, int width, int height) {
+  if (texture_ != nullptr && pixel_format == texture_src_pixel_format_ &&
+      width == rect_.w && height == rect_.h) {
+    return 0;
+  }
+  texture_.reset();
+  video_frame_convert_.reset();
+  texture_format_ = GetTextureFormat(pixel_format);
+  if (texture_format_ != SDL_PIXELFORMAT_UNKNOWN) {
+    texture_.reset(SDL_CreateTexture(renderer_.get(), texture_format_,
+                                     SDL_TEXTUREACCESS_STREAMING, width, height),
+                   SDL_DestroyTexture);
   }
-  audio_data_ = audio_data.data();
-  audio_len_ = audio_data.size();
-  SDL_PauseAudio(0);
+  if (texture_ == nullptr) {
+    // Anything else is converted to IYUV, which every renderer takes.
+    texture_format_ = SDL_PIXELFORMAT_IYUV;
+    texture_.reset(SDL_CreateTexture(renderer_.get(), texture_format_,
+                                     SDL_TEXTUREACCESS_STREAMING, width, height),
+                   SDL_DestroyTexture);
+    if (texture_ == nullptr) {
+      spdlog::error("SDL_CreateTexture: {}", SDL_GetError());
+      return -1;
+    }
+    // Conversion runs on the event thread between two refreshes; the decode threads keep the
+    // other half of the cores.
+    VideoFrameConvertConfig convert_config;
+    convert_config.thread_num = max<int>(1, std::thread::hardware_concurrency() / 2);
+    video_frame_convert_ = make_unique<VideoFrameConvert>(width, height, pixel_format,
+                                                          AV_PIX_FMT_YUV420P, convert_config);
+  }
+  texture_src_pixel_format_ = pixel_format;
+  rect_.w = width;
+  rect_.h = height;
+  const char* pixel_format_name = av_get_pix_fmt_name(pixel_format);
+  spdlog::info("video texture {}x{} for {}, {}", width, height,
+               pixel_format_name != nullptr ? pixel_format_name : "unknown",
+               video_frame_convert_ != nullptr ? "converted to yuv420p" : "uploaded directly");
+  return 0;
 }
 
-void SdlPlayer::FillAudio(void* userdata, Uint8* stream, int len) {
-  SDL_memset(stream, 0, len);
-  if (audio_len_ == 0) {
-    return;
+int SdlPlayer::UploadFrame(const AVFrame* frame) {
+  switch (texture_format_) {
+    case SDL_PIXELFORMAT_IYUV:
+      return SDL_UpdateYUVTexture(texture_.get(), &rect_, frame->data[0], frame->linesize[0],
+                                  frame->data[1], frame->linesize[1], frame->data[2],
+                                  frame->linesize[2]);
+    case SDL_PIXELFORMAT_NV12:
+    case SDL_PIXELFORMAT_NV21:
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+      return SDL_UpdateNVTexture(texture_.get(), &rect_, frame->data[0], frame->linesize[0],
+                                 frame->data[1], frame->linesize[1]);
+#else
+      return UploadNvFrame(frame);
+#endif
+    default:
+      // Packed formats are a single plane.
+      return SDL_UpdateTexture(texture_.get(), &rect_, frame->data[0], frame->linesize[0]);
   }
-  len = min(len, audio_len_.load());
-  SDL_MixAudio(stream, audio_data_, len, SDL_MIX_MAXVOLUME);
-  audio_data_ += len;
-  audio_len_ -= len;
 }
 
-int SdlPlayer::Refresh(void* data) {
-  SDL_Event event;
-  while (!refresh_data_.exit) {
-    if (!refresh_data_.pause) {
-      event.type = SDL_PALYER_EVENT_REFRESH;
-      SDL_PushEvent(&event);
-      SDL_Delay(refresh_data_.delay_ms);
-    }
+int SdlPlayer::UploadNvFrame(const AVFrame* frame) {
+  void* pixels = nullptr;
+  int pitch = 0;
+  if (SDL_LockTexture(texture_.get(), &rect_, &pixels, &pitch) < 0) {
+    return -1;
+  }
+  // A locked NV texture is the luma plane followed by the interleaved chroma plane, both with
+  // the same pitch.
+  auto* dst = static_cast<uint8_t*>(pixels);
+  for (int y = 0; y < frame->height; y++, dst += pitch) {
+    memcpy(dst, frame->data[0] + static_cast<ptrdiff_t>(y) * frame->linesize[0], frame->width);
+  }
+  int chroma_width = (frame->width + 1) & ~1;
+  for (int y = 0; y < (frame->height + 1) / 2; y++, dst += pitch) {
+    memcpy(dst, frame->data[1] + static_cast<ptrdiff_t>(y) * frame->linesize[1], chroma_width);
   }
-  event.type = SDL_PALYER_EVENT_STOP;
-  SDL_PushEvent(&event);
+  SDL_UnlockTexture(texture_.get());
   return 0;
 }
 
-}  // namespace ryoma
\ No newline at end of file
+void SdlPlayer::StartAudioFeed() {
+  is_audio_feed_stop_ = false;
+  audio_thread_ = thread(&SdlPlayer::FeedAudio, this);
+}
+
+void SdlPlayer::RequestAudioFeedStop() { is_audio_feed_stop_ = true; }
+
+void SdlPlayer::StopAudioFeed() {
+  RequestAudioFeedStop();
+  if (audio_thread_.joinable()) {
+    audio_thread_.join();
+  }
+  SDL_PauseAudio(1);
+  is_audio_started_ = false;
+  // The callback is not running, so the consumer side of the ring may be reset here.
+  SDL_LockAudio();
+  audio_ring_buffer_->Clear();
+  SDL_UnlockAudio();
+  audio_write_end_sec_ = NAN;
+}
+
+void SdlPlayer::StartAudioDevice() {
+  if (!refresh_data_.pause && !is_audio_started_.exchange(true)) {
+    SDL_PauseAudio(0);
+  }
+}
+
+void SdlPlayer::FeedAudio() {
+  ryoma::AudioFrameResample audio_frame_resample(ffmpeg_decoder_->GetAudioCodecCtx(),
+                                                 audio_wanted_spec_.freq, AV_SAMPLE_FMT_S16);
+  auto* audio_stream = ffmpeg_decoder_->GetAudioStream();
+  FramePtr frame;
+  while (!refresh_data_.exit && !is_audio_feed_stop_ && decode_pipeline_->PopAudioFrame(frame)) {
+    double pts_sec = GetFrameSeconds(frame.get(), audio_stream);
+    auto samples = audio_frame_resample.Resample(frame.get());
+    frame.reset();
+    PlayAudioFrame(samples);
+    // Frames without a timestamp continue where the previous one ended.
+    double start_sec = isnan(pts_sec) ? audio_write_end_sec_.load() : pts_sec;
+    audio_write_end_sec_ =
+        start_sec + static_cast<double>(samples.size()) / audio_bytes_per_second_;
+  }
+  if (!is_audio_feed_stop_) {
+    // The tail swr still holds back for its filter.
+    auto samples = audio_frame_resample.Flush();
+    PlayAudioFrame(samples);
+    audio_write_end_sec_ = audio_write_end_sec_.load() +
+                           static_cast<double>(samples.size()) / audio_bytes_per_second_;
+    // Streams shorter than the latency target never filled the buffer.
+    StartAudioDevice();
+  }
+}
+
+void SdlPlayer::PlayAudioFrame(const AudioSamples& audio_data) {
+  // Sleep while the device still holds more than the latency target; the callback drains
+  // about a quarter of it per wait.
+  uint32_t wait_ms = max(config_.audio_latency_ms / 4, 1);
+  size_t written_size = 0;
+  while (written_size < audio_data.size() && !refresh_data_.exit && !is_audio_feed_stop_) {
+    if (audio_ring_buffer_->Size() >= audio_latency_bytes_) {
+      StartAudioDevice();
+      SDL_Delay(wait_ms);
+      continue;
+    }
+    written_size += audio_ring_buffer_->Write(audio_data.data() + written_size,
+                                              audio_data.size() - written_size);
+  }
+}
+
+void SdlPlayer::FillAudio(void* userdata, Uint8* stream, int len) {
+  auto* player = static_cast<SdlPlayer*>(userdata);
+  double write_end_sec = player->audio_write_end_sec_;
+  size_t read_size = player->audio_ring_buffer_->Read(stream, len);
+  // Silence on underrun, the gap is counted by the ring buffer.
+  SDL_memset(stream + read_size, player->audio_wanted_spec_.silence, len - read_size);
+
+  // What the device plays now is everything written minus what still waits in the ring and in
+  // the block just handed over.
+  if (read_size > 0 && !isnan(write_end_sec)) {
+    size_t queued_size = player->audio_ring_buffer_->Size() + read_size;
+    player->sync_clock_.GetAudioClock()->Set(
+        write_end_sec - static_cast<double>(queued_size) / player->audio_bytes_per_second_);
+  }
+}
+
+}  // namespace ryoma
\ No newline at end of file
@@ -5,10 +5,18 @@
 #define SDL_MAIN_HANDLED
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <string>
+#include <thread>
 
+#include "audio_frame_resample.h"
+#include "audio_ring_buffer.h"
+#include "av_clock.h"
+#include "decode_pipeline.h"
 #include "ffmpeg_decoder.h"
+#include "presentation_timer.h"
+#include "video_frame_convert.h"
 
 extern "C" {
 #include "SDL2/SDL.h"
@@ -25,37 +33,91 @@ enum SdlPlayerEventType {
   SDL_PALYER_EVENT_STOP,
 };
 
+struct SdlPlayerConfig {
+  // Decoded audio kept ahead of the device; higher rides out longer stalls of the decode side.
+  int audio_latency_ms = 100;
+  SyncMaster sync_master = SyncMaster::kAudio;
+};
+
 class SdlPlayer {
  public:
   struct RefreshData {
     atomic<bool> exit;
     atomic<bool> pause;
-    atomic<uint32_t> delay_ms;
   };
 
  public:
   ~SdlPlayer();
 
-  int Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder);
+  int Init(const string& title, ryoma::FFmpegDecoder* ffmpeg_decoder,
+           const SdlPlayerConfig& config = SdlPlayerConfig());
 
   int Play();
 
  private:
-  static int Refresh(void* data);
+  // Returned by ScheduleVideo when no decoded frame is waiting: nothing is scheduled until the
+  // pipeline queues the next one, and nothing at all after the end of the stream.
+  static constexpr chrono::microseconds kNoRefresh = chrono::microseconds::max();
+  // Left/right and down/up arrow keys.
+  static constexpr double kSeekStepSec = 10.0;
+  static constexpr double kLongSeekStepSec = 60.0;
 
+ private:
+  // Presents or drops decoded frames against the master clock, returns the time until the next
+  // refresh is worth doing, or kNoRefresh.
+  chrono::microseconds ScheduleVideo();
   void RendererFrame(AVFrame* frame);
-
-  void PlayAudioFrame(const vector<uint8_t>& audio_data);
-  static void FillAudio(void* data, Uint8* stream, int len);
+  // (Re)creates the texture when the decoder's format or size changes.
+  int PrepareTexture(AVPixelFormat pixel_format, int width, int height);
+  int UploadFrame(const AVFrame* frame);
+  // NV12/NV21 through SDL_LockTexture, for SDL older than 2.0.16 without SDL_UpdateNVTexture.
+  int UploadNvFrame(const AVFrame* frame);
+  double GetFrameSeconds(const AVFrame* frame, const AVStream* stream) const;
+
+  void SeekBy(double delta_sec, SeekMode mode);
+
+  void StartAudioFeed();
+  // Set before anything that makes PopAudioFrame return false, so FeedAudio does not take it for
+  // the end of the stream and flush the resampler tail.
+  void RequestAudioFeedStop();
+  void StopAudioFeed();
+  void StartAudioDevice();
+  void FeedAudio();
+  void PlayAudioFrame(const AudioSamples& audio_data);
+  static void FillAudio(void* userdata, Uint8* stream, int len);
 
  private:
   shared_ptr<SDL_Window> window_;
   shared_ptr<SDL_Renderer> renderer_;
   shared_ptr<SDL_Texture> texture_;
   SDL_Rect rect_;
+  // Decoder format the texture was made for, and the texture's own format.
+  AVPixelFormat texture_src_pixel_format_ = AV_PIX_FMT_NONE;
+  Uint32 texture_format_ = SDL_PIXELFORMAT_UNKNOWN;
+  // Only set for decoder formats without a matching texture format.
+  unique_ptr<VideoFrameConvert> video_frame_convert_;
 
   SDL_AudioDeviceID audio_dev_;
   SDL_AudioSpec audio_wanted_spec_;
+  SdlPlayerConfig config_;
+  // PCM between the audio thread and FillAudio; the only state the callback touches.
+  unique_ptr<AudioRingBuffer> audio_ring_buffer_;
+  size_t audio_latency_bytes_ = 0;
+  size_t audio_bytes_per_second_ = 0;
+  atomic<bool> is_audio_started_{false};
+  thread audio_thread_;
+  atomic<bool> is_audio_feed_stop_{false};
+  // Stream time just past the last sample written into the ring buffer.
+  atomic<double> audio_write_end_sec_{NAN};
+
+  SyncClock sync_clock_;
+  VideoScheduler video_scheduler_{&sync_clock_};
+  FramePtr pending_video_frame_;
+  // Set while ScheduleVideo waits for the decode thread to queue a frame.
+  atomic<bool> is_video_starved_{false};
+  double video_frame_duration_sec_ = 0;
+  // Pushes SDL_PALYER_EVENT_REFRESH at each frame deadline.
+  unique_ptr<PresentationTimer> presentation_timer_;
 
   static RefreshData refresh_data_;
 
@@ -64,9 +126,7 @@ class SdlPlayer {
   AVPixelFormat video_target_pixel_format_ = AV_PIX_FMT_YUV420P;
 
   ryoma::FFmpegDecoder* ffmpeg_decoder_ = nullptr;
-
-  static atomic<int> audio_len_;
-  static atomic<const Uint8*> audio_data_;
+  shared_ptr<ryoma::DecodePipeline> decode_pipeline_;
 };
 
 }  // namespace ryoma
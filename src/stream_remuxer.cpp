@@ -0,0 +1,294 @@
+#include "stream_remuxer.h"
+
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+namespace {
+
+// Annex B streams start with a start code, MP4/MKV style ones with an avcC/hvcC record.
+bool IsAnnexB(const AVCodecParameters* codecpar) {
+  const uint8_t* data = codecpar->extradata;
+  int size = codecpar->extradata_size;
+  if (data == nullptr || size < 3) {
+    // No out-of-band parameter sets, they are in the stream itself.
+    return true;
+  }
+  return (data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+         (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+}
+
+bool IsFormat(const AVOutputFormat* oformat, const char* name) {
+  return strcmp(oformat->name, name) == 0;
+}
+
+}  // namespace
+
+StreamRemuxer::StreamRemuxer(AVFormatContext* av_ctx, PacketPool* packet_pool)
+    : av_ctx_(av_ctx), packet_pool_(packet_pool), routes_(av_ctx->nb_streams) {}
+
+StreamRemuxer::~StreamRemuxer() {
+  for (auto& output : outputs_) {
+    CloseOutput(*output);
+  }
+}
+
+int StreamRemuxer::AddOutput(const RemuxOutput& remux_output) {
+  const auto& path = remux_output.path;
+  for (int stream_index : remux_output.stream_indexes) {
+    if (stream_index < 0 || stream_index >= static_cast<int>(av_ctx_->nb_streams)) {
+      spdlog::error("output {} asks for stream {}, input has {}", path, stream_index,
+                    av_ctx_->nb_streams);
+      return AVERROR(EINVAL);
+    }
+  }
+
+  AVFormatContext* ctx_ptr = nullptr;
+  int ret = avformat_alloc_output_context2(&ctx_ptr, nullptr, nullptr, path.c_str());
+  if (ret < 0) {
+    spdlog::error("avformat_alloc_output_context2 failed, path {} ret {}", path, ret);
+    return ret;
+  }
+  auto output = make_unique<Output>();
+  output->path = path;
+  // The AVIO context belongs to the writer, only the format context is freed here.
+  output->ctx.reset(ctx_ptr, [](AVFormatContext* ptr) { avformat_free_context(ptr); });
+
+  for (int stream_index : remux_output.stream_indexes) {
+    const auto* in_stream = av_ctx_->streams[stream_index];
+    AVStream* out_stream = avformat_new_stream(output->ctx.get(), nullptr);
+    if (out_stream == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+    OutputStream output_stream;
+    output_stream.time_base = in_stream->time_base;
+    const auto* codecpar = in_stream->codecpar;
+    string bsf_chain = GetBsfChain(in_stream->codecpar, output->ctx->oformat);
+    if (!bsf_chain.empty()) {
+      ret = InitBsf(in_stream, output_stream, bsf_chain);
+      if (ret < 0) {
+        return ret;
+      }
+      codecpar = output_stream.bsf_ctx->par_out;
+      output_stream.time_base = output_stream.bsf_ctx->time_base_out;
+    }
+    ret = avcodec_parameters_copy(out_stream->codecpar, codecpar);
+    if (ret < 0) {
+      spdlog::error("avcodec_parameters_copy failed, ret {}", ret);
+      return ret;
+    }
+    // The tag is container specific, let the muxer pick its own.
+    out_stream->codecpar->codec_tag = 0;
+    // Only a hint, avformat_write_header may pick another time base.
+    out_stream->time_base = output_stream.time_base;
+    output->streams.push_back(output_stream);
+  }
+
+  if (!(output->ctx->oformat->flags & AVFMT_NOFILE)) {
+    output->writer = make_unique<AsyncFileWriter>();
+    ret = output->writer->Open(path);
+    if (ret < 0) {
+      spdlog::error("AsyncFileWriter::Open {} failed, ret {}", path, ret);
+      return ret;
+    }
+    output->avio_ctx = output->writer->CreateAvioCtx();
+    if (output->avio_ctx == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+    output->ctx->pb = output->avio_ctx.get();
+  }
+
+  ret = avformat_write_header(output->ctx.get(), nullptr);
+  if (ret < 0) {
+    spdlog::error("avformat_write_header {} failed, ret {}", path, ret);
+    return ret;
+  }
+  av_dump_format(output->ctx.get(), 0, path.c_str(), 1);
+
+  for (size_t i = 0; i < remux_output.stream_indexes.size(); i++) {
+    Route route;
+    route.output = output.get();
+    route.stream_index = static_cast<int>(i);
+    routes_[remux_output.stream_indexes[i]].push_back(route);
+  }
+  outputs_.push_back(move(output));
+  return 0;
+}
+
+int StreamRemuxer::Run() {
+  // Streams nobody asked for are skipped by the demuxer.
+  vector<AVDiscard> discards(av_ctx_->nb_streams);
+  for (unsigned int i = 0; i < av_ctx_->nb_streams; i++) {
+    discards[i] = av_ctx_->streams[i]->discard;
+    if (routes_[i].empty()) {
+      av_ctx_->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  int first_error = 0;
+  while (true) {
+    auto av_packet = packet_pool_->Acquire();
+    int ret = av_read_frame(av_ctx_, av_packet.get());
+    if (ret < 0) {
+      if (ret != AVERROR_EOF) {
+        spdlog::error("av_read_frame failed, ret {}", ret);
+        first_error = ret;
+      }
+      break;
+    }
+    stats_.read_packet_num++;
+    if (av_packet->stream_index < 0 ||
+        av_packet->stream_index >= static_cast<int>(routes_.size())) {
+      continue;
+    }
+    for (const auto& route : routes_[av_packet->stream_index]) {
+      if (route.output->is_failed) {
+        continue;
+      }
+      ret = WritePacket(*route.output, route.stream_index, av_packet.get());
+      if (ret < 0) {
+        spdlog::error("write to {} failed, ret {}, dropping the output", route.output->path, ret);
+        route.output->is_failed = true;
+        first_error = first_error < 0 ? first_error : ret;
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < av_ctx_->nb_streams; i++) {
+    av_ctx_->streams[i]->discard = discards[i];
+  }
+  for (auto& output : outputs_) {
+    int ret = CloseOutput(*output);
+    first_error = first_error < 0 ? first_error : ret;
+  }
+  spdlog::info("remuxed {} outputs, read {} packets, wrote {} packets {} bytes, disk waits {}",
+               outputs_.size(), stats_.read_packet_num, stats_.written_packet_num,
+               stats_.written_bytes, stats_.block_wait_num);
+  return first_error;
+}
+
+StreamRemuxerStats StreamRemuxer::GetStats() const { return stats_; }
+
+string StreamRemuxer::GetBsfChain(const AVCodecParameters* codecpar,
+                                  const AVOutputFormat* oformat) {
+  // Containers that carry H.264/HEVC as a byte stream with start codes.
+  bool is_annexb_target = IsFormat(oformat, "h264") || IsFormat(oformat, "hevc") ||
+                          IsFormat(oformat, "mpegts");
+  switch (codecpar->codec_id) {
+    case AV_CODEC_ID_H264:
+      return is_annexb_target && !IsAnnexB(codecpar) ? "h264_mp4toannexb" : "";
+    case AV_CODEC_ID_HEVC:
+      return is_annexb_target && !IsAnnexB(codecpar) ? "hevc_mp4toannexb" : "";
+    case AV_CODEC_ID_AAC:
+      // Without an AudioSpecificConfig the input is ADTS, e.g. from MPEG-TS; everything but
+      // the ADTS-based containers wants the header moved out of band.
+      if (codecpar->extradata_size > 0 || IsFormat(oformat, "adts") ||
+          IsFormat(oformat, "mpegts") || IsFormat(oformat, "latm")) {
+        return "";
+      }
+      return "aac_adtstoasc";
+    default:
+      return "";
+  }
+}
+
+int StreamRemuxer::InitBsf(const AVStream* in_stream, OutputStream& output_stream,
+                           const string& bsf_chain) {
+  AVBSFContext* bsf_ctx_ptr = nullptr;
+  int ret = av_bsf_list_parse_str(bsf_chain.c_str(), &bsf_ctx_ptr);
+  if (ret < 0) {
+    spdlog::error("av_bsf_list_parse_str {} failed, ret {}", bsf_chain, ret);
+    return ret;
+  }
+  output_stream.bsf_ctx.reset(bsf_ctx_ptr, [](AVBSFContext* ptr) { av_bsf_free(&ptr); });
+  ret = avcodec_parameters_copy(output_stream.bsf_ctx->par_in, in_stream->codecpar);
+  if (ret < 0) {
+    return ret;
+  }
+  output_stream.bsf_ctx->time_base_in = in_stream->time_base;
+  ret = av_bsf_init(output_stream.bsf_ctx.get());
+  if (ret < 0) {
+    spdlog::error("av_bsf_init {} failed, ret {}", bsf_chain, ret);
+    return ret;
+  }
+  spdlog::info("stream {} goes through {}", in_stream->index, bsf_chain);
+  return 0;
+}
+
+int StreamRemuxer::WritePacket(Output& output, int stream_index, const AVPacket* av_packet) {
+  // A new reference per output, the payload is shared; the filter or the muxer takes it over.
+  auto out_packet = packet_pool_->Acquire();
+  int ret = av_packet_ref(out_packet.get(), av_packet);
+  if (ret < 0) {
+    return ret;
+  }
+  if (output.streams[stream_index].bsf_ctx != nullptr) {
+    return FilterPacket(output, stream_index, out_packet.get());
+  }
+  return MuxPacket(output, stream_index, out_packet.get());
+}
+
+int StreamRemuxer::FilterPacket(Output& output, int stream_index, AVPacket* av_packet) {
+  auto* bsf_ctx = output.streams[stream_index].bsf_ctx.get();
+  int ret = av_bsf_send_packet(bsf_ctx, av_packet);
+  if (ret < 0) {
+    spdlog::error("av_bsf_send_packet failed, ret {}", ret);
+    return ret;
+  }
+  auto filtered_packet = packet_pool_->Acquire();
+  while ((ret = av_bsf_receive_packet(bsf_ctx, filtered_packet.get())) == 0) {
+    ret = MuxPacket(output, stream_index, filtered_packet.get());
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+int StreamRemuxer::MuxPacket(Output& output, int stream_index, AVPacket* av_packet) {
+  const auto* out_stream = output.ctx->streams[stream_index];
+  av_packet_rescale_ts(av_packet, output.streams[stream_index].time_base, out_stream->time_base);
+  av_packet->stream_index = stream_index;
+  av_packet->pos = -1;
+  // Takes the reference over and leaves av_packet blank.
+  int ret = av_interleaved_write_frame(output.ctx.get(), av_packet);
+  if (ret < 0) {
+    return ret;
+  }
+  stats_.written_packet_num++;
+  return 0;
+}
+
+int StreamRemuxer::CloseOutput(Output& output) {
+  if (output.ctx == nullptr) {
+    return 0;
+  }
+  // Filters may still hold packets, e.g. a reordering one.
+  for (size_t i = 0; i < output.streams.size(); i++) {
+    if (output.streams[i].bsf_ctx != nullptr && !output.is_failed &&
+        FilterPacket(output, static_cast<int>(i), nullptr) < 0) {
+      output.is_failed = true;
+    }
+  }
+  int ret = av_write_trailer(output.ctx.get());
+  if (ret < 0) {
+    spdlog::error("av_write_trailer {} failed, ret {}", output.path, ret);
+  }
+  output.ctx.reset();
+  output.avio_ctx.reset();
+  if (output.writer != nullptr) {
+    int ret_close = output.writer->Close();
+    if (ret_close < 0) {
+      spdlog::error("AsyncFileWriter::Close {} failed, ret {}", output.path, ret_close);
+      ret = ret < 0 ? ret : ret_close;
+    }
+    auto writer_stats = output.writer->GetStats();
+    stats_.written_bytes += writer_stats.written_bytes;
+    stats_.block_wait_num += writer_stats.block_wait_num;
+  }
+  return ret;
+}
+
+}  // namespace ryoma
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async_file_writer.h"
+#include "packet_pool.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+struct RemuxOutput {
+  string path;  // the container is guessed from the extension
+  vector<int> stream_indexes;  // input streams, in output order
+};
+
+struct StreamRemuxerStats {
+  uint64_t read_packet_num = 0;
+  uint64_t written_packet_num = 0;
+  uint64_t written_bytes = 0;
+  // Times an output waited for its disk, summed over the outputs.
+  uint64_t block_wait_num = 0;
+};
+
+// Copies any subset of the input streams into any number of outputs in a single read of the
+// input. Each output goes through an AsyncFileWriter, so muxing overlaps with the disk writes.
+// Timestamps are rescaled to whatever time base the muxer picked, and streams whose bitstream
+// format the target container does not take go through the matching filters, e.g. H.264 from
+// MP4/MKV into a raw .h264 file is converted to Annex B.
+class StreamRemuxer {
+ public:
+  StreamRemuxer(AVFormatContext* av_ctx, PacketPool* packet_pool);
+  ~StreamRemuxer();
+
+  StreamRemuxer(const StreamRemuxer&) = delete;
+  StreamRemuxer& operator=(const StreamRemuxer&) = delete;
+
+  // Opens the file and writes the header.
+  int AddOutput(const RemuxOutput& remux_output);
+  // Reads from the current position of the input to its end. An output that fails is dropped,
+  // the others go on; returns the first error.
+  int Run();
+
+  StreamRemuxerStats GetStats() const;
+
+ private:
+  // Declaration order is teardown order reversed: the format context goes first, its AVIO
+  // context flushes into the writer, then the writer finishes.
+  struct OutputStream {
+    // Time base of the packets that reach the muxer, the filter's output if there is one.
+    AVRational time_base = AVRational{0, 1};
+    shared_ptr<AVBSFContext> bsf_ctx;
+  };
+
+  struct Output {
+    string path;
+    unique_ptr<AsyncFileWriter> writer;
+    shared_ptr<AVIOContext> avio_ctx;
+    shared_ptr<AVFormatContext> ctx;
+    vector<OutputStream> streams;
+    bool is_failed = false;
+  };
+
+  struct Route {
+    Output* output = nullptr;
+    int stream_index = 0;
+  };
+
+  // Comma separated filter chain for av_bsf_list_parse_str, empty when none is needed.
+  static string GetBsfChain(const AVCodecParameters* codecpar, const AVOutputFormat* oformat);
+  int InitBsf(const AVStream* in_stream, OutputStream& output_stream, const string& bsf_chain);
+
+  int WritePacket(Output& output, int stream_index, const AVPacket* av_packet);
+  // Drains the filter; av_packet nullptr flushes it at the end of the input.
+  int FilterPacket(Output& output, int stream_index, AVPacket* av_packet);
+  int MuxPacket(Output& output, int stream_index, AVPacket* av_packet);
+  int CloseOutput(Output& output);
+
+ private:
+  AVFormatContext* av_ctx_ = nullptr;
+  PacketPool* packet_pool_ = nullptr;
+
+  vector<unique_ptr<Output>> outputs_;
+  // By input stream index.
+  vector<vector<Route>> routes_;
+
+  StreamRemuxerStats stats_;
+};
+
+}  // namespace ryoma
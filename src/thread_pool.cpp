@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace ryoma {
+
+ThreadPool::ThreadPool(int thread_num) {
+  for (int i = 0; i < thread_num; i++) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    is_stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Submit(function<void()> task) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    tasks_.push_back(move(task));
+  }
+  cond_.notify_one();
+}
+
+void ThreadPool::ParallelFor(int task_num, const function<void(int)>& task) {
+  if (task_num <= 0) {
+    return;
+  }
+  // Helpers may be scheduled after the last index is taken, so the shared state outlives this
+  // call; the caller only waits for the tasks themselves.
+  struct State {
+    function<void(int)> task;
+    int task_num = 0;
+    atomic<int> next_index{0};
+    int done_num = 0;
+    mutex done_mutex;
+    condition_variable done_cond;
+  };
+  auto state = make_shared<State>();
+  state->task = task;
+  state->task_num = task_num;
+  auto run = [](const shared_ptr<State>& state) {
+    int index = 0;
+    int done_num = 0;
+    while ((index = state->next_index.fetch_add(1)) < state->task_num) {
+      state->task(index);
+      done_num++;
+    }
+    if (done_num > 0) {
+      lock_guard<mutex> lock(state->done_mutex);
+      state->done_num += done_num;
+      if (state->done_num == state->task_num) {
+        state->done_cond.notify_all();
+      }
+    }
+  };
+
+  int helper_num = min<int>(task_num - 1, static_cast<int>(workers_.size()));
+  for (int i = 0; i < helper_num; i++) {
+    Submit([state, run] { run(state); });
+  }
+  run(state);
+
+  unique_lock<mutex> lock(state->done_mutex);
+  state->done_cond.wait(lock, [&] { return state->done_num == state->task_num; });
+}
+
+int ThreadPool::GetThreadNum() const { return static_cast<int>(workers_.size()); }
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return is_stop_ || !tasks_.empty(); });
+      if (is_stop_ && tasks_.empty()) {
+        return;
+      }
+      task = move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace ryoma
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace ryoma {
+
+// Fixed set of worker threads that live as long as the pool, so per-call work does not pay for
+// thread creation.
+class ThreadPool {
+ public:
+  explicit ThreadPool(int thread_num);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void Submit(function<void()> task);
+
+  // Runs task(0) ... task(task_num - 1) on the workers and the calling thread, returns once all
+  // of them are done.
+  void ParallelFor(int task_num, const function<void(int)>& task);
+
+  int GetThreadNum() const;
+
+ private:
+  void WorkerLoop();
+
+ private:
+  mutex mutex_;
+  condition_variable cond_;
+  deque<function<void()>> tasks_;
+  bool is_stop_ = false;
+
+  vector<thread> workers_;
+};
+
+}  // namespace ryoma
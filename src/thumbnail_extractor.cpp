@@ -0,0 +1,215 @@
+#include "thumbnail_extractor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ffmpeg_decoder.h"
+#include "fmt/format.h"
+#include "spdlog/spdlog.h"
+
+namespace ryoma {
+
+ThumbnailExtractor::ThumbnailExtractor(FFmpegDecoder* ffmpeg_decoder)
+    : ffmpeg_decoder_(ffmpeg_decoder) {}
+
+int ThumbnailExtractor::Extract(const string& target_dir, const ThumbnailOptions& options) {
+  av_ctx_ = ffmpeg_decoder_->GetFormatCtx();
+  video_stream_ = ffmpeg_decoder_->GetVideoStream();
+  video_codec_ctx_ = ffmpeg_decoder_->GetVideoCodecCtx();
+  is_eof_ = false;
+  last_pts_ = SecondsToPts(0);
+  saved_frame_num_ = 0;
+
+  thumbnail_writer_ = make_unique<ThumbnailWriter>(options.writer_options);
+  int ret = thumbnail_writer_->Start();
+  if (ret < 0) {
+    spdlog::error("ThumbnailWriter::Start failed, ret {}", ret);
+    return ret;
+  }
+  switch (options.mode) {
+    case ThumbnailMode::kFrameStep:
+      ret = ExtractFrameStep(target_dir, options);
+      break;
+    case ThumbnailMode::kKeyframes:
+      ret = ExtractKeyframes(target_dir, options);
+      break;
+    case ThumbnailMode::kInterval: {
+      double duration_sec = av_ctx_->duration > 0
+                                ? static_cast<double>(av_ctx_->duration) / AV_TIME_BASE
+                                : video_stream_->duration * av_q2d(video_stream_->time_base);
+      if (duration_sec <= 0 || options.interval_sec <= 0) {
+        spdlog::error("interval mode needs a known duration, duration {} interval {}",
+                      duration_sec, options.interval_sec);
+        ret = AVERROR(EINVAL);
+        break;
+      }
+      vector<double> timestamps_sec;
+      for (double t = 0; t < duration_sec; t += options.interval_sec) {
+        timestamps_sec.push_back(t);
+      }
+      ret = ExtractTimestamps(target_dir, options, move(timestamps_sec));
+      break;
+    }
+    case ThumbnailMode::kTimestamps:
+      ret = ExtractTimestamps(target_dir, options, options.timestamps_sec);
+      break;
+  }
+  video_codec_ctx_->skip_frame = AVDISCARD_DEFAULT;
+
+  thumbnail_writer_->Finish();
+  saved_frame_num_ = thumbnail_writer_->GetWrittenNum();
+  auto queue_stats = thumbnail_writer_->GetQueueStats();
+  spdlog::info("saved {} thumbnails, {} failed, decoded {} frames, encode stalled decode {} times",
+               saved_frame_num_, thumbnail_writer_->GetFailedNum(),
+               ffmpeg_decoder_->GetVideoFrameDecoder()->GetDecodedFrameNum(),
+               queue_stats.push_stall_num);
+  thumbnail_writer_.reset();
+  return ret;
+}
+
+size_t ThumbnailExtractor::GetSavedFrameNum() const { return saved_frame_num_; }
+
+int ThumbnailExtractor::ExtractFrameStep(const string& target_dir,
+                                         const ThumbnailOptions& options) {
+  size_t frame_step = max<size_t>(options.frame_step, 1);
+  size_t frame_index = 0;
+  int ret = DecodeUntil([&](AVFrame* frame) {
+    if (frame_index % frame_step == 0) {
+      SaveFrame(fmt::format("{}/demo_{}.jpg", target_dir, frame_index), frame);
+    }
+    frame_index++;
+    return 0;
+  });
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int ThumbnailExtractor::ExtractKeyframes(const string& target_dir,
+                                         const ThumbnailOptions& options) {
+  // Non-key packets are not even sent to the decoder, see DecodeUntil.
+  video_codec_ctx_->skip_frame = AVDISCARD_NONKEY;
+  int ret = DecodeUntil([&](AVFrame* frame) {
+    int64_t pts_ms = av_rescale_q(frame->best_effort_timestamp, video_stream_->time_base,
+                                  AVRational{1, 1000});
+    SaveFrame(fmt::format("{}/demo_{}ms.jpg", target_dir, pts_ms), frame);
+    return 0;
+  });
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+int ThumbnailExtractor::ExtractTimestamps(const string& target_dir,
+                                          const ThumbnailOptions& options,
+                                          vector<double> timestamps_sec) {
+  sort(timestamps_sec.begin(), timestamps_sec.end());
+  timestamps_sec.erase(unique(timestamps_sec.begin(), timestamps_sec.end()),
+                       timestamps_sec.end());
+  int64_t seek_threshold = av_rescale_q(llround(kSeekThresholdSec * AV_TIME_BASE),
+                                        AVRational{1, AV_TIME_BASE}, video_stream_->time_base);
+  if (options.keyframe_only) {
+    video_codec_ctx_->skip_frame = AVDISCARD_NONKEY;
+  }
+
+  // Some thumbnails beat none: only a run that produced nothing fails, with its first error.
+  int first_error = 0;
+  size_t submitted_num = 0;
+  auto record_error = [&](int ret) {
+    if (first_error == 0) {
+      first_error = ret;
+    }
+  };
+  for (double timestamp_sec : timestamps_sec) {
+    int64_t target_pts = SecondsToPts(timestamp_sec);
+    // A keyframe-only thumbnail is whatever the seek lands on. Otherwise seeking only pays off
+    // when the target is further away than decoding up to it.
+    bool need_seek = options.keyframe_only || target_pts < last_pts_ ||
+                     target_pts - last_pts_ > seek_threshold;
+    if (need_seek) {
+      int ret = SeekTo(target_pts);
+      if (ret < 0) {
+        record_error(ret);
+        continue;
+      }
+    }
+
+    string image_path =
+        fmt::format("{}/demo_{}ms.jpg", target_dir, llround(timestamp_sec * 1000));
+    int ret = DecodeUntil([&](AVFrame* frame) {
+      // Without a timestamp there is no telling how far off the target is, take the frame.
+      if (!options.keyframe_only && frame->best_effort_timestamp != AV_NOPTS_VALUE &&
+          frame->best_effort_timestamp < target_pts) {
+        return 0;
+      }
+      int save_ret = SaveFrame(image_path, frame);
+      if (save_ret < 0) {
+        record_error(save_ret);
+      } else {
+        submitted_num++;
+      }
+      return AVERROR_EXIT;
+    });
+    if (ret == AVERROR_EOF) {
+      record_error(ret);
+      break;
+    }
+  }
+  return submitted_num == 0 ? first_error : 0;
+}
+
+int ThumbnailExtractor::DecodeUntil(const function<int(AVFrame*)>& on_frame) {
+  auto* frame_decoder = ffmpeg_decoder_->GetVideoFrameDecoder();
+  auto* packet_pool = ffmpeg_decoder_->GetPacketPool();
+  auto track_frame = [&](AVFrame* frame) {
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+      last_pts_ = frame->best_effort_timestamp;
+    }
+    return on_frame(frame);
+  };
+
+  while (!is_eof_) {
+    auto av_packet = packet_pool->Acquire();
+    if (av_read_frame(av_ctx_, av_packet.get()) < 0) {
+      is_eof_ = true;
+      break;
+    }
+    if (av_packet->stream_index != video_stream_->index) {
+      continue;
+    }
+    if (video_codec_ctx_->skip_frame >= AVDISCARD_NONKEY &&
+        !(av_packet->flags & AV_PKT_FLAG_KEY)) {
+      continue;
+    }
+    if (frame_decoder->Decode(av_packet.get(), track_frame) == AVERROR_EXIT) {
+      return 0;
+    }
+  }
+  // Frames still held by the decoder come out on the flush.
+  return frame_decoder->Flush(track_frame) == AVERROR_EXIT ? 0 : AVERROR_EOF;
+}
+
+int ThumbnailExtractor::SeekTo(int64_t target_pts) {
+  int ret = avformat_seek_file(av_ctx_, video_stream_->index, INT64_MIN, target_pts, target_pts,
+                               0);
+  if (ret < 0) {
+    spdlog::error("avformat_seek_file {} failed, ret {}", target_pts, ret);
+    return ret;
+  }
+  ffmpeg_decoder_->GetVideoFrameDecoder()->Reset();
+  is_eof_ = false;
+  last_pts_ = target_pts;
+  return 0;
+}
+
+int ThumbnailExtractor::SaveFrame(const string& image_path, AVFrame* frame) {
+  int ret = thumbnail_writer_->Submit(image_path, frame);
+  if (ret < 0) {
+    spdlog::error("ThumbnailWriter::Submit {} failed, ret {}", image_path, ret);
+  }
+  return ret;
+}
+
+int64_t ThumbnailExtractor::SecondsToPts(double seconds) const {
+  int64_t start_pts = video_stream_->start_time == AV_NOPTS_VALUE ? 0 : video_stream_->start_time;
+  return start_pts + av_rescale_q(llround(seconds * AV_TIME_BASE), AVRational{1, AV_TIME_BASE},
+                                  video_stream_->time_base);
+}
+
+}  // namespace ryoma
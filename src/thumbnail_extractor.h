@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thumbnail_writer.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+class FFmpegDecoder;
+
+enum class ThumbnailMode {
+  kFrameStep,   // every frame_step-th decoded frame
+  kInterval,    // one frame every interval_sec
+  kTimestamps,  // one frame per entry of timestamps_sec
+  kKeyframes,   // every keyframe, nothing else is decoded
+};
+
+struct ThumbnailOptions {
+  ThumbnailMode mode = ThumbnailMode::kFrameStep;
+  size_t frame_step = 100;
+  double interval_sec = 10.0;
+  vector<double> timestamps_sec;
+  // kInterval/kTimestamps: take the keyframe at or before each time instead of decoding up to
+  // the exact frame.
+  bool keyframe_only = false;
+  // Encoder, quality, downscale and encode threads of the JPEG stage.
+  ThumbnailWriterOptions writer_options;
+};
+
+// Writes JPEG thumbnails of the decoder's video stream. Time based modes seek to each target
+// instead of decoding the whole file. Selected frames go to a ThumbnailWriter, so decoding keeps
+// running while earlier thumbnails are converted and compressed.
+class ThumbnailExtractor {
+ public:
+  explicit ThumbnailExtractor(FFmpegDecoder* ffmpeg_decoder);
+
+  int Extract(const string& target_dir, const ThumbnailOptions& options);
+
+  size_t GetSavedFrameNum() const;
+
+ private:
+  int ExtractFrameStep(const string& target_dir, const ThumbnailOptions& options);
+  int ExtractKeyframes(const string& target_dir, const ThumbnailOptions& options);
+  int ExtractTimestamps(const string& target_dir, const ThumbnailOptions& options,
+                        vector<double> timestamps_sec);
+
+  // Decodes forward until on_frame returns AVERROR_EXIT or the stream ends.
+  int DecodeUntil(const function<int(AVFrame*)>& on_frame);
+  int SeekTo(int64_t target_pts);
+
+  int SaveFrame(const string& image_path, AVFrame* frame);
+
+  int64_t SecondsToPts(double seconds) const;
+
+ private:
+  // Targets closer than this to the decode position are reached by decoding forward.
+  static constexpr double kSeekThresholdSec = 5.0;
+
+  FFmpegDecoder* ffmpeg_decoder_ = nullptr;
+  AVFormatContext* av_ctx_ = nullptr;
+  AVStream* video_stream_ = nullptr;
+  AVCodecContext* video_codec_ctx_ = nullptr;
+  unique_ptr<ThumbnailWriter> thumbnail_writer_;
+
+  bool is_eof_ = false;
+  int64_t last_pts_ = AV_NOPTS_VALUE;
+  size_t saved_frame_num_ = 0;
+};
+
+}  // namespace ryoma
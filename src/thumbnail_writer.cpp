@@ -0,0 +1,201 @@
+#include "thumbnail_writer.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "spdlog/spdlog.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+namespace ryoma {
+
+ThumbnailWriter::ThumbnailWriter(const ThumbnailWriterOptions& options)
+    : options_(options), job_queue_(max<size_t>(options.queue_size, 1)) {
+  options_.quality = clamp(options_.quality, 1, 100);
+  if (options_.worker_num <= 0) {
+    options_.worker_num = max<int>(1, std::thread::hardware_concurrency() / 2);
+  }
+}
+
+ThumbnailWriter::~ThumbnailWriter() { Finish(); }
+
+int ThumbnailWriter::Start() {
+  if (!workers_.empty()) {
+    return 0;
+  }
+  if (options_.encoder == JpegEncoder::kMjpeg &&
+      avcodec_find_encoder(AV_CODEC_ID_MJPEG) == nullptr) {
+    spdlog::error("mjpeg encoder not available");
+    return AVERROR_ENCODER_NOT_FOUND;
+  }
+  job_queue_.Reset();
+  written_num_ = 0;
+  failed_num_ = 0;
+  for (int i = 0; i < options_.worker_num; i++) {
+    workers_.emplace_back(&ThumbnailWriter::WorkerLoop, this);
+  }
+  return 0;
+}
+
+int ThumbnailWriter::Submit(const string& image_path, const AVFrame* frame) {
+  // A new reference, the pixels are not copied; the decoder's pool hands out other buffers
+  // until the worker drops it.
+  shared_ptr<AVFrame> frame_ref(av_frame_clone(frame), [](AVFrame* ptr) { av_frame_free(&ptr); });
+  if (frame_ref == nullptr) {
+    return AVERROR(ENOMEM);
+  }
+  if (!job_queue_.Push(Job{image_path, move(frame_ref)})) {
+    return AVERROR_EXIT;
+  }
+  return 0;
+}
+
+void ThumbnailWriter::Finish() {
+  job_queue_.Close();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+uint64_t ThumbnailWriter::GetWrittenNum() const { return written_num_; }
+
+uint64_t ThumbnailWriter::GetFailedNum() const { return failed_num_; }
+
+QueueStats ThumbnailWriter::GetQueueStats() const { return job_queue_.GetStats(); }
+
+void ThumbnailWriter::WorkerLoop() {
+  Worker worker;
+  Job job;
+  while (job_queue_.Pop(job)) {
+    if (Encode(worker, job) < 0) {
+      failed_num_++;
+    } else {
+      written_num_++;
+    }
+    job = Job();
+  }
+}
+
+int ThumbnailWriter::Encode(Worker& worker, const Job& job) {
+  if (options_.encoder == JpegEncoder::kMjpeg) {
+    return EncodeMjpeg(worker, job.frame.get(), job.image_path);
+  }
+  return EncodeStb(worker, job.frame.get(), job.image_path);
+}
+
+VideoFrameConvert* ThumbnailWriter::GetFrameConvert(Worker& worker, const AVFrame* frame,
+                                                    AVPixelFormat target_pixel_format) {
+  auto& video_frame_convert = worker.video_frame_convert;
+  if (video_frame_convert == nullptr || video_frame_convert->GetSrcWidth() != frame->width ||
+      video_frame_convert->GetSrcHeight() != frame->height ||
+      video_frame_convert->GetSrcPixelFormat() != frame->format) {
+    VideoFrameConvertConfig config;
+    GetTargetSize(frame->width, frame->height, config.target_width, config.target_height);
+    config.preset = options_.scale_preset;
+    // Each worker already takes its own image.
+    config.thread_num = 1;
+    video_frame_convert = make_unique<VideoFrameConvert>(
+        frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+        target_pixel_format, config);
+  }
+  return video_frame_convert.get();
+}
+
+int ThumbnailWriter::EncodeStb(Worker& worker, AVFrame* frame, const string& image_path) {
+  auto* video_frame_convert = GetFrameConvert(worker, frame, AV_PIX_FMT_RGB24);
+  // stbi_write_jpg takes no stride, so RGB rows have to be packed.
+  const auto& rgb_pixel = video_frame_convert->ConvertToBytes(frame);
+  int ret = stbi_write_jpg(image_path.c_str(), video_frame_convert->GetTargetWidth(),
+                           video_frame_convert->GetTargetHeight(), 3, rgb_pixel.data(),
+                           options_.quality);
+  if (ret == 0) {
+    spdlog::error("stbi_write_jpg {} failed", image_path);
+    return -1;
+  }
+  return 0;
+}
+
+int ThumbnailWriter::EncodeMjpeg(Worker& worker, AVFrame* src, const string& image_path) {
+  // Full range 4:2:0 is what the mjpeg encoder takes without lowering strictness.
+  auto* frame = GetFrameConvert(worker, src, AV_PIX_FMT_YUVJ420P)->Convert(src);
+  auto& codec_ctx = worker.mjpeg_ctx;
+  // Map quality 1 - 100 onto the mjpeg qscale 31 - 2.
+  int qscale = 31 - (options_.quality - 1) * 29 / 99;
+
+  if (codec_ctx == nullptr || codec_ctx->width != frame->width ||
+      codec_ctx->height != frame->height) {
+    const auto* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    codec_ctx.reset(avcodec_alloc_context3(codec),
+                    [](AVCodecContext* ptr) { avcodec_free_context(&ptr); });
+    if (codec_ctx == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+    codec_ctx->width = frame->width;
+    codec_ctx->height = frame->height;
+    codec_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    codec_ctx->time_base = AVRational{1, 25};
+    codec_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+    codec_ctx->global_quality = qscale * FF_QP2LAMBDA;
+    // Parallelism comes from the workers, one image each.
+    codec_ctx->thread_count = 1;
+    int ret = avcodec_open2(codec_ctx.get(), codec, nullptr);
+    if (ret < 0) {
+      spdlog::error("avcodec_open2 mjpeg failed, ret {}", ret);
+      codec_ctx.reset();
+      return ret;
+    }
+  }
+  if (worker.packet == nullptr) {
+    worker.packet.reset(av_packet_alloc(), [](AVPacket* ptr) { av_packet_free(&ptr); });
+    if (worker.packet == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  frame->pts = 0;
+  frame->quality = codec_ctx->global_quality;
+  int ret = avcodec_send_frame(codec_ctx.get(), frame);
+  if (ret < 0) {
+    spdlog::error("avcodec_send_frame mjpeg failed, ret {}", ret);
+    return ret;
+  }
+  ret = avcodec_receive_packet(codec_ctx.get(), worker.packet.get());
+  if (ret < 0) {
+    spdlog::error("avcodec_receive_packet mjpeg failed, ret {}", ret);
+    return ret;
+  }
+
+  ofstream image_file(image_path, ios::binary);
+  image_file.write(reinterpret_cast<const char*>(worker.packet->data), worker.packet->size);
+  av_packet_unref(worker.packet.get());
+  if (!image_file) {
+    spdlog::error("write {} failed", image_path);
+    return AVERROR(EIO);
+  }
+  return 0;
+}
+
+void ThumbnailWriter::GetTargetSize(int width, int height, int& target_width,
+                                    int& target_height) const {
+  double scale = 1.0;
+  if (options_.max_width > 0 && width > options_.max_width) {
+    scale = min(scale, static_cast<double>(options_.max_width) / width);
+  }
+  if (options_.max_height > 0 && height > options_.max_height) {
+    scale = min(scale, static_cast<double>(options_.max_height) / height);
+  }
+  if (scale >= 1.0) {
+    target_width = width;
+    target_height = height;
+    return;
+  }
+  // Even sizes keep 4:2:0 chroma exact.
+  target_width = max(2, static_cast<int>(width * scale) & ~1);
+  target_height = max(2, static_cast<int>(height * scale) & ~1);
+}
+
+}  // namespace ryoma
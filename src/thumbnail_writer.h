@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "video_frame_convert.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+using namespace std;
+
+namespace ryoma {
+
+enum class JpegEncoder {
+  kStb,    // stbi_write_jpg on RGB24
+  kMjpeg,  // libavcodec's mjpeg encoder on YUVJ420P
+};
+
+struct ThumbnailWriterOptions {
+  JpegEncoder encoder = JpegEncoder::kStb;
+  int quality = 80;  // 1 - 100
+  // Downscale to fit inside max_width x max_height, keeping the aspect ratio; 0 keeps the size.
+  int max_width = 0;
+  int max_height = 0;
+  ScalePreset scale_preset = ScalePreset::kBilinear;
+  int worker_num = 0;  // 0: half of the cores
+  size_t queue_size = 16;
+};
+
+// Encode stage for frame dumps. Submit only queues a reference to the decoded frame; scaling,
+// color conversion, JPEG compression and the file write all happen on the worker threads, so
+// decoding and encoding overlap. A full queue blocks Submit, which bounds memory.
+class ThumbnailWriter {
+ public:
+  explicit ThumbnailWriter(const ThumbnailWriterOptions& options = ThumbnailWriterOptions());
+  ~ThumbnailWriter();
+
+  int Start();
+  int Submit(const string& image_path, const AVFrame* frame);
+  // Waits until every queued job is written and stops the workers.
+  void Finish();
+
+  uint64_t GetWrittenNum() const;
+  uint64_t GetFailedNum() const;
+  QueueStats GetQueueStats() const;
+
+ private:
+  struct Job {
+    string image_path;
+    shared_ptr<AVFrame> frame;
+  };
+
+  // Per worker scratch, reused across jobs.
+  struct Worker {
+    unique_ptr<VideoFrameConvert> video_frame_convert;
+    shared_ptr<AVCodecContext> mjpeg_ctx;
+    shared_ptr<AVPacket> packet;
+  };
+
+  void WorkerLoop();
+  int Encode(Worker& worker, const Job& job);
+  VideoFrameConvert* GetFrameConvert(Worker& worker, const AVFrame* frame,
+                                     AVPixelFormat target_pixel_format);
+  int EncodeStb(Worker& worker, AVFrame* frame, const string& image_path);
+  int EncodeMjpeg(Worker& worker, AVFrame* src, const string& image_path);
+
+  void GetTargetSize(int width, int height, int& target_width, int& target_height) const;
+
+ private:
+  ThumbnailWriterOptions options_;
+
+  BoundedQueue<Job> job_queue_;
+  vector<thread> workers_;
+
+  atomic<uint64_t> written_num_{0};
+  atomic<uint64_t> failed_num_{0};
+};
+
+}  // namespace ryoma
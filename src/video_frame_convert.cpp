@@ -1,40 +1,294 @@
 #include "video_frame_convert.h"
 
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
 extern "C" {
 #include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
 }
 
 namespace ryoma {
 
+namespace {
+
+// Moves the plane pointers of a picture down to row y.
+void OffsetPlanes(const AVPixFmtDescriptor* desc, int plane_num, int y, const int linesize[4],
+                  uint8_t* data[4]) {
+  for (int plane = 0; plane < plane_num; plane++) {
+    bool is_chroma = plane == 1 || plane == 2;
+    int row = is_chroma ? y >> desc->log2_chroma_h : y;
+    data[plane] += static_cast<ptrdiff_t>(row) * linesize[plane];
+  }
+}
+
+bool IsPlanarYuvOrGray(AVPixelFormat pixel_format) {
+  const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixel_format);
+  if (desc == nullptr || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR)) {
+    return false;
+  }
+  if (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_FLOAT | AV_PIX_FMT_FLAG_HWACCEL)) {
+    return false;
+  }
+  // Semi-planar formats (nv12, p010, ...) keep both chroma components in one plane.
+  return desc->nb_components < 3 || av_pix_fmt_count_planes(pixel_format) >= 3;
+}
+
+// True when swscale converts src to dst of the same size with one of its unscaled converters,
+// which only read the rows they write. Any other pair runs the vertical scaler, which filters
+// across rows and would treat every slice edge as a picture edge.
+bool HasRowLocalConverter(AVPixelFormat src, AVPixelFormat dst) {
+  if (src == dst) {
+    return true;
+  }
+  // Plane copy with a bit depth change, as long as the chroma subsampling matches.
+  if (IsPlanarYuvOrGray(src) && IsPlanarYuvOrGray(dst)) {
+    const AVPixFmtDescriptor* src_desc = av_pix_fmt_desc_get(src);
+    const AVPixFmtDescriptor* dst_desc = av_pix_fmt_desc_get(dst);
+    bool is_gray = src_desc->nb_components < 3 || dst_desc->nb_components < 3;
+    return is_gray || (src_desc->log2_chroma_w == dst_desc->log2_chroma_w &&
+                       src_desc->log2_chroma_h == dst_desc->log2_chroma_h);
+  }
+  // Dedicated interleave and deinterleave converters.
+  switch (src) {
+    case AV_PIX_FMT_YUV420P:
+      return dst == AV_PIX_FMT_NV12 || dst == AV_PIX_FMT_NV21 || dst == AV_PIX_FMT_YUYV422 ||
+             dst == AV_PIX_FMT_UYVY422;
+    case AV_PIX_FMT_YUV422P:
+      return dst == AV_PIX_FMT_YUYV422 || dst == AV_PIX_FMT_UYVY422;
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+      return dst == AV_PIX_FMT_YUV420P;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
 VideoFrameConvert::VideoFrameConvert(const AVCodecContext* video_codec_ctx,
-                                     AVPixelFormat target_pixel_format)
-    : video_codec_ctx_(video_codec_ctx), target_pixel_format_(target_pixel_format) {
+                                     AVPixelFormat target_pixel_format,
+                                     const VideoFrameConvertConfig& config)
+    : VideoFrameConvert(video_codec_ctx->width, video_codec_ctx->height,
+                        video_codec_ctx->pix_fmt, target_pixel_format, config) {}
+
+VideoFrameConvert::VideoFrameConvert(int width, int height, AVPixelFormat pixel_format,
+                                     AVPixelFormat target_pixel_format,
+                                     const VideoFrameConvertConfig& config)
+    : width_(width),
+      height_(height),
+      pixel_format_(pixel_format),
+      target_width_(config.target_width > 0 ? config.target_width : width),
+      target_height_(config.target_height > 0 ? config.target_height : height),
+      target_pixel_format_(target_pixel_format),
+      config_(config) {
   Init();
 }
 
-void VideoFrameConvert::Init() {
-  sws_ctx_ =
-      sws_getContext(video_codec_ctx_->width, video_codec_ctx_->height, video_codec_ctx_->pix_fmt,
-                     video_codec_ctx_->width, video_codec_ctx_->height, target_pixel_format_,
-                     SWS_BICUBIC, nullptr, nullptr, nullptr);
+VideoFrameConvert::~VideoFrameConvert() {
+  // Workers may still reference the slice contexts.
+  thread_pool_.reset();
+  for (auto* slice_sws_ctx : slice_sws_ctxs_) {
+    sws_freeContext(slice_sws_ctx);
+  }
+  sws_freeContext(sws_ctx_);
+}
 
-  int video_target_pixel_size = av_image_get_buffer_size(
-      target_pixel_format_, video_codec_ctx_->width, video_codec_ctx_->height, 1);
+void VideoFrameConvert::Init() {
+  int video_target_pixel_size =
+      av_image_get_buffer_size(target_pixel_format_, target_width_, target_height_, 1);
   target_frame_buff_.resize(video_target_pixel_size);
   target_frame_.reset(av_frame_alloc(), [](AVFrame*& ptr) { av_frame_free(&ptr); });
   av_image_fill_arrays(target_frame_->data, target_frame_->linesize, target_frame_buff_.data(),
-                       target_pixel_format_, video_codec_ctx_->width, video_codec_ctx_->height, 1);
+                       target_pixel_format_, target_width_, target_height_, 1);
+  target_frame_->width = target_width_;
+  target_frame_->height = target_height_;
+  target_frame_->format = target_pixel_format_;
+
+  if (config_.passthrough && pixel_format_ == target_pixel_format_ && width_ == target_width_ &&
+      height_ == target_height_) {
+    // Every frame is expected to pass through, swscale is only set up on demand.
+    return;
+  }
+
+  if (config_.thread_num > 1) {
+    bool is_same_size = width_ == target_width_ && height_ == target_height_;
+    bool is_sliceable = config_.threading == ConvertThreading::kSliced && is_same_size &&
+                        HasRowLocalConverter(pixel_format_, target_pixel_format_);
+    bool is_threaded = is_sliceable ? InitSlices() : InitNativeThreading();
+    if (is_threaded) {
+      return;
+    }
+    spdlog::warn("threaded conversion unavailable, converting on the caller's thread");
+  }
+  sws_ctx_ = sws_getContext(width_, height_, pixel_format_, target_width_, target_height_,
+                            target_pixel_format_, GetSwsFlags(), nullptr, nullptr, nullptr);
+}
+
+bool VideoFrameConvert::InitNativeThreading() {
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+  sws_ctx_ = sws_alloc_context();
+  if (sws_ctx_ == nullptr) {
+    return false;
+  }
+  av_opt_set_int(sws_ctx_, "srcw", width_, 0);
+  av_opt_set_int(sws_ctx_, "srch", height_, 0);
+  av_opt_set_int(sws_ctx_, "src_format", pixel_format_, 0);
+  av_opt_set_int(sws_ctx_, "dstw", target_width_, 0);
+  av_opt_set_int(sws_ctx_, "dsth", target_height_, 0);
+  av_opt_set_int(sws_ctx_, "dst_format", target_pixel_format_, 0);
+  av_opt_set_int(sws_ctx_, "sws_flags", GetSwsFlags(), 0);
+  av_opt_set_int(sws_ctx_, "threads", config_.thread_num, 0);
+  if (sws_init_context(sws_ctx_, nullptr, nullptr) < 0) {
+    sws_freeContext(sws_ctx_);
+    sws_ctx_ = nullptr;
+    return false;
+  }
+  // sws_scale_frame only writes into the frame when it already has a buffer; wrap ours without
+  // handing over ownership.
+  target_frame_->buf[0] =
+      av_buffer_create(target_frame_buff_.data(), static_cast<int>(target_frame_buff_.size()),
+                       [](void*, uint8_t*) {}, nullptr, 0);
+  if (target_frame_->buf[0] == nullptr) {
+    sws_freeContext(sws_ctx_);
+    sws_ctx_ = nullptr;
+    return false;
+  }
+  is_native_threading_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool VideoFrameConvert::InitSlices() {
+  // Only reached for pairs HasRowLocalConverter accepts, so independent slices give the same
+  // picture as one full frame pass.
+  int height = height_;
+  int slice_num = min(config_.thread_num, height / kSliceAlign);
+  if (slice_num < 2) {
+    return false;
+  }
+  int slice_height = (height / slice_num + kSliceAlign - 1) / kSliceAlign * kSliceAlign;
+  slice_rows_.clear();
+  for (int y = 0; y < height; y += slice_height) {
+    slice_rows_.push_back(y);
+  }
+  slice_rows_.push_back(height);
+
+  for (size_t i = 0; i + 1 < slice_rows_.size(); i++) {
+    int rows = slice_rows_[i + 1] - slice_rows_[i];
+    auto* slice_sws_ctx = sws_getContext(width_, rows, pixel_format_, width_, rows,
+                                         target_pixel_format_, GetSwsFlags(), nullptr, nullptr,
+                                         nullptr);
+    if (slice_sws_ctx == nullptr) {
+      for (auto* ctx : slice_sws_ctxs_) {
+        sws_freeContext(ctx);
+      }
+      slice_sws_ctxs_.clear();
+      slice_rows_.clear();
+      return false;
+    }
+    slice_sws_ctxs_.push_back(slice_sws_ctx);
+  }
+  // The calling thread converts a slice too.
+  thread_pool_ = make_unique<ThreadPool>(static_cast<int>(slice_sws_ctxs_.size()) - 1);
+  return true;
 }
 
 AVFrame* VideoFrameConvert::Convert(AVFrame* src) {
+  if (IsPassthrough(src)) {
+    return src;
+  }
+  if (sws_ctx_ == nullptr && slice_sws_ctxs_.empty()) {
+    // Set up for passthrough, but this frame differs from the expected format.
+    sws_ctx_ = sws_getContext(width_, height_, pixel_format_, target_width_, target_height_,
+                              target_pixel_format_, GetSwsFlags(), nullptr, nullptr, nullptr);
+    if (sws_ctx_ == nullptr) {
+      spdlog::error("sws_getContext failed, {}x{} {} -> {}x{} {}", width_, height_,
+                    pixel_format_, target_width_, target_height_, target_pixel_format_);
+      return target_frame_.get();
+    }
+  }
+  if (!slice_sws_ctxs_.empty()) {
+    thread_pool_->ParallelFor(static_cast<int>(slice_sws_ctxs_.size()),
+                              [&](int slice_index) { ConvertSlice(src, slice_index); });
+    return target_frame_.get();
+  }
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+  if (is_native_threading_) {
+    int ret = sws_scale_frame(sws_ctx_, target_frame_.get(), src);
+    if (ret < 0) {
+      spdlog::error("sws_scale_frame failed, ret {}", ret);
+    }
+    return target_frame_.get();
+  }
+#endif
   sws_scale(sws_ctx_, src->data, src->linesize, 0, src->height, target_frame_->data,
             target_frame_->linesize);
   return target_frame_.get();
 }
 
+void VideoFrameConvert::ConvertSlice(const AVFrame* src, int slice_index) {
+  int y = slice_rows_[slice_index];
+  int rows = slice_rows_[slice_index + 1] - y;
+
+  uint8_t* src_data[4] = {src->data[0], src->data[1], src->data[2], src->data[3]};
+  OffsetPlanes(av_pix_fmt_desc_get(static_cast<AVPixelFormat>(src->format)),
+               av_pix_fmt_count_planes(static_cast<AVPixelFormat>(src->format)), y, src->linesize,
+               src_data);
+  uint8_t* dst_data[4] = {target_frame_->data[0], target_frame_->data[1], target_frame_->data[2],
+                          target_frame_->data[3]};
+  OffsetPlanes(av_pix_fmt_desc_get(target_pixel_format_),
+               av_pix_fmt_count_planes(target_pixel_format_), y, target_frame_->linesize,
+               dst_data);
+  sws_scale(slice_sws_ctxs_[slice_index], src_data, src->linesize, 0, rows, dst_data,
+            target_frame_->linesize);
+}
+
 const vector<uint8_t>& VideoFrameConvert::ConvertToBytes(AVFrame* src) {
+  if (IsPassthrough(src)) {
+    // The decoder's rows are padded, pack them.
+    av_image_copy_to_buffer(target_frame_buff_.data(), static_cast<int>(target_frame_buff_.size()),
+                            src->data, src->linesize, target_pixel_format_, target_width_,
+                            target_height_, 1);
+    return target_frame_buff_;
+  }
   Convert(src);
   return target_frame_buff_;
 }
 
-}  // namespace ryoma
\ No newline at end of file
+bool VideoFrameConvert::IsPassthrough(const AVFrame* src) const {
+  return config_.passthrough && src->format == target_pixel_format_ &&
+         src->width == target_width_ && src->height == target_height_;
+}
+
+int VideoFrameConvert::GetSrcWidth() const { return width_; }
+
+int VideoFrameConvert::GetSrcHeight() const { return height_; }
+
+AVPixelFormat VideoFrameConvert::GetSrcPixelFormat() const { return pixel_format_; }
+
+int VideoFrameConvert::GetTargetWidth() const { return target_width_; }
+
+int VideoFrameConvert::GetTargetHeight() const { return target_height_; }
+
+int VideoFrameConvert::GetSwsFlags() const {
+  switch (config_.preset) {
+    case ScalePreset::kFastBilinear:
+      return SWS_FAST_BILINEAR;
+    case ScalePreset::kBilinear:
+      return SWS_BILINEAR;
+    case ScalePreset::kArea:
+      return SWS_AREA;
+    case ScalePreset::kBicubic:
+      return SWS_BICUBIC;
+    case ScalePreset::kLanczos:
+      return SWS_LANCZOS;
+  }
+  return SWS_BICUBIC;
+}
+
+}  // namespace ryoma
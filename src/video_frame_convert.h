@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 
+#include "thread_pool.h"
+
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libswscale/swscale.h"
@@ -13,26 +15,93 @@ using namespace std;
 
 namespace ryoma {
 
+enum class ConvertThreading {
+  // Horizontal slices on our own ThreadPool, one SwsContext per slice. Only for same size pairs
+  // that swscale converts row by row; other pairs use kNative.
+  kSliced,
+  // swscale's own "threads" option, needs libswscale 6 (FFmpeg 5.0) or newer.
+  kNative,
+};
+
+// Scaling algorithm, from fastest to sharpest.
+enum class ScalePreset {
+  kFastBilinear,
+  kBilinear,
+  kArea,
+  kBicubic,
+  kLanczos,
+};
+
+struct VideoFrameConvertConfig {
+  // 0 keeps the source size.
+  int target_width = 0;
+  int target_height = 0;
+  ScalePreset preset = ScalePreset::kBicubic;
+  // Hand the source frame back untouched when it already has the target format and size.
+  bool passthrough = true;
+
+  int thread_num = 1;
+  ConvertThreading threading = ConvertThreading::kSliced;
+};
+
 class VideoFrameConvert {
  public:
   explicit VideoFrameConvert(const AVCodecContext* video_codec_ctx,
-                             AVPixelFormat target_pixel_format = AV_PIX_FMT_YUV420P);
+                             AVPixelFormat target_pixel_format = AV_PIX_FMT_YUV420P,
+                             const VideoFrameConvertConfig& config = VideoFrameConvertConfig());
+  VideoFrameConvert(int width, int height, AVPixelFormat pixel_format,
+                    AVPixelFormat target_pixel_format,
+                    const VideoFrameConvertConfig& config = VideoFrameConvertConfig());
+  ~VideoFrameConvert();
 
+  VideoFrameConvert(const VideoFrameConvert&) = delete;
+  VideoFrameConvert& operator=(const VideoFrameConvert&) = delete;
+
+  // The result is owned by the converter, or is src itself on passthrough.
   AVFrame* Convert(AVFrame* src);
 
+  // Tightly packed target picture.
   const vector<uint8_t>& ConvertToBytes(AVFrame* src);
 
+  bool IsPassthrough(const AVFrame* src) const;
+
+  int GetSrcWidth() const;
+  int GetSrcHeight() const;
+  AVPixelFormat GetSrcPixelFormat() const;
+  int GetTargetWidth() const;
+  int GetTargetHeight() const;
+
  private:
   void Init();
+  bool InitNativeThreading();
+  bool InitSlices();
+
+  void ConvertSlice(const AVFrame* src, int slice_index);
+
+  int GetSwsFlags() const;
 
  private:
-  const AVCodecContext* video_codec_ctx_;
+  // Slice heights are a multiple of this, which keeps every chroma subsampling row aligned.
+  static constexpr int kSliceAlign = 16;
+
+  int width_ = 0;
+  int height_ = 0;
+  AVPixelFormat pixel_format_ = AV_PIX_FMT_NONE;
+  int target_width_ = 0;
+  int target_height_ = 0;
   AVPixelFormat target_pixel_format_;
+  VideoFrameConvertConfig config_;
 
   SwsContext* sws_ctx_ = nullptr;
+  bool is_native_threading_ = false;
+
+  vector<SwsContext*> slice_sws_ctxs_;
+  // First row of each slice, plus the frame height at the end.
+  vector<int> slice_rows_;
+  unique_ptr<ThreadPool> thread_pool_;
 
   shared_ptr<AVFrame> target_frame_;
   vector<uint8_t> target_frame_buff_;
 };
 
-}  // namespace ryoma
\ No newline at end of file
+}  // namespace ryoma
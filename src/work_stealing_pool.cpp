@@ -0,0 +1,118 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+namespace ryoma {
+
+namespace {
+
+// The pool and worker index running on this thread, nullptr and -1 elsewhere.
+thread_local const void* current_pool = nullptr;
+thread_local int current_worker = -1;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(int thread_num) {
+  if (thread_num <= 0) {
+    thread_num = max<int>(1, std::thread::hardware_concurrency());
+  }
+  for (int i = 0; i < thread_num; i++) {
+    workers_.push_back(make_unique<Worker>());
+  }
+  for (int i = 0; i < thread_num; i++) {
+    threads_.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    is_stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& worker : threads_) {
+    worker.join();
+  }
+}
+
+void WorkStealingPool::Submit(function<void()> task) {
+  size_t worker_index = current_pool == this ? current_worker
+                                             : next_worker_.fetch_add(1) % workers_.size();
+  {
+    // Queued under mutex_, so an idle worker either sees the task when it checks the deques or
+    // is already waiting for the notify. Counted in the same step, so Wait cannot miss it.
+    lock_guard<mutex> lock(mutex_);
+    pending_num_++;
+    auto& worker = *workers_[worker_index];
+    lock_guard<mutex> worker_lock(worker.tasks_mutex);
+    worker.tasks.push_back(move(task));
+  }
+  cond_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  done_cond_.wait(lock, [this] { return pending_num_ == 0; });
+}
+
+int WorkStealingPool::GetThreadNum() const { return static_cast<int>(threads_.size()); }
+
+uint64_t WorkStealingPool::GetStolenNum() const { return stolen_num_; }
+
+void WorkStealingPool::WorkerLoop(int worker_index) {
+  current_pool = this;
+  current_worker = worker_index;
+  while (true) {
+    function<void()> task;
+    if (PopTask(worker_index, task)) {
+      task();
+      lock_guard<mutex> lock(mutex_);
+      if (--pending_num_ == 0) {
+        done_cond_.notify_all();
+      }
+      continue;
+    }
+    unique_lock<mutex> lock(mutex_);
+    if (is_stop_) {
+      return;
+    }
+    cond_.wait(lock, [&] {
+      if (is_stop_) {
+        return true;
+      }
+      for (auto& worker : workers_) {
+        lock_guard<mutex> worker_lock(worker->tasks_mutex);
+        if (!worker->tasks.empty()) {
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+}
+
+bool WorkStealingPool::PopTask(int worker_index, function<void()>& task) {
+  {
+    auto& worker = *workers_[worker_index];
+    lock_guard<mutex> lock(worker.tasks_mutex);
+    if (!worker.tasks.empty()) {
+      task = move(worker.tasks.back());
+      worker.tasks.pop_back();
+      return true;
+    }
+  }
+  int worker_num = static_cast<int>(workers_.size());
+  for (int i = 1; i < worker_num; i++) {
+    auto& victim = *workers_[(worker_index + i) % worker_num];
+    lock_guard<mutex> lock(victim.tasks_mutex);
+    if (!victim.tasks.empty()) {
+      task = move(victim.tasks.front());
+      victim.tasks.pop_front();
+      stolen_num_++;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace ryoma
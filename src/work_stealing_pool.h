@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace ryoma {
+
+// Worker threads with one task deque each. A worker takes its own newest task first and, once
+// its deque is empty, steals the oldest task of another worker, so a few long jobs do not leave
+// the rest of the pool idle. Tasks submitted from a worker go to that worker's deque.
+class WorkStealingPool {
+ public:
+  // thread_num <= 0: one per core.
+  explicit WorkStealingPool(int thread_num = 0);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  void Submit(function<void()> task);
+  // Returns once every submitted task, including those submitted by tasks, has finished.
+  void Wait();
+
+  int GetThreadNum() const;
+  uint64_t GetStolenNum() const;
+
+ private:
+  struct Worker {
+    mutex tasks_mutex;
+    deque<function<void()>> tasks;
+  };
+
+  void WorkerLoop(int worker_index);
+  bool PopTask(int worker_index, function<void()>& task);
+
+ private:
+  vector<unique_ptr<Worker>> workers_;
+  vector<thread> threads_;
+
+  // Guards the sleep and wake up of idle workers and of Wait.
+  mutex mutex_;
+  condition_variable cond_;
+  condition_variable done_cond_;
+  // Submitted and not finished yet.
+  size_t pending_num_ = 0;
+  bool is_stop_ = false;
+
+  atomic<size_t> next_worker_{0};
+  atomic<uint64_t> stolen_num_{0};
+};
+
+}  // namespace ryoma